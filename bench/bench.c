@@ -0,0 +1,646 @@
+// Copyright 2024 Dominic Dwyer (dom@itsallbroken.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+//             http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+// Host-side power & wake-up benchmark.
+//
+// Loads main.elf into simavr, drives a set of scripted input scenarios for a
+// simulated 24h each, and reports how the MCU spent its cycles along with an
+// estimate of the charge drawn by the MCU over the day.
+//
+// This file is built for the host by `make bench` and is excluded from the
+// firmware sources.
+
+#include <avr_ioport.h>
+#include <sim_io.h>
+#include <sim_avr.h>
+#include <sim_cycle_timers.h>
+#include <sim_elf.h>
+#include <sim_time.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+/// The CPU frequency the firmware is built for (see F_CPU in the Makefile).
+#define BENCH_F_CPU 8000000UL
+
+/// Every scenario runs for this long (in simulated time).
+#define BENCH_DURATION_US (24ULL * 60 * 60 * 1000 * 1000)
+
+/// The channel layout of the firmware, passed in by the Makefile as for the
+/// firmware itself (see channel.h).
+#ifndef CHANNEL_COUNT
+#define CHANNEL_COUNT 2
+#endif
+#if CHANNEL_COUNT < 1 || CHANNEL_COUNT > 4
+#error "CHANNEL_COUNT must be between 1 and 4"
+#endif
+#if CHANNEL_COUNT > 2
+#define CHANNEL_EXPANDER
+#endif
+
+#ifdef RTC
+#error "the bench does not model the DS3231 - run `make sim RTC=1 CHANNELS=1`"
+#endif
+
+/// Pins in PORTB, mirroring pins.h.
+#ifdef CHANNEL_EXPANDER
+#define BUTTON_PIN 0
+#define EXPANDER_LATCH_PIN 3
+#define OVERFLOW_SENSE_PIN 4
+
+/// The shift register outputs: pump n on Qn, and the (active low) select of
+/// probe n on Q(n + 4).
+#define EXPANDER_PUMP(channel) (1 << (channel))
+#define EXPANDER_PROBE(channel) (1 << ((channel) + 4))
+#else
+#define BUTTON_PIN 0
+#define OVERFLOW_SIGNAL_PIN_1 1
+#define OVERFLOW_SIGNAL_PIN_2 2
+#define PUMP_PIN_1 3
+#define PUMP_PIN_2 4
+
+static const uint8_t PUMP_PINS[] = {PUMP_PIN_1, PUMP_PIN_2};
+static const uint8_t OVERFLOW_SIGNAL_PINS[] = {OVERFLOW_SIGNAL_PIN_1,
+                                               OVERFLOW_SIGNAL_PIN_2};
+#endif
+
+/// A scripted input wetting (level 0) or drying (level 1) the saucer of
+/// channel, rather than driving a pin in PORTB.
+#define SAUCER(channel) (8 + (channel))
+
+/// ATtiny85 data-space addresses (I/O address + 0x20).
+#define ADDR_WDTCR 0x41
+#define ADDR_PORTB 0x38
+#define ADDR_MCUCR 0x55
+#define ADDR_CLKPR 0x66
+
+/// USI registers, driving the telemetry output (see telemetry.h).
+#define ADDR_USIDR 0x2F
+#define ADDR_USICR 0x2D
+#define USICR_USICLK 0x02
+#define USICR_USITC 0x01
+
+/// The length of a telemetry bit: 13 ticks of timer 0 at F_CPU/64.
+#define TELEMETRY_BIT_CYCLES (13 * 64)
+
+/// MCUCR sleep mode bits & WDTCR enable bits.
+#define MCUCR_SM_MASK 0x18
+#define MCUCR_SM_IDLE 0x00
+#define MCUCR_SM_PWR_DOWN 0x10
+#define WDTCR_WDIE 0x40
+#define WDTCR_WDE 0x08
+
+/// The CLKPR change enable bit, opening the prescaler change sequence.
+#define CLKPR_CLKPCE 0x80
+
+/// The opcode of the RETI instruction, marking the end of an ISR.
+#define OPCODE_RETI 0x9518
+
+/// Supply current model for the ATtiny85 at VCC = 3V, in microamps.
+///
+/// Typical figures read from the "Typical Characteristics" section of the
+/// ATtiny25/45/85 datasheet (internal RC oscillator, 25C) - the active & idle
+/// currents are a fixed part plus a part proportional to the CPU clock
+/// (fitted to the 1MHz & 8MHz curves, as in host/sim.c).
+#define CURRENT_ACTIVE_UA 200.0
+#define CURRENT_ACTIVE_UA_PER_MHZ 300.0
+#define CURRENT_IDLE_UA 40.0
+#define CURRENT_IDLE_UA_PER_MHZ 89.0
+#define CURRENT_PWR_DOWN_WDT_UA 4.5
+#define CURRENT_PWR_DOWN_UA 0.15
+
+/// Interrupt vector names for the ATtiny85, indexed by vector number.
+static const char *const VECTOR_NAMES[] = {
+    "RESET",          "INT0_vect",       "PCINT0_vect",     "TIM1_COMPA_vect",
+    "TIM1_OVF_vect",  "TIM0_OVF_vect",   "EE_RDY_vect",     "ANA_COMP_vect",
+    "ADC_vect",       "TIM1_COMPB_vect", "TIM0_COMPA_vect", "TIM0_COMPB_vect",
+    "WDT_vect",       "USI_START_vect",  "USI_OVF_vect",
+};
+
+#define VECTOR_COUNT (sizeof(VECTOR_NAMES) / sizeof(VECTOR_NAMES[0]))
+
+/// A scripted change of an input pin (or SAUCER()) level, at an absolute
+/// simulation time.
+struct input_step {
+  uint64_t at_us;
+  uint8_t pin;
+  uint8_t level;
+};
+
+/// A named sequence of input changes.
+struct scenario {
+  const char *name;
+  const struct input_step *steps;
+  size_t n_steps;
+};
+
+#define MS(x) ((uint64_t)(x) * 1000)
+#define SECS(x) (MS(x) * 1000)
+
+/// A press (or release) of the button, bouncing for ~1ms before settling.
+#define BOUNCE(at, level)                                                      \
+  {(at), BUTTON_PIN, (level)}, {(at) + 150, BUTTON_PIN, !(level)},             \
+      {(at) + 300, BUTTON_PIN, (level)}, {(at) + 550, BUTTON_PIN, !(level)},   \
+      {(at) + 900, BUTTON_PIN, (level)}
+
+/// No inputs - the unit sleeps through a full day.
+static const struct input_step IDLE_DAY[] = {};
+
+/// Hold the button for 5 seconds, training a new pump duration.
+static const struct input_step TRAINING_PRESS[] = {
+    BOUNCE(SECS(2), 0),
+    BOUNCE(SECS(7), 1),
+};
+
+/// Tap the button for 300ms, triggering a test run of the pumps.
+static const struct input_step TEST_PRESS[] = {
+    BOUNCE(SECS(2), 0),
+    BOUNCE(SECS(2) + MS(300), 1),
+};
+
+/// Every saucer is wet for the whole day.
+static const struct input_step OVERFLOWED_SAUCER[] = {
+    {0, SAUCER(0), 0},
+    {0, SAUCER(1), 0},
+    {0, SAUCER(2), 0},
+    {0, SAUCER(3), 0},
+};
+
+#define SCENARIO(name, steps) {name, steps, sizeof(steps) / sizeof(steps[0])}
+
+static const struct scenario SCENARIOS[] = {
+    SCENARIO("idle_day", IDLE_DAY),
+    SCENARIO("training_press", TRAINING_PRESS),
+    SCENARIO("test_press", TEST_PRESS),
+    SCENARIO("overflowed_saucer", OVERFLOWED_SAUCER),
+};
+
+/// Per-vector ISR statistics.
+struct isr_stats {
+  uint64_t calls;
+  uint64_t max_cycles;
+};
+
+/// The measurements taken for a single scenario run.
+///
+/// Cycles are counted at the undivided system clock (BENCH_F_CPU), and clocks
+/// are those of the CPU - fewer while the clock is divided by CLKPR.
+struct bench_result {
+  uint64_t wakeups;
+  uint64_t active_cycles;
+  uint64_t active_clocks;
+  uint64_t idle_cycles;
+  uint64_t idle_clocks;
+  uint64_t pwr_down_cycles;
+  uint64_t pwr_down_wdt_cycles;
+  uint64_t pump_cycles[CHANNEL_COUNT];
+  struct isr_stats isr[VECTOR_COUNT];
+  bool halted;
+};
+
+/// Decoder state for the serial telemetry line (8N1), rebuilt from the USI
+/// register writes.
+struct telemetry_uart {
+  FILE *out;
+  /// The USI shift register, whose MSB drives the line.
+  uint8_t shift;
+  uint8_t level;
+  bool active;
+  avr_cycle_count_t start;
+  uint8_t bits;
+  uint16_t value;
+};
+
+/// The system clock prescaler, rebuilt from the CLKPR writes.
+struct clock_prescaler {
+  /// True once CLKPCE is written, until the next write.
+  bool change;
+  /// The division of the system clock.
+  uint32_t div;
+};
+
+/// Set by the end-of-run cycle timer.
+static bool RUN_DONE = false;
+
+/// A bitmap of channels (1 << channel index) with their saucer wet.
+static uint8_t WET = 0;
+
+#ifdef CHANNEL_EXPANDER
+/// The byte last loaded into USIDR, and the levels latched onto the shift
+/// register outputs.
+static uint8_t EXPANDER_SHIFT = 0;
+static uint8_t EXPANDER_OUTPUTS = 0;
+#endif
+
+/// Sleep callback that returns immediately, rather than sleeping the host
+/// thread for the simulated duration.
+static void bench_sleep(avr_t *avr, avr_cycle_count_t how_long) {
+  (void)avr;
+  (void)how_long;
+}
+
+/// Drive the external level of pin in PORTB.
+static void set_pin(avr_t *avr, uint8_t pin, uint8_t level) {
+  avr_raise_irq(avr_io_getirq(avr, AVR_IOCTL_IOPORT_GETIRQ('B'), pin), level);
+}
+
+/// Drive the overflow probe pins from the wet saucers - with the expander, the
+/// shared sense pin is pulled low by any wet probe selected by the outputs.
+static void update_probes(avr_t *avr) {
+#ifdef CHANNEL_EXPANDER
+  uint8_t selected = 0;
+  for (uint8_t i = 0; i < CHANNEL_COUNT; i++) {
+    if ((EXPANDER_OUTPUTS & EXPANDER_PROBE(i)) == 0) {
+      selected |= 1 << i;
+    }
+  }
+  set_pin(avr, OVERFLOW_SENSE_PIN, (WET & selected) == 0);
+#else
+  for (uint8_t i = 0; i < CHANNEL_COUNT; i++) {
+    set_pin(avr, OVERFLOW_SIGNAL_PINS[i], (WET & (1 << i)) == 0);
+  }
+#endif
+}
+
+/// Return true if the pump of channel is driven on, given the PORTB levels.
+static bool pump_on(uint8_t portb, uint8_t channel) {
+#ifdef CHANNEL_EXPANDER
+  (void)portb;
+  return EXPANDER_OUTPUTS & EXPANDER_PUMP(channel);
+#else
+  return portb & (1 << PUMP_PINS[channel]);
+#endif
+}
+
+static avr_cycle_count_t on_input_step(avr_t *avr, avr_cycle_count_t when,
+                                       void *param) {
+  (void)when;
+  const struct input_step *step = param;
+
+  if (step->pin < SAUCER(0)) {
+    set_pin(avr, step->pin, step->level);
+    return 0;
+  }
+
+  uint8_t channel = step->pin - SAUCER(0);
+  if (channel < CHANNEL_COUNT) {
+    WET = step->level ? WET & ~(1 << channel) : WET | (1 << channel);
+    update_probes(avr);
+  }
+  return 0;
+}
+
+static avr_cycle_count_t on_run_done(avr_t *avr, avr_cycle_count_t when,
+                                     void *param) {
+  (void)avr;
+  (void)when;
+  (void)param;
+  RUN_DONE = true;
+  return 0;
+}
+
+/// Sample the telemetry line at each bit centre before now, emitting complete
+/// characters.
+static void telemetry_advance(struct telemetry_uart *u,
+                              avr_cycle_count_t now) {
+  while (u->active) {
+    avr_cycle_count_t centre =
+        u->start + (2 * u->bits + 1) * TELEMETRY_BIT_CYCLES / 2;
+    if (centre >= now) {
+      break;
+    }
+
+    u->value |= (uint16_t)u->level << u->bits;
+    if (++u->bits == 10) {
+      // Drop framing errors: a low start bit and a high stop bit.
+      if ((u->value & 1) == 0 && (u->value >> 9) == 1) {
+        fputc((u->value >> 1) & 0xFF, u->out);
+      }
+      u->active = false;
+    }
+  }
+}
+
+/// Record the telemetry line changing to level at now.
+static void telemetry_line(struct telemetry_uart *u, avr_cycle_count_t now,
+                           uint8_t level) {
+  telemetry_advance(u, now);
+  if (!u->active && u->level == 1 && level == 0) {
+    u->active = true;
+    u->start = now;
+    u->bits = 0;
+    u->value = 0;
+  }
+  u->level = level;
+}
+
+/// Mirror the USI shift register (loaded through USIDR, and shifted by each
+/// USICLK strobe) independently of simavr's USI support.
+static void on_usi_write(avr_t *avr, avr_io_addr_t addr, uint8_t v,
+                         void *param) {
+  struct telemetry_uart *u = param;
+
+  if (addr == ADDR_USIDR) {
+    u->shift = v;
+    avr->data[addr] = v;
+  } else {
+    if (v & USICR_USICLK) {
+      u->shift <<= 1;
+    }
+    // The strobe bits always read as zero.
+    avr->data[addr] = v & ~(USICR_USICLK | USICR_USITC);
+  }
+
+  telemetry_line(u, avr->cycle, u->shift >> 7);
+}
+
+/// Follow the CLKPR change sequence - simavr executes at the undivided clock
+/// regardless of the prescaler, so the division is applied by the caller.
+///
+/// The 4 cycle window of the change sequence is not enforced.
+static void on_clkpr_write(avr_t *avr, avr_io_addr_t addr, uint8_t v,
+                           void *param) {
+  struct clock_prescaler *c = param;
+
+  if (v == CLKPR_CLKPCE) {
+    c->change = true;
+    return;
+  }
+
+  if (c->change && (v & CLKPR_CLKPCE) == 0) {
+    uint8_t prescale = v & 0x0F;
+    c->div = (uint32_t)1 << (prescale > 8 ? 8 : prescale);
+    avr->data[addr] = v & 0x0F;
+  }
+  c->change = false;
+}
+
+#ifdef CHANNEL_EXPANDER
+/// Record the byte loaded into USIDR - the firmware always shifts all 8 bits
+/// out to the shift register before latching them (see expander_update()).
+static void on_expander_write(avr_t *avr, avr_io_addr_t addr, uint8_t v,
+                              void *param) {
+  (void)param;
+  EXPANDER_SHIFT = v;
+  avr->data[addr] = v;
+}
+#endif
+
+/// Read the 16-bit instruction word at the byte address pc.
+static uint16_t opcode_at(const avr_t *avr, avr_flashaddr_t pc) {
+  return avr->flash[pc] | (avr->flash[pc + 1] << 8);
+}
+
+/// Execute the firmware in elf against scenario s, filling in result.
+///
+/// If telemetry is not NULL, the bytes sent on the telemetry line (in a
+/// `make TELEMETRY=1` build) are written to it.
+static int run_scenario(elf_firmware_t *elf, const struct scenario *s,
+                        struct bench_result *result, FILE *telemetry) {
+  avr_t *avr = avr_make_mcu_by_name("attiny85");
+  if (!avr) {
+    fprintf(stderr, "simavr does not support the attiny85\n");
+    return -1;
+  }
+
+  avr_init(avr);
+  avr->log = LOG_ERROR;
+  avr->sleep = bench_sleep;
+  avr_load_firmware(avr, elf);
+  avr->frequency = BENCH_F_CPU;
+
+  // All inputs idle high: button released, saucers dry.
+  WET = 0;
+#ifdef CHANNEL_EXPANDER
+  EXPANDER_SHIFT = 0;
+  EXPANDER_OUTPUTS = 0;
+  avr_register_io_write(avr, ADDR_USIDR, on_expander_write, NULL);
+#endif
+  set_pin(avr, BUTTON_PIN, 1);
+  update_probes(avr);
+
+  struct telemetry_uart uart = {.out = telemetry, .shift = 0xFF, .level = 1};
+  if (telemetry) {
+    avr_register_io_write(avr, ADDR_USIDR, on_usi_write, &uart);
+    avr_register_io_write(avr, ADDR_USICR, on_usi_write, &uart);
+  }
+
+  struct clock_prescaler clock = {.div = 1};
+  avr_register_io_write(avr, ADDR_CLKPR, on_clkpr_write, &clock);
+
+  for (size_t i = 0; i < s->n_steps; i++) {
+    avr_cycle_timer_register(avr, avr_usec_to_cycles(avr, s->steps[i].at_us),
+                             on_input_step, (void *)&s->steps[i]);
+  }
+
+  // The end-of-run timer also bounds how far a single sleep can jump forward,
+  // should the firmware sleep with no wake source armed.
+  RUN_DONE = false;
+  avr_cycle_timer_register(avr, avr_usec_to_cycles(avr, BENCH_DURATION_US),
+                           on_run_done, NULL);
+
+  memset(result, 0, sizeof(*result));
+
+  // ISR nesting is tracked as a small stack of (vector, entry cycle) pairs.
+  uint8_t isr_vector[4];
+  avr_cycle_count_t isr_entry[4];
+  uint8_t isr_depth = 0;
+
+  while (!RUN_DONE) {
+    int before_state = avr->state;
+    avr_cycle_count_t before_cycle = avr->cycle;
+    uint8_t mcucr = avr->data[ADDR_MCUCR];
+    uint8_t wdtcr = avr->data[ADDR_WDTCR];
+    uint8_t portb = avr->data[ADDR_PORTB];
+    uint32_t div = clock.div;
+    bool is_reti = before_state == cpu_Running &&
+                   opcode_at(avr, avr->pc) == OPCODE_RETI;
+
+    int state = avr_run(avr);
+
+    // simavr keeps running at the undivided clock regardless of CLKPR - a
+    // sleep lasts until a timed wake-up, so is already in real time, while
+    // each instruction executed takes div cycles of the undivided clock.
+    avr_cycle_count_t delta = avr->cycle - before_cycle;
+
+    if (before_state == cpu_Sleeping) {
+      switch (mcucr & MCUCR_SM_MASK) {
+      case MCUCR_SM_PWR_DOWN:
+        if (wdtcr & (WDTCR_WDIE | WDTCR_WDE)) {
+          result->pwr_down_wdt_cycles += delta;
+        } else {
+          result->pwr_down_cycles += delta;
+        }
+        break;
+      case MCUCR_SM_IDLE:
+      default:
+        // ADC noise reduction is not used - account it as idle.
+        result->idle_cycles += delta;
+        result->idle_clocks += delta / div;
+        break;
+      }
+      if (state == cpu_Running) {
+        result->wakeups++;
+      }
+    } else {
+      result->active_clocks += delta;
+      delta *= div;
+      result->active_cycles += delta;
+    }
+
+    for (uint8_t i = 0; i < CHANNEL_COUNT; i++) {
+      if (pump_on(portb, i)) {
+        result->pump_cycles[i] += delta;
+      }
+    }
+
+#ifdef CHANNEL_EXPANDER
+    // The outputs follow the shift register on a rising edge of the latch,
+    // pulsed for a single instruction.
+    uint8_t latch = 1 << EXPANDER_LATCH_PIN;
+    if ((avr->data[ADDR_PORTB] & latch) && !(portb & latch)) {
+      EXPANDER_OUTPUTS = EXPANDER_SHIFT;
+      update_probes(avr);
+    }
+#endif
+
+    if (is_reti && isr_depth > 0) {
+      isr_depth--;
+      struct isr_stats *st = &result->isr[isr_vector[isr_depth]];
+      uint64_t took = avr->cycle - isr_entry[isr_depth];
+      st->calls++;
+      if (took > st->max_cycles) {
+        st->max_cycles = took;
+      }
+    }
+
+    // Servicing an interrupt moves the PC onto the vector table entry.
+    if (avr->pc != 0 && avr->pc < VECTOR_COUNT * avr->vector_size &&
+        avr->pc % avr->vector_size == 0 && isr_depth < 4) {
+      isr_vector[isr_depth] = avr->pc / avr->vector_size;
+      isr_entry[isr_depth] = before_cycle;
+      isr_depth++;
+    }
+
+    if (state == cpu_Done || state == cpu_Crashed) {
+      // The firmware halted (sleeping with interrupts disabled) - the rest of
+      // the day is spent in power down.
+      result->halted = true;
+      result->pwr_down_cycles +=
+          avr_usec_to_cycles(avr, BENCH_DURATION_US) - avr->cycle;
+      break;
+    }
+  }
+
+  if (telemetry) {
+    telemetry_advance(&uart, (avr_cycle_count_t)-1);
+  }
+
+  avr_terminate(avr);
+  return 0;
+}
+
+/// Estimate the charge drawn by the MCU over the run, in microamp-hours.
+static double charge_uah(const struct bench_result *r) {
+  double ua_cycles = r->active_cycles * CURRENT_ACTIVE_UA +
+                     r->idle_cycles * CURRENT_IDLE_UA +
+                     r->pwr_down_wdt_cycles * CURRENT_PWR_DOWN_WDT_UA +
+                     r->pwr_down_cycles * CURRENT_PWR_DOWN_UA;
+  double ua_per_mhz_clocks = r->active_clocks * CURRENT_ACTIVE_UA_PER_MHZ +
+                             r->idle_clocks * CURRENT_IDLE_UA_PER_MHZ;
+
+  return (ua_cycles / BENCH_F_CPU + ua_per_mhz_clocks / 1000000) / 3600.0;
+}
+
+static void print_result(const struct scenario *s,
+                         const struct bench_result *r) {
+  printf("== %s%s\n", s->name, r->halted ? " (halted)" : "");
+  printf("  wake-ups               %12llu\n", (unsigned long long)r->wakeups);
+  printf("  active cycles          %12llu (CPU clocks: %llu)\n",
+         (unsigned long long)r->active_cycles,
+         (unsigned long long)r->active_clocks);
+  printf("  idle cycles            %12llu (CPU clocks: %llu)\n",
+         (unsigned long long)r->idle_cycles,
+         (unsigned long long)r->idle_clocks);
+  printf("  power-down cycles      %12llu (WDT on: %llu)\n",
+         (unsigned long long)(r->pwr_down_cycles + r->pwr_down_wdt_cycles),
+         (unsigned long long)r->pwr_down_wdt_cycles);
+  printf("  pump on (s)            %12.3f",
+         (double)r->pump_cycles[0] / BENCH_F_CPU);
+  for (uint8_t i = 1; i < CHANNEL_COUNT; i++) {
+    printf(" / %.3f", (double)r->pump_cycles[i] / BENCH_F_CPU);
+  }
+  printf("\n");
+
+  for (size_t v = 1; v < VECTOR_COUNT; v++) {
+    if (r->isr[v].calls == 0) {
+      continue;
+    }
+    printf("  %-22s %12llu cycles worst case (%llu calls)\n", VECTOR_NAMES[v],
+           (unsigned long long)r->isr[v].max_cycles,
+           (unsigned long long)r->isr[v].calls);
+  }
+
+  printf("  MCU charge / 24h (uAh) %12.1f\n\n", charge_uah(r));
+}
+
+int main(int argc, char **argv) {
+  if (argc < 2 || argc > 4) {
+    fprintf(stderr, "usage: %s <firmware.elf> [scenario [telemetry.bin]]\n",
+            argv[0]);
+    return 1;
+  }
+
+  FILE *telemetry = NULL;
+  if (argc > 3 && !(telemetry = fopen(argv[3], "wb"))) {
+    fprintf(stderr, "failed to open %s\n", argv[3]);
+    return 1;
+  }
+
+  elf_firmware_t elf;
+  memset(&elf, 0, sizeof(elf));
+  if (elf_read_firmware(argv[1], &elf) != 0) {
+    fprintf(stderr, "failed to read firmware %s\n", argv[1]);
+    return 1;
+  }
+  elf.frequency = BENCH_F_CPU;
+  strcpy(elf.mmcu, "attiny85");
+
+  bool matched = false;
+  for (size_t i = 0; i < sizeof(SCENARIOS) / sizeof(SCENARIOS[0]); i++) {
+    if (argc > 2 && strcmp(argv[2], SCENARIOS[i].name) != 0) {
+      continue;
+    }
+    matched = true;
+
+    struct bench_result result;
+    if (run_scenario(&elf, &SCENARIOS[i], &result, telemetry) != 0) {
+      return 1;
+    }
+    print_result(&SCENARIOS[i], &result);
+  }
+
+  if (telemetry) {
+    fclose(telemetry);
+  }
+
+  if (!matched) {
+    fprintf(stderr, "unknown scenario %s\n", argv[2]);
+    return 1;
+  }
+
+  return 0;
+}
@@ -0,0 +1,287 @@
+#include "channel.h"
+#include "event.h"
+#include "pins.h"
+#include "power.h"
+#include "telemetry.h"
+#include <util/atomic.h>
+#include <util/delay.h>
+
+/// The number of samples taken (and majority voted) per overflow reading. MUST
+/// be odd.
+#define OVERFLOW_SAMPLES 3
+_Static_assert(OVERFLOW_SAMPLES % 2 == 1);
+
+/// Delay between enabling the overflow pull-up and the first sample, letting
+/// the probe wires charge.
+#define OVERFLOW_SETTLE_US 100
+
+/// Delay between each overflow sample.
+#define OVERFLOW_SAMPLE_GAP_US 20
+
+/// @brief Return true if the majority of OVERFLOW_SAMPLES readings of the
+/// (pulled-up & settled) probe pin are low.
+static bool sample_low(uint8_t pin) {
+  uint8_t high = 0;
+  for (uint8_t i = 0; i < OVERFLOW_SAMPLES; i++) {
+    if (IS_HIGH(pin)) {
+      high++;
+    }
+    _delay_us(OVERFLOW_SAMPLE_GAP_US);
+  }
+
+  return high <= OVERFLOW_SAMPLES / 2;
+}
+
+#ifdef CHANNEL_EXPANDER
+
+/// The USI clocks out each bit on a rising edge of USCK, toggled by software
+/// (two strobes per bit).
+#define EXPANDER_BITS 8
+
+/// The select outputs of all the probes.
+#define EXPANDER_PROBES                                                        \
+  (EXPANDER_PROBE(0) | EXPANDER_PROBE(1) | EXPANDER_PROBE(2) |                 \
+   EXPANDER_PROBE(3))
+
+/// The levels last latched onto the shift register outputs.
+static volatile uint8_t OUTPUTS = 0;
+
+/// A bitmap of channels (1 << channel index) with their probe monitored.
+static uint8_t MONITORED = 0;
+
+/// @brief Latch (OUTPUTS | set) & ~clear onto the shift register outputs, if
+/// changed.
+///
+/// Called from both the pump PWM ISRs and the event handlers - the read,
+/// shift & latch is atomic.
+static void expander_update(uint8_t set, uint8_t clear) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    uint8_t outputs = (OUTPUTS | set) & ~clear;
+
+    if (outputs != OUTPUTS) {
+      OUTPUTS = outputs;
+
+      power_acquire(POWER_USI_EXPANDER);
+      USIDR = outputs;
+
+      // Hand DO & USCK to the USI before the first clock edge, then shift the
+      // register out MSB first - each strobe toggles USCK.
+      USICR = (1 << USIWM0) | (1 << USICS1) | (1 << USICLK);
+      for (uint8_t i = 0; i < EXPANDER_BITS * 2; i++) {
+        USICR = (1 << USIWM0) | (1 << USICS1) | (1 << USICLK) | (1 << USITC);
+      }
+      USICR = 0;
+
+      // Move the shifted bits onto the outputs together.
+      PORTB |= (1 << EXPANDER_LATCH_PIN);
+      PORTB &= ~(1 << EXPANDER_LATCH_PIN);
+      power_release(POWER_USI_EXPANDER);
+    }
+  }
+}
+
+/// @brief Latch every pump off and every probe deselected, whatever was last
+/// latched.
+static void expander_reset() {
+  OUTPUTS = (uint8_t)~EXPANDER_PROBES;
+  expander_update(EXPANDER_PROBES, (uint8_t)~EXPANDER_PROBES);
+}
+
+void channel_init() {
+  // The sense pin is an input, with the pull-up (and input buffer) disabled
+  // until a probe is read.
+  DDRB &= ~(1 << OVERFLOW_SENSE_PIN);
+  PORTB &= ~(1 << OVERFLOW_SENSE_PIN);
+
+  // The register outputs are undefined at power on.
+  expander_reset();
+}
+
+void channel_halt() {
+  // The outputs stay latched once PORTB is cleared - a pump left running
+  // would run on until the power is removed.
+  expander_reset();
+}
+
+void channel_on(uint8_t channel) { expander_update(EXPANDER_PUMP(channel), 0); }
+
+void channel_off(uint8_t channel) {
+  expander_update(0, EXPANDER_PUMP(channel));
+}
+
+/// @brief Select the probes of the channels in the bitmap, powering the sense
+/// line while any are selected.
+///
+/// The sense pin change interrupt is masked, as the line moves with the
+/// selection - see monitor_resume().
+static void probe_select(uint8_t channels) {
+  PCMSK &= ~(1 << OVERFLOW_SENSE_PIN);
+
+  uint8_t selected = 0;
+  for (uint8_t i = 0; i < CHANNEL_COUNT; i++) {
+    if (channels & (1 << i)) {
+      selected |= EXPANDER_PROBE(i);
+    }
+  }
+  expander_update(EXPANDER_PROBES & ~selected, selected);
+
+  if (channels == 0) {
+    PORTB &= ~(1 << OVERFLOW_SENSE_PIN);
+    power_input_disable(OVERFLOW_SENSE_PIN);
+    return;
+  }
+
+  power_input_enable(OVERFLOW_SENSE_PIN);
+  PORTB |= (1 << OVERFLOW_SENSE_PIN);
+  _delay_us(OVERFLOW_SETTLE_US);
+}
+
+/// @brief Re-enable the sense pin change interrupt for the monitored probes
+/// (selected by probe_select()), if any.
+///
+/// A probe that wetted while the interrupt was masked raises
+/// EVENT_STATE_OVERFLOW straight away, as no edge is left to interrupt on.
+static void monitor_resume() {
+  if (MONITORED == 0) {
+    return;
+  }
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    PCMSK |= (1 << OVERFLOW_SENSE_PIN);
+    if (!IS_HIGH(OVERFLOW_SENSE_PIN)) {
+      event_flag_set(EVENT_STATE_OVERFLOW);
+    }
+  }
+}
+
+/// @brief Return true if the saucer of channel is overflowing.
+///
+/// Only the probe of channel is selected while being read, so the sense line
+/// is pulled low only through its saucer - the monitored probes are selected
+/// again afterwards, or the line unpowered if there are none.
+bool channel_overflowed(uint8_t channel) {
+  probe_select(1 << channel);
+  bool overflowed = sample_low(OVERFLOW_SENSE_PIN);
+
+  probe_select(MONITORED);
+  monitor_resume();
+
+  return overflowed;
+}
+
+void channel_monitor_start(uint8_t channel) {
+  // All the monitored probes are selected together, any of them wetting
+  // pulling the sense line low - handle_event_overflow() reads each to find
+  // which.
+  MONITORED |= (1 << channel);
+  probe_select(MONITORED);
+  monitor_resume();
+}
+
+void channel_monitor_stop(uint8_t channel) {
+  MONITORED &= ~(1 << channel);
+  probe_select(MONITORED);
+  monitor_resume();
+}
+
+#else
+
+const uint8_t CHANNEL_PINS[CHANNEL_COUNT] = {
+    PUMP_PIN_1,
+#if CHANNEL_COUNT > 1
+    PUMP_PIN_2,
+#endif
+};
+
+/// The overflow detection pin of each channel, overflowed when low.
+static const uint8_t OVERFLOW_PINS[CHANNEL_COUNT] = {
+    OVERFLOW_SIGNAL_PIN_1,
+#if CHANNEL_COUNT > 1
+    OVERFLOW_SIGNAL_PIN_2,
+#endif
+};
+
+/// @brief Configure the overflow signal pins as inputs, with the pull-ups (and
+/// input buffers) disabled until read by channel_overflowed().
+void channel_init() {
+  // Set the overflow pins to input
+  DDRB &= ~OVERFLOW_SIGNAL_PINS;
+
+  // Disable the pull-ups, leaving the probes unpowered
+  PORTB &= ~OVERFLOW_SIGNAL_PINS;
+}
+
+/// @brief Return false if pin has been taken over by a debugging output (see
+/// telemetry.h & profile.h), leaving its overflow sensor unused.
+static bool overflow_pin_available(uint8_t pin) {
+  (void)pin;
+#ifdef TELEMETRY
+  if (pin == TELEMETRY_TX_PIN) {
+    return false;
+  }
+#endif
+#ifdef PROFILE_PIN
+  if (pin == PROFILE_PIN) {
+    return false;
+  }
+#endif
+  return true;
+}
+
+/// @brief Return true if the saucer of channel is overflowing.
+///
+/// The probe is only powered (by the pin pull-up) while being read, avoiding a
+/// continuous current through (and corrosion of) the wires in a wet saucer -
+/// unless it is being monitored by channel_monitor_start(), in which case it
+/// is left powered. Likewise the input buffer of the otherwise floating pin is
+/// only enabled while being read.
+bool channel_overflowed(uint8_t channel) {
+  uint8_t pin = OVERFLOW_PINS[channel];
+
+  if (!overflow_pin_available(pin)) {
+    return false;
+  }
+  bool monitored = (PCMSK & (1 << pin)) != 0;
+
+  power_input_enable(pin);
+  PORTB |= (1 << pin);
+  _delay_us(OVERFLOW_SETTLE_US);
+
+  // The pin is pulled low through the water when overflowing.
+  bool overflowed = sample_low(pin);
+
+  if (!monitored) {
+    PORTB &= ~(1 << pin);
+    power_input_disable(pin);
+  }
+
+  return overflowed;
+}
+
+void channel_monitor_start(uint8_t channel) {
+  uint8_t pin = OVERFLOW_PINS[channel];
+
+  if (!overflow_pin_available(pin)) {
+    return;
+  }
+
+  // Let the probe charge before enabling the interrupt, avoiding a spurious
+  // event from the rising edge.
+  power_input_enable(pin);
+  PORTB |= (1 << pin);
+  _delay_us(OVERFLOW_SETTLE_US);
+  PCMSK |= (1 << pin);
+}
+
+void channel_monitor_stop(uint8_t channel) {
+  uint8_t pin = OVERFLOW_PINS[channel];
+
+  if (!overflow_pin_available(pin)) {
+    return;
+  }
+  PCMSK &= ~(1 << pin);
+  PORTB &= ~(1 << pin);
+  power_input_disable(pin);
+}
+
+#endif /* CHANNEL_EXPANDER */
@@ -0,0 +1,80 @@
+#ifndef CHANNEL_H
+#define CHANNEL_H
+
+#include <avr/io.h>
+#include <stdbool.h>
+
+/// The number of watering channels, each a pump & the overflow probe in its
+/// saucer - set by `make CHANNELS=n` (run `make clean` when changing it).
+///
+/// Up to two channels are driven straight from PORTB pins (see pins.h), each
+/// probe on its own pin. Beyond that the pumps & probes are driven through a
+/// 74HC595 shift register clocked by the USI, with the probes multiplexed
+/// onto a single sense pin - the 8 outputs of a single register limit this to
+/// 4 channels.
+#ifndef CHANNEL_COUNT
+#define CHANNEL_COUNT 2
+#endif
+
+#if CHANNEL_COUNT < 1 || CHANNEL_COUNT > 4
+#error "CHANNEL_COUNT must be between 1 and 4"
+#endif
+
+#if CHANNEL_COUNT > 2
+#define CHANNEL_EXPANDER
+#endif
+
+/// A bitmap of all channels (1 << channel index).
+#define CHANNELS_ALL ((1 << CHANNEL_COUNT) - 1)
+
+/// Configure the pins of the pumps & overflow probes, with every pump off and
+/// every probe unpowered.
+extern void channel_init();
+
+#ifdef CHANNEL_EXPANDER
+
+/// The shift register outputs: pump n on Qn, and the (active low) select of
+/// probe n on Q(n + 4) - the wiring is the same for any channel count.
+#define EXPANDER_PUMP(channel) (1 << (channel))
+#define EXPANDER_PROBE(channel) (1 << ((channel) + 4))
+
+/// Drive the pump output of channel high.
+extern void channel_on(uint8_t channel);
+
+/// Drive the pump output of channel low.
+extern void channel_off(uint8_t channel);
+
+/// Latch every pump output low and every probe deselected, whatever the
+/// outputs last latched - for halt(), with interrupts disabled.
+extern void channel_halt();
+
+#else
+
+/// The pump output pin of each channel.
+extern const uint8_t CHANNEL_PINS[CHANNEL_COUNT];
+
+/// Drive the pump output of channel high.
+static inline void channel_on(uint8_t channel) {
+  PORTB |= (1 << CHANNEL_PINS[channel]);
+}
+
+/// Drive the pump output of channel low.
+static inline void channel_off(uint8_t channel) {
+  PORTB &= ~(1 << CHANNEL_PINS[channel]);
+}
+
+#endif /* CHANNEL_EXPANDER */
+
+/// Return true if the saucer of channel is overflowing.
+extern bool channel_overflowed(uint8_t channel);
+
+/// Power the overflow probe of channel and enable its pin change interrupt,
+/// raising EVENT_STATE_OVERFLOW as soon as the saucer wets.
+///
+/// The pump MUST be running - the probe draws current through a wet saucer.
+extern void channel_monitor_start(uint8_t channel);
+
+/// Stop monitoring the overflow probe of channel, unpowering it.
+extern void channel_monitor_stop(uint8_t channel);
+
+#endif /* CHANNEL_H */
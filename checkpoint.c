@@ -0,0 +1,94 @@
+#include "checkpoint.h"
+#include "clock.h"
+#include <avr/eeprom.h>
+#include <stddef.h>
+#include <util/crc16.h>
+
+/// The EEPROM bytes given to the checkpoint ring, the remainder after the
+/// settings & history rings.
+#define CHECKPOINT_EEPROM_BYTES 64
+
+/// The CRC-8 initial value - non-zero so that neither zero-filled nor erased
+/// cells form an intact record.
+#define CHECKPOINT_CRC_SEED 0xFF
+
+/// @brief A single record in the EEPROM ring.
+struct checkpoint_slot {
+  struct checkpoint checkpoint;
+  /// Incremented (wrapping) for each record written.
+  uint8_t seq;
+  /// CRC-8 of all the preceding fields, detecting a write torn by the reset
+  /// it guards against.
+  uint8_t crc;
+};
+
+/// The number of records in the EEPROM ring - as many as fit in
+/// CHECKPOINT_EEPROM_BYTES (5 with two channels).
+///
+/// A write torn by a power loss leaves the previous record as the newest
+/// intact one.
+#define CHECKPOINT_SLOT_COUNT                                                  \
+  ((uint8_t)(CHECKPOINT_EEPROM_BYTES / sizeof(struct checkpoint_slot)))
+_Static_assert(CHECKPOINT_EEPROM_BYTES / sizeof(struct checkpoint_slot) >= 2,
+               "The checkpoint ring needs at least two slots");
+
+/// The EEPROM ring of checkpoints, written in order and overwriting the
+/// oldest.
+static struct checkpoint_slot EEMEM CHECKPOINT_SLOTS[CHECKPOINT_SLOT_COUNT];
+
+/// The index of the newest intact slot, or CHECKPOINT_SLOT_COUNT if none.
+static uint8_t NEWEST = CHECKPOINT_SLOT_COUNT;
+
+/// The sequence number of the newest intact slot.
+static uint8_t NEWEST_SEQ = 0;
+
+/// @brief Compute the CRC-8 of slot, excluding the crc field itself.
+static uint8_t slot_crc(const struct checkpoint_slot *slot) {
+  const uint8_t *p = (const uint8_t *)slot;
+  uint8_t crc = CHECKPOINT_CRC_SEED;
+  for (uint8_t i = 0; i < offsetof(struct checkpoint_slot, crc); i++) {
+    crc = _crc8_ccitt_update(crc, p[i]);
+  }
+  return crc;
+}
+
+bool checkpoint_init(struct checkpoint *checkpoint) {
+  struct checkpoint_slot slot;
+
+  NEWEST = CHECKPOINT_SLOT_COUNT;
+  NEWEST_SEQ = 0;
+
+  for (uint8_t i = 0; i < CHECKPOINT_SLOT_COUNT; i++) {
+    eeprom_read_block(&slot, &CHECKPOINT_SLOTS[i], sizeof(slot));
+    if (slot.crc != slot_crc(&slot)) {
+      continue;
+    }
+
+    // As for the settings ring, all the intact records lie within
+    // CHECKPOINT_SLOT_COUNT of each other, so the signed difference orders
+    // them.
+    if (NEWEST == CHECKPOINT_SLOT_COUNT ||
+        (int8_t)(slot.seq - NEWEST_SEQ) > 0) {
+      NEWEST = i;
+      NEWEST_SEQ = slot.seq;
+      *checkpoint = slot.checkpoint;
+    }
+  }
+
+  return NEWEST != CHECKPOINT_SLOT_COUNT;
+}
+
+void checkpoint_save(const struct checkpoint *checkpoint) {
+  struct checkpoint_slot slot;
+  slot.checkpoint = *checkpoint;
+  slot.seq = NEWEST_SEQ + 1;
+  slot.crc = slot_crc(&slot);
+
+  NEWEST = NEWEST >= CHECKPOINT_SLOT_COUNT - 1 ? 0 : NEWEST + 1;
+  NEWEST_SEQ = slot.seq;
+
+  // Wait out the EEPROM write cycles at the reduced clock.
+  clock_slow();
+  eeprom_update_block(&slot, &CHECKPOINT_SLOTS[NEWEST], sizeof(slot));
+  clock_full();
+}
@@ -0,0 +1,35 @@
+#ifndef CHECKPOINT_H
+#define CHECKPOINT_H
+
+#include "channel.h"
+#include <avr/io.h>
+#include <stdbool.h>
+
+/// How often the watering schedule is checkpointed between routines, bounding
+/// how far it slips across a reset (see watering_resume()).
+///
+/// Each checkpoint is written to the next slot of a small EEPROM ring, so each
+/// cell is rewritten only every few hours - decades of its rated endurance.
+#define CHECKPOINT_INTERVAL_SECONDS ((uint32_t)60 * 60)
+
+/// @brief The progress of the watering schedule, persisted across resets.
+struct checkpoint {
+  /// The seconds remaining until the next watering routine of each pump.
+  uint32_t remaining_s[CHANNEL_COUNT];
+  /// A bitmap of pumps (1 << pump index) in a watering routine in progress
+  /// that have not yet run (or been skipped).
+  uint8_t unfinished;
+  /// Non-zero if the unfinished pumps are being retried after a reset.
+  uint8_t retried;
+};
+
+/// Load the newest intact checkpoint from EEPROM into checkpoint.
+///
+/// MUST be called once at boot, before checkpoint_save(). Returns false if
+/// none has been written yet (or all are torn), leaving checkpoint undefined.
+extern bool checkpoint_init(struct checkpoint *checkpoint);
+
+/// Write checkpoint to the next slot of the EEPROM ring.
+extern void checkpoint_save(const struct checkpoint *checkpoint);
+
+#endif /* CHECKPOINT_H */
@@ -0,0 +1,61 @@
+#include "clock.h"
+#include "power.h"
+#include <avr/io.h>
+#include <avr/power.h>
+#include <stdbool.h>
+#include <util/atomic.h>
+
+/// The following timer configuration assumes a clock frequency of 8MHz
+_Static_assert(F_CPU == 8000000);
+
+/// The timer 1 clock select bits counting at F_CPU/64 (as the PWM does) at
+/// the full and reduced system clock.
+#define TIMER1_CS_MASK 0x0F
+#define TIMER1_CS_FULL ((1 << CS12) | (1 << CS11) | (1 << CS10)) // DIV64
+#define TIMER1_CS_SLOW (1 << CS12)                               // DIV8
+
+/// True while the system clock is divided down to CLOCK_SLOW.
+static bool SLOW = false;
+
+void clock_slow() {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    if (SLOW) {
+      return;
+    }
+
+    // The debounce samples & telemetry bits are timed by timer 0, and are
+    // serviced at the full clock.
+    uint16_t users = power_users();
+    if (users & POWER_TIMER0_USERS) {
+      return;
+    }
+
+    // Timer 1 may only be running for the PWM, at the prescaler it can be
+    // adjusted from.
+    uint8_t cs = TCCR1 & TIMER1_CS_MASK;
+    if ((users & (POWER_TIMER1_USERS & ~POWER_TIMER1_PWM)) ||
+        (cs != 0 && cs != TIMER1_CS_FULL)) {
+      return;
+    }
+
+    clock_prescale_set(CLOCK_SLOW);
+    if (cs == TIMER1_CS_FULL) {
+      TCCR1 = (TCCR1 & ~TIMER1_CS_MASK) | TIMER1_CS_SLOW;
+    }
+    SLOW = true;
+  }
+}
+
+void clock_full() {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    if (!SLOW) {
+      return;
+    }
+
+    clock_prescale_set(clock_div_1);
+    if ((TCCR1 & TIMER1_CS_MASK) == TIMER1_CS_SLOW) {
+      TCCR1 = (TCCR1 & ~TIMER1_CS_MASK) | TIMER1_CS_FULL;
+    }
+    SLOW = false;
+  }
+}
@@ -0,0 +1,28 @@
+#ifndef CLOCK_H
+#define CLOCK_H
+
+/// The reduced system clock: F_CPU / 8 (1MHz).
+#define CLOCK_SLOW clock_div_8
+
+/// @brief Divide the system clock down to CLOCK_SLOW for a wait bound by time
+/// rather than CPU cycles, unless a running timer requires the full clock.
+///
+/// Active & idle current is a fixed part plus a part proportional to the
+/// clock, so work bound by CPU cycles costs the least at full speed (returning
+/// to sleep sooner) - while idling on a timer or busy-waiting on the EEPROM
+/// write cycle draws a fraction of the current at the reduced clock.
+///
+/// Timer 1 (the pump PWM) is switched to a prescaler keeping its tick rate, so
+/// the PWM period is unaffected. The clock is left at full speed while timer 0
+/// is running the button debounce or telemetry, or if timer 1 is the profiling
+/// clock.
+///
+/// _delay_ms() and _delay_us() are derived from F_CPU, and MUST NOT be used
+/// until clock_full() is called.
+extern void clock_slow();
+
+/// @brief Restore the full system clock (and timer 1 prescaler) after
+/// clock_slow().
+extern void clock_full();
+
+#endif /* CLOCK_H */
@@ -1,17 +1,21 @@
 #include "event.h"
 #include "event_handler/button.h"
 #include "event_handler/watchdog.h"
+#include "pins.h"
+#include "power.h"
+#include "profile.h"
+#include "telemetry.h"
+#include "wdt.h"
 #include <avr/interrupt.h>
-#include <avr/sleep.h>
 #include <avr/wdt.h>
 #include <stdbool.h>
 #include <util/atomic.h>
 
 /// A set of bit flags set
-static volatile uint8_t EVENT_STATE = 0;
+static volatile event_flags_t EVENT_STATE = 0;
 
 /// Return true if `flag` is set in `EVENT_STATE`.
-static bool event_flag_is_set(uint8_t flag) {
+static bool event_flag_is_set(event_flags_t flag) {
   return (EVENT_STATE & flag) != 0;
 }
 
@@ -19,7 +23,7 @@ static bool event_flag_is_set(uint8_t flag) {
 ///
 /// MUST be called in an atomic context (ISR or ATOMIC_BLOCK - see
 /// event_flag_clear()) to preserve atomicity of the change.
-void event_flag_set(uint8_t flag) { EVENT_STATE |= flag; }
+void event_flag_set(event_flags_t flag) { EVENT_STATE |= flag; }
 
 /// @brief Clear any pending event flags.
 void event_flag_reset() {
@@ -33,30 +37,100 @@ void event_flag_reset() {
 /// Because mutating the volatile EVENT_STATE is not atomic (compiles down to a
 /// load, modify, store) care must be taken to avoid overwriting flag bits set
 /// by an interleaved ISR.
-static void event_flag_clear(uint8_t flag) {
+///
+/// Each flag is cleared before its handler runs - a handler arming a timer
+/// that expires at once (setting the flag again) is run again on the next
+/// tick, rather than losing the event.
+static void event_flag_clear(event_flags_t flag) {
   ATOMIC_BLOCK(ATOMIC_FORCEON) { EVENT_STATE &= ~flag; }
 }
 
 void event_loop_tick() {
+  // The debounce samples are too frequent to be worth the bandwidth.
+  telemetry_events(EVENT_STATE & ~EVENT_STATE_BUTTON_SAMPLE);
+
+#ifdef RTC
+  // Before all else, restart the WDT after a suspended sleep - catching the
+  // uptime clock up with the RTC, and expiring the timers now due. Any other
+  // pin change was the button.
+  if (event_flag_is_set(EVENT_STATE_RTC_WAKE)) {
+    event_flag_clear(EVENT_STATE_RTC_WAKE);
+    PROFILE_BEGIN(profile);
+    bool alarm = wdt_resume();
+    ATOMIC_BLOCK(ATOMIC_FORCEON) {
+      if (!alarm || !IS_HIGH(BUTTON_PIN)) {
+        event_flag_set(EVENT_STATE_BUTTON);
+      }
+    }
+    PROFILE_END(Profile_EventRtcWake, profile);
+  }
+#endif
+
   // Priority is always given to the training pin.
   //
   // This flag is set if the pin change interrupt for the button has been fired.
   if (event_flag_is_set(EVENT_STATE_BUTTON)) {
-    handle_event_button();
     event_flag_clear(EVENT_STATE_BUTTON);
+    PROFILE_BEGIN(profile);
+    handle_event_button();
+    PROFILE_END(Profile_EventButton, profile);
+  }
+
+  // Followed by the debounce sampler, which processes a single button sample
+  // per tick before yielding.
+  if (event_flag_is_set(EVENT_STATE_BUTTON_SAMPLE)) {
+    event_flag_clear(EVENT_STATE_BUTTON_SAMPLE);
+    PROFILE_BEGIN(profile);
+    handle_event_button_sample();
+    PROFILE_END(Profile_EventButtonSample, profile);
+  }
+
+  // Followed by an overflow sensor changing while a pump is running, stopping
+  // it ahead of any timer event.
+  if (event_flag_is_set(EVENT_STATE_OVERFLOW)) {
+    event_flag_clear(EVENT_STATE_OVERFLOW);
+    PROFILE_BEGIN(profile);
+    handle_event_overflow();
+    PROFILE_END(Profile_EventOverflow, profile);
   }
 
   // If the button is not being actively pressed, process watchdog timer events.
   //
-  // This flag is set if the user-set timeout (driven by the watchdog timer) has
-  // elapsed.
-  if (event_flag_is_set(EVENT_STATE_WDT)) {
-    handle_event_watchdog();
-    event_flag_clear(EVENT_STATE_WDT);
+  // These flags are set if a pump's run duration or start offset (driven by
+  // the watchdog timer) has elapsed, advancing a watering routine already in
+  // progress.
+  for (uint8_t i = 0; i < CHANNEL_COUNT; i++) {
+    if (event_flag_is_set(EVENT_STATE_WDT_PUMP(i))) {
+      event_flag_clear(EVENT_STATE_WDT_PUMP(i));
+      PROFILE_BEGIN(profile);
+      handle_event_pump(i);
+      PROFILE_END(Profile_EventPump, profile);
+    }
   }
 
-  // Configure the sleep mode to enter the lowest power state.
-  set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+  // Set hourly, persisting the progress through the watering intervals -
+  // ahead of a routine starting in the same tick, so re-arming its timer
+  // never restarts the WDT under a running pump.
+  if (event_flag_is_set(EVENT_STATE_WDT_CHECKPOINT)) {
+    event_flag_clear(EVENT_STATE_WDT_CHECKPOINT);
+    PROFILE_BEGIN(profile);
+    handle_event_checkpoint();
+    PROFILE_END(Profile_EventCheckpoint, profile);
+  }
+
+  // These flags are set if the user-set interval of a pump (driven by the
+  // watchdog timer) has elapsed, starting a new watering routine.
+  for (uint8_t i = 0; i < CHANNEL_COUNT; i++) {
+    if (event_flag_is_set(EVENT_STATE_WDT_INTERVAL(i))) {
+      event_flag_clear(EVENT_STATE_WDT_INTERVAL(i));
+      PROFILE_BEGIN(profile);
+      handle_event_watering_interval(i);
+      PROFILE_END(Profile_EventInterval, profile);
+    }
+  }
+
+  telemetry_wdt(wdt_timer_next_expiry());
+  profile_report();
 
   // Perform a conditional sleep to avoid racing an incoming interrupt
   // intended to wake the device with the actual sleep.
@@ -69,16 +143,12 @@ void event_loop_tick() {
   // At this point no interrupt can fire - the system state can be evaluated and
   // an action taken atomically.
   if (EVENT_STATE == 0) {
-    sleep_enable();
-
-    // Re-enable interrupts.
-    //
-    // This guarantees next instruction is executed atomically (no interrupt can
-    // happen before the CPU sleep). Any pending (but not yet serviced)
-    // interrupts will immediately wake the device.
-    sei();
-    sleep_cpu();
-    sleep_disable(); // Wake here and restore system
+    // Hand long sleeps to the RTC alarm, if built with it.
+    wdt_suspend();
+    wdt_sleep();
+
+    // Sleep in the lowest power state the running peripherals allow.
+    power_sleep();
   }
   // Always re-enable interrupts before yielding control.
   sei();
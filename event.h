@@ -1,13 +1,47 @@
 #ifndef EVENT_H
 #define EVENT_H
 
+#include "channel.h"
 #include <avr/io.h>
 
+/// The pending event flags - wide enough for a flag per event of every
+/// channel.
+#if CHANNEL_COUNT <= 2
+typedef uint8_t event_flags_t;
+#else
+typedef uint16_t event_flags_t;
+#endif
+
 /// Flag bit definitions.
-#define EVENT_STATE_WDT (1 << 0)    // Watchdog timer interrupt fired
-#define EVENT_STATE_BUTTON (1 << 1) // PCINT interrupt fired
+#define EVENT_STATE_BUTTON (1 << 0)        // PCINT interrupt fired
+#define EVENT_STATE_BUTTON_SAMPLE (1 << 1) // Debounce timer interrupt fired
+#define EVENT_STATE_OVERFLOW (1 << 2)      // Overflow PCINT while pumping
+
+/// Followed by a flag per channel for each of its timers - the pump FSM timer
+/// of every channel, then the watering interval timer of every channel.
+#define EVENT_STATE_CHANNEL_SHIFT 3
+#define EVENT_STATE_WDT_PUMP(channel)                                          \
+  ((event_flags_t)1 << (EVENT_STATE_CHANNEL_SHIFT + (channel)))
+#define EVENT_STATE_WDT_INTERVAL(channel)                                      \
+  ((event_flags_t)1 << (EVENT_STATE_CHANNEL_SHIFT + CHANNEL_COUNT + (channel)))
+
+/// And last, the periodic checkpoint of the watering schedule.
+#define EVENT_STATE_WDT_CHECKPOINT                                             \
+  ((event_flags_t)1 << (EVENT_STATE_CHANNEL_SHIFT + 2 * CHANNEL_COUNT))
+
+/// In an RTC build, a pin change while the WDT is suspended (see
+/// wdt_suspend()) - the RTC alarm, or the button sharing its line.
+#ifdef RTC
+#define EVENT_STATE_RTC_WAKE                                                   \
+  ((event_flags_t)1 << (EVENT_STATE_CHANNEL_SHIFT + 2 * CHANNEL_COUNT + 1))
+#define EVENT_STATE_RTC_COUNT 1
+#else
+#define EVENT_STATE_RTC_COUNT 0
+#endif
 
-_Static_assert(EVENT_STATE_WDT != EVENT_STATE_BUTTON);
+_Static_assert(EVENT_STATE_CHANNEL_SHIFT + 2 * CHANNEL_COUNT + 1 +
+                   EVENT_STATE_RTC_COUNT <=
+               sizeof(event_flags_t) * 8);
 
 /// @brief Execute event loop.
 ///
@@ -15,7 +49,7 @@ _Static_assert(EVENT_STATE_WDT != EVENT_STATE_BUTTON);
 extern void run_event_loop();
 
 /// Set the specified `flag` in `EVENT_STATE`.
-extern void event_flag_set(uint8_t flag);
+extern void event_flag_set(event_flags_t flag);
 
 /// Reset the event flags, clearing all pending flags.
 extern void event_flag_reset();
@@ -1,10 +1,15 @@
 #include "button.h"
 #include "../event.h"
+#include "../hal.h"
 #include "../pins.h"
+#include "../power.h"
+#include "../profile.h"
+#include "../pump.h"
+#include "../settings.h"
+#include "../supply.h"
+#include "../telemetry.h"
 #include "../wdt.h"
 #include "watchdog.h"
-#include <avr/eeprom.h>
-#include <avr/power.h>
 #include <stdbool.h>
 #include <util/atomic.h>
 
@@ -15,160 +20,339 @@ _Static_assert(F_CPU == 8000000);
 #define BUTTON_DOWN 0b00000000
 #define BUTTON_UP 0b11111111
 
-/// The value of TIMER_TICKS after ~1 second.
-#define ONE_SECOND_TICKS 1000
+/// The duration of a press (in ms) starting a training run.
+#define ONE_SECOND_MS 1000
+
+#ifdef TELEMETRY
+/// Timer 0 is shared with the telemetry bit clock (see telemetry.c), counting
+/// at F_CPU/64 (8us) with a period of 125 ticks (1ms) - a sample is taken
+/// every BUTTON_SAMPLE_MS periods.
+#define TIMER_PRESCALER ((1 << CS01) | (1 << CS00)) // DIV64
+#define TICK_US 8
+#define PERIOD_TICKS 125
+#define SAMPLE_PERIODS BUTTON_SAMPLE_MS
+#else
+/// Timer 0 counts at F_CPU/1024 (128us), with a period of the nearest whole
+/// number of ticks to BUTTON_SAMPLE_MS - a sample is taken every period.
+#define TIMER_PRESCALER ((1 << CS02) | (1 << CS00)) // DIV1024
+#define TICK_US 128
+#define PERIOD_TICKS ((BUTTON_SAMPLE_MS * 1000UL + TICK_US / 2) / TICK_US)
+#define SAMPLE_PERIODS 1
+#endif
+
+_Static_assert(PERIOD_TICKS >= 1 && PERIOD_TICKS <= 256,
+               "BUTTON_SAMPLE_MS is out of range for timer 0");
+_Static_assert(SAMPLE_PERIODS >= 1 && SAMPLE_PERIODS <= 255,
+               "BUTTON_SAMPLE_MS is out of range for timer 0");
 
 /// @brief Enable the BUTTON_PIN change interrupt, assuming the Pin Change
 /// Interrupt Enable bit is set in the General Interrupt Mask Register.
 static void enable_pin_change_interrupt() { PCMSK |= (1 << BUTTON_PIN); }
-/// @brief Disable the BUTTON_PIN change interrupt, leaving the other pin
-/// interrupts unchanged.
-static void disable_pin_change_interrupt() { PCMSK &= ~(1 << BUTTON_PIN); }
 
-/// A timer incremented approximately once every millisecond.
-static volatile uint32_t TIMER_TICKS = 0;
-ISR(TIM0_COMPA_vect) { TIMER_TICKS += 1; } // ISR fires every 1ms.
+/// The number of whole timer periods counted since sampling started,
+/// extending the 8-bit counter - saturating at PERIODS_MAX, after ~6 days (~9.5
+/// hours in telemetry builds), beyond the longest trainable duration.
+static volatile uint32_t PERIODS = 0;
+
+/// The largest count of PERIODS, keeping timer_ticks() from wrapping.
+#define PERIODS_MAX (UINT32_MAX / PERIOD_TICKS - 2)
+
+#if SAMPLE_PERIODS > 1
+/// The number of periods until the next sample is due.
+static volatile uint8_t COUNTDOWN = SAMPLE_PERIODS;
+#endif
+
+// ISR fires once per timer period, requesting the next debounce sample be
+// taken when due.
+ISR(TIM0_COMPA_vect) {
+  PROFILE_BEGIN(profile);
+  if (PERIODS != PERIODS_MAX) {
+    PERIODS += 1;
+  }
+#if SAMPLE_PERIODS > 1
+  if (--COUNTDOWN == 0) {
+    COUNTDOWN = SAMPLE_PERIODS;
+    event_flag_set(EVENT_STATE_BUTTON_SAMPLE);
+  }
+#else
+  event_flag_set(EVENT_STATE_BUTTON_SAMPLE);
+#endif
+  PROFILE_END(Profile_IsrTim0CompA, profile);
+}
+
+/// The debounce accumulator, shifted left by one sample every sample period.
+static uint8_t ACCUMULATOR = 0;
+
+/// True once the debounced button state has passed through BUTTON_DOWN.
+static bool STARTED = false;
+
+/// True once the button has been held long enough to turn on the pump.
+static bool TRAINING = false;
+
+/// True while the timer is running and samples are being taken.
+static volatile bool SAMPLING = false;
+
+/// The time (in ticks) of the first falling (or rising) edge of the button pin
+/// since the last sample read it high (or low), and whether one has been seen.
+///
+/// Set by button_edge(), these timestamp the start & end of a press to the
+/// tick rather than the sample period - the accumulator delays both equally.
+static volatile uint32_t FALL_AT = 0;
+static volatile uint32_t RISE_AT = 0;
+static volatile bool FALLEN = false;
+static volatile bool RISEN = false;
+
+/// The level of the button pin when last read by button_edge() or a sample,
+/// telling its changes apart from those of the overflow pins sharing the pin
+/// change interrupt.
+static volatile bool LEVEL = true;
+
+/// The time (in ticks) the debounced press started.
+static uint32_t PRESSED_AT = 0;
+
+/// The supply voltage (in mV) measured as the training run started.
+static uint16_t TRAINING_SUPPLY_MV = 0;
+
+/// @brief Return the timer ticks counted since sampling started.
+///
+/// MUST be called while interrupts are disabled.
+static uint32_t timer_ticks() {
+  uint8_t count = TCNT0;
+  uint32_t periods = PERIODS;
+
+  // A compare match not yet serviced has restarted the counter - read it
+  // again, certain to be after the match.
+  if (TIFR & (1 << OCF0A)) {
+    count = TCNT0;
+    periods += 1;
+  }
+  return periods * PERIOD_TICKS + count;
+}
+
+/// @brief Convert a duration in timer ticks to milliseconds.
+///
+/// Split into whole & remaining thousands of ticks, as the product of ticks &
+/// TICK_US overflows after ~71 minutes.
+static uint32_t ticks_ms(uint32_t ticks) {
+  return ticks / 1000 * TICK_US + ticks % 1000 * TICK_US / 1000;
+}
 
-/// @brief Configure the TIM0_COMPA_vect interrupt to fire every millisecond.
+/// @brief Configure the TIM0_COMPA_vect interrupt to fire every timer period,
+/// timestamping the button pin change that started sampling.
 static void timer0_init() {
-  power_timer0_enable();
+  power_acquire(POWER_TIMER0_DEBOUNCE);
+
+  // In CTC mode the counter includes 0, so the match value is one less than
+  // the period.
+  OCR0A = PERIOD_TICKS - 1;
+
+  TCCR0B = TIMER_PRESCALER;
+  TCCR0A = (1 << WGM01); // CTC mode, int. on value match of OCR0A
+
+  ATOMIC_BLOCK(ATOMIC_FORCEON) {
+    // Discard any match from before sampling started (or from the telemetry
+    // sharing the timer) before enabling the interrupt.
+    hal_write(TIFR, 1 << OCF0A);
+    TIMSK |= (1 << OCIE0A);
+
+    PERIODS = 0;
+#if SAMPLE_PERIODS > 1
+    COUNTDOWN = SAMPLE_PERIODS;
+#endif
+
+    // The pin change raising this event is the first falling edge of the
+    // press - later edges (while bouncing) are ignored until a sample reads
+    // the pin high.
+    FALL_AT = timer_ticks();
+    FALLEN = true;
+    RISEN = false;
+  }
+}
+
+/// @brief Stop sampling the button.
+static void debounce_stop() {
+  // Disable the timer interrupt.
+  TIMSK &= ~(1 << OCIE0A);
+
+  // Release the timer to minimise the power draw (it keeps running if still
+  // clocking out telemetry).
+  power_release(POWER_TIMER0_DEBOUNCE);
+
+  SAMPLING = false;
+}
+
+/// @brief The debounced button has been pressed for the first time.
+static void press_started() {
+  // First always stop the pumps, if running.
+  watering_stop();
 
-  // Set the value of A that when reached, causes an interrupt at
-  // 1ms/1000Hz.
+  // NOTE: If a WDT interrupt fired and set a WDT event flag before this
+  // handler disabled the WDT, then the event flag may be set already.
   //
-  // At 8MHz, and a timer pre-scaler divisor of 64, a total of 125 ticks is
-  // exactly 1ms (125*64 = 8000, which is 1/1000th of 8,000,000).
-  OCR0A = 125;
+  // Disarm all the watchdog timers and clear any interrupt - the watering
+  // interval is restarted when the button is released.
+  wdt_cancel();
 
-  TCCR0B = (1 << CS01) | (1 << CS00); // Pre-scaler: DIV64
-  TCCR0A = (1 << WGM01);              // CTC mode, int. on value match of OCR0A
-  TIMSK |= (1 << OCIE0A);             // Enable a compare-match interrupt on A
+  // Clear the event flags should the interrupt have fired before being
+  // disabled.
+  event_flag_reset();
 
-  TIMER_TICKS = 0;
+  // Measure the time spent pressed from the first edge of the press.
+  ATOMIC_BLOCK(ATOMIC_FORCEON) { PRESSED_AT = FALL_AT; }
 }
 
-static void debounce() {
-  // Now de-bounce the pin and wait for one of two events:
+/// @brief The debounced button has been released after being held for
+/// held_ms.
+static void press_released(uint32_t held_ms) {
+  // Always ensure the pump is now turned off.
+  pump_stop(0);
+
+  // Either way, the next watering routine is scheduled a full interval after
+  // the button was released.
+  watering_schedule(PUMPS_ALL);
+
+  // If the time depressed was less than ~1 second, perform a pump test run.
+  if (held_ms < ONE_SECOND_MS) {
+    watering_start(PUMPS_ALL);
+    return;
+  }
+
+  // Otherwise record the duration of the button being held down (to the
+  // millisecond, and within the range of a valid record), and use it as the
+  // new duration all the pumps should be configured to run for.
   //
-  // * The pin goes back to 0 -> pump test
-  // * 1 second elapses -> start pump, recording the button depressed time
+  // The volume delivered is for the supply voltage of the training run, the
+  // duration of later runs scaled to deliver the same.
+  if (held_ms >= SETTINGS_MAX_ON_DURATION_MS) {
+    held_ms = SETTINGS_MAX_ON_DURATION_MS - 1;
+  }
 
-  // Start the 1ms interrupt timer.
-  timer0_init();
+  struct settings settings = *settings_get();
+  for (uint8_t i = 0; i < SETTINGS_PUMP_COUNT; i++) {
+    settings.pumps[i].on_duration_ms = held_ms;
+  }
+  settings.supply_ref_mv = TRAINING_SUPPLY_MV;
+  settings_save(&settings);
+}
 
-  uint8_t accumulator = 0;
-  uint8_t LAST_TICK = 0; // The LSB of TIMER_TICKS to save memory
-  bool started = false;
+bool button_edge() {
+  bool high = IS_HIGH(BUTTON_PIN);
+  if (high == LEVEL) {
+    return false;
+  }
+  LEVEL = high;
 
-  while (1) {
-    // Wait for a tick event every ~1ms
-    while (TIMER_TICKS == LAST_TICK) {
-    }
-    LAST_TICK = TIMER_TICKS;
-
-    // Read the button state
-    uint8_t state = (PINB >> BUTTON_PIN) & 1;
-
-    // Add it to the accumulator
-    accumulator <<= 1;
-    accumulator |= state;
-
-    // Process the debounced state
-    switch (accumulator) {
-    case BUTTON_UP: {
-      // Always ensure the pump is now turned off.
-      PORTB &= ~(1 << PUMP_PIN_1);
-
-      // If the button debounce state never passed through the "on" state, then
-      // simply return - the button was never "truly" pressed.
-      if (!started)
-        return;
-
-      // The button has been released.
-      //
-      // If the time depressed was less than ~1 second, perform a pump test run.
-      if (TIMER_TICKS < ONE_SECOND_TICKS) {
-        handle_event_watchdog();
-        return;
-      }
-
-      // Otherwise record the duration of the button being held down, and use it
-      // as the new duration the pumps should be configured to run for.
-      eeprom_write_word(&PUMP_ON_DURATION_SECONDS,
-                        TIMER_TICKS / ONE_SECOND_TICKS);
-
-      wdt_sleep_seconds(PUMP_INTERVAL_SECONDS);
-      return;
-    }
+  if (!SAMPLING) {
+    return true;
+  }
 
-    case BUTTON_DOWN:
-      // If the depress was already registered, do nothing.
-      if (!started) {
-        started = true;
-        // The button has been depressed for the first time.
-        //
-        // Start counting the ticks to measure the duration of time spent
-        // pressed.
-        TIMER_TICKS = 0;
-        // Reset LAST_TICK after TIMER_TICKS, so that if a tick happens
-        // concurrently, the spin loop immediately unblocks.
-        LAST_TICK = 0;
-        continue;
-      }
-
-      // If more than one second, start the training routine by turning on the
-      // pump.
-      if (TIMER_TICKS >= ONE_SECOND_TICKS) {
-        PORTB |= (1 << PUMP_PIN_1);
-      }
-
-      continue;
-
-    default:
-      continue;
+  if (high) {
+    if (!RISEN) {
+      RISE_AT = timer_ticks();
+      RISEN = true;
     }
+  } else if (!FALLEN) {
+    FALL_AT = timer_ticks();
+    FALLEN = true;
   }
+  return true;
 }
 
-void handle_event_button() {
-  // First always stop the pumps, if running.
-  PORTB &= ~(1 << PUMP_PIN_1);
-  PORTB &= ~(1 << PUMP_PIN_2);
-
-  // NOTE: If a pin-change interrupt occurred before this event handler disabled
-  // the pin change interrupts, or a WDT interrupt and set the WDT event flag
-  // before this handler disabled the WDT, then the respective interrupt flag
-  // and/or event flag may be set already.
+void handle_event_button_sample() {
+  // De-bounce the pin one sample at a time, waiting for one of two events:
   //
-  // Do not allow more pin change interrupts to fire. This does NOT clear any
-  // queued interrupt.
-  disable_pin_change_interrupt();
-
-  // Disable the watchdog timer and clear any interrupt
-  wdt_cancel();
+  // * The pin goes back to 0 -> pump test
+  // * 1 second elapses -> start pump, recording the button depressed time
+  //
+  // Control is yielded back to the event loop between samples, allowing the
+  // MCU to idle (and other events to be processed) while the button is held.
+  if (!SAMPLING)
+    return;
+
+  // Read the button state, restarting the search for the first edge away
+  // from it. Should the edge go unseen, it happened after this sample.
+  uint8_t state;
+  ATOMIC_BLOCK(ATOMIC_FORCEON) {
+    state = (PINB >> BUTTON_PIN) & 1;
+    LEVEL = state;
+    if (state) {
+      FALL_AT = timer_ticks();
+      FALLEN = false;
+    } else {
+      RISE_AT = timer_ticks();
+      RISEN = false;
+    }
+  }
 
-  // Clear the event flags should either interrupt have fired before being
-  // disabled.
-  event_flag_reset();
+  // Add it to the accumulator
+  ACCUMULATOR <<= 1;
+  ACCUMULATOR |= state;
+
+  // Process the debounced state
+  switch (ACCUMULATOR) {
+  case BUTTON_UP: {
+    // The press ended at the first edge of the release.
+    uint32_t released_at;
+    ATOMIC_BLOCK(ATOMIC_FORCEON) { released_at = RISE_AT; }
+    debounce_stop();
+
+    // If the button debounce state never passed through the "on" state, then
+    // simply return - the button was never "truly" pressed and nothing has
+    // been disturbed.
+    if (STARTED)
+      press_released(ticks_ms(released_at - PRESSED_AT));
+
+    return;
+  }
 
-  // Process the button change logic.
-  debounce();
+  case BUTTON_DOWN:
+    // If the depress was already registered, check the training threshold.
+    if (!STARTED) {
+      STARTED = true;
+      press_started();
+      return;
+    }
 
-  // Disable the timer interrupt.
-  TIMSK &= ~(1 << OCIE0A);
+    // If more than one second, start the training routine by turning on the
+    // pump.
+    uint32_t now;
+    ATOMIC_BLOCK(ATOMIC_FORCEON) { now = timer_ticks(); }
+    if (!TRAINING && ticks_ms(now - PRESSED_AT) >= ONE_SECOND_MS) {
+      TRAINING = true;
+      TRAINING_SUPPLY_MV = supply_read_mv();
+      pump_start(0);
+    }
+    return;
 
-  // Disable the timer to minimise the power draw.
-  power_timer0_disable();
+  default:
+    return;
+  }
+}
 
-  // Re-enable pin change interrupts to allow this code to be reached again.
-  enable_pin_change_interrupt();
+void handle_event_button() {
+  // The pin change interrupt is left enabled while sampling, timestamping
+  // each edge (see button_edge()) - the events it raises are absorbed by the
+  // debounce sampling below.
+  if (SAMPLING)
+    return;
+
+  // Start sampling the button state every BUTTON_SAMPLE_MS, processing each
+  // sample in handle_event_button_sample().
+  ACCUMULATOR = 0;
+  STARTED = false;
+  TRAINING = false;
+  SAMPLING = true;
+  timer0_init();
 }
 
+bool button_is_debouncing() { return SAMPLING; }
+
 /// @brief Configure BUTTON_PIN as an input with pull ups, and enable pin
 /// change interrupts.
 void init_event_button() {
-  // Set the button pin to input
+  // Set the button pin to input, always able to wake the MCU
   DDRB &= ~(1 << BUTTON_PIN);
+  power_input_enable(BUTTON_PIN);
 
   // Enable the pull-up for the button pin
   PORTB |= (1 << BUTTON_PIN);
@@ -1,7 +1,31 @@
 #ifndef HANDLER_BUTTON_H
 #define HANDLER_BUTTON_H
 
+#include <stdbool.h>
+
+/// The period (in ms) between debounce samples of the button, a press or
+/// release registering after 8 consistent samples - override with
+/// -DBUTTON_SAMPLE_MS=n (up to 32ms).
+///
+/// Only the debounce latency depends on it: the duration of a press is timed
+/// from its edges.
+#ifndef BUTTON_SAMPLE_MS
+#define BUTTON_SAMPLE_MS 10
+#endif
+
 extern void init_event_button();
 extern void handle_event_button();
+extern void handle_event_button_sample();
+
+/// Timestamp a change of the button pin while it is being sampled, called from
+/// the pin change interrupt - returning false if the button pin is unchanged
+/// (the change was of another pin).
+///
+/// MUST be called while interrupts are disabled.
+extern bool button_edge();
+
+/// Returns true while the button is being sampled, with timer 0 configured for
+/// the debounce sample period.
+extern bool button_is_debouncing();
 
 #endif /* HANDLER_BUTTON_H */
\ No newline at end of file
@@ -1,158 +1,573 @@
 #include "watchdog.h"
+#include "../channel.h"
+#include "../checkpoint.h"
+#include "../event.h"
 #include "../halt.h"
-#include "../pins.h"
+#include "../history.h"
+#include "../led.h"
+#include "../pump.h"
+#include "../rtc.h"
+#include "../settings.h"
+#include "../supply.h"
+#include "../telemetry.h"
 #include "../wdt.h"
-#include <avr/eeprom.h>
 #include <stdbool.h>
-#include <util/delay.h>
 
-/// Specify the default pump value if not previously set by the user.
-uint16_t EEMEM PUMP_ON_DURATION_SECONDS = 5;
+_Static_assert(PUMPS_ALL == (1 << SETTINGS_PUMP_COUNT) - 1);
 
-/// @brief A helper enum to describe the state of the pump FSM.
-enum PumpRoutineState {
-  Pump1_On = 0,       // Must be 0 (no set bits)
-  Pump1_Off = 1 << 0, // Other values must be a single set bit value
-  Pump2_On = 1 << 1,
-  Pump2_Off = 1 << 2
+/// @brief The state of a single pump channel in the watering routine.
+enum PumpState {
+  Pump_Idle = 0, // Off, and not part of the routine
+  Pump_Waiting,  // Off, waiting for the start timer to expire
+  Pump_Running,  // On, waiting for the run timer to expire
+  Pump_Flashing, // Skipped, flashing the LED pattern one step per timer
+  Pump_Settling, // Off, waiting for the current to settle before the next
 };
 
-_Static_assert(Pump1_On == 0);
-_Static_assert(Pump1_On != Pump1_Off);
-_Static_assert(Pump1_On != Pump2_On);
-_Static_assert(Pump1_On != Pump2_Off);
-_Static_assert(Pump1_Off != Pump2_Off);
-_Static_assert(Pump1_Off != Pump2_On);
-_Static_assert(Pump2_On != Pump2_Off);
+/// The current FSM state (a PumpState) of each pump channel.
+static uint8_t PUMP_STATE[SETTINGS_PUMP_COUNT];
 
-/// @brief Configure OVERFLOW_SIGNAL_PIN_1 as an input with pull ups.
-void init_overflow_sensor() {
-  // Set the button pin to input
-  DDRB &= ~(1 << OVERFLOW_SIGNAL_PIN_1);
+/// @brief Move pump to the given (PumpState) state.
+static void pump_state_set(uint8_t pump, uint8_t state) {
+  PUMP_STATE[pump] = state;
+  telemetry_pump(pump, state);
+}
+
+/// The uptime (see wdt_uptime()) each pump's next watering routine starts at.
+static uint32_t NEXT_WATERING[SETTINGS_PUMP_COUNT];
+
+/// A bitmap of pumps (1 << pump index) due to run in the watering routine.
+static uint8_t PUMPS_DUE = 0;
+
+/// A bitmap of pumps in the watering routine that have not yet run (or been
+/// skipped), and true if they are being retried after a reset - both
+/// checkpointed, see watering_resume().
+static uint8_t PUMPS_UNFINISHED = 0;
+static bool RETRYING = false;
+
+/// The uptime the next periodic checkpoint is written at.
+static uint32_t NEXT_CHECKPOINT;
+
+/// In adaptive mode, the interval between overflow readings while pumping - a
+/// whole number of the shortest (16ms) WDT intervals, so no period is rounded
+/// up to the next.
+#define ADAPT_POLL_MS 256
+
+/// In adaptive mode, the largest reduction of the run duration after a single
+/// overflowing run, as a fraction (1/n) of the duration.
+#define ADAPT_SHRINK_DIV 8
+
+/// In adaptive mode, the increase of the run duration after a run that did not
+/// overflow, as a fraction (1/n) of the duration, and at least
+/// ADAPT_MIN_STEP_MS.
+#define ADAPT_GROW_DIV 32
+#define ADAPT_MIN_STEP_MS 100
+
+/// The run duration (in milliseconds) of each running pump, the uptime (see
+/// wdt_uptime_ms()) it started at, and the time it has run for by the time its
+/// run timer expires.
+static uint32_t RUN_DURATION_MS[SETTINGS_PUMP_COUNT];
+static uint32_t RUN_STARTED_MS[SETTINGS_PUMP_COUNT];
+static uint32_t RUN_ELAPSED_MS[SETTINGS_PUMP_COUNT];
+
+/// The supply voltage (in mV) measured as each running pump started.
+static uint16_t RUN_SUPPLY_MV[SETTINGS_PUMP_COUNT];
+
+/// Delay between a pump stopping and the next starting in sequential mode,
+/// letting the pump/current settle.
+#define SEQUENTIAL_SETTLE_MS 200
+
+/// @brief Return true if the pump was due to run and is enabled, clearing the
+/// due bit.
+static bool take_due(uint8_t pump) {
+  bool due = (PUMPS_DUE & (1 << pump)) != 0;
+  PUMPS_DUE &= ~(1 << pump);
+  return due && settings_get()->pumps[pump].enabled;
+}
+
+/// @brief Return the uptime of the first water_at_min time of day (see
+/// settings.h) no earlier than up to early seconds before due, nor than now -
+/// or due unchanged if watering at any time of day, or the time of day is
+/// unknown.
+static uint32_t align_time_of_day(uint32_t due, uint32_t early) {
+  uint16_t water_at_min = settings_get()->water_at_min;
+  uint32_t now = wdt_uptime();
+  uint32_t from = due - early;
+  if ((int32_t)(from - now) < 0) {
+    from = now;
+  }
+
+  uint32_t time_of_day;
+  if (water_at_min == SETTINGS_WATER_AT_NONE ||
+      !wdt_time_of_day(from, &time_of_day)) {
+    return due;
+  }
+
+  uint32_t water_at = (uint32_t)water_at_min * 60;
+  if (water_at < time_of_day) {
+    water_at += RTC_DAY_SECONDS;
+  }
+  return from + (water_at - time_of_day);
+}
+
+/// @brief Persist the time remaining until each pump's next routine, and the
+/// pumps of the routine in progress yet to finish.
+static void checkpoint() {
+  struct checkpoint c;
+  uint32_t now = wdt_uptime();
+
+  for (uint8_t i = 0; i < SETTINGS_PUMP_COUNT; i++) {
+    int32_t remaining = (int32_t)(NEXT_WATERING[i] - now);
+    c.remaining_s[i] = remaining > 0 ? remaining : 0;
+  }
+  c.unfinished = PUMPS_UNFINISHED;
+  c.retried = RETRYING;
+
+  checkpoint_save(&c);
+}
+
+/// @brief (Re)start the periodic checkpoint, CHECKPOINT_INTERVAL_SECONDS from
+/// now.
+static void checkpoint_arm() {
+  NEXT_CHECKPOINT = wdt_uptime() + CHECKPOINT_INTERVAL_SECONDS;
+  wdt_timer_at(EVENT_STATE_WDT_CHECKPOINT, NEXT_CHECKPOINT);
+}
+
+/// @brief Mark pump as finished with for the watering routine (run or
+/// skipped), checkpointing the change.
+static void routine_finished(uint8_t pump) {
+  PUMPS_UNFINISHED &= ~(1 << pump);
+  if (PUMPS_UNFINISHED == 0) {
+    RETRYING = false;
+  }
+  checkpoint();
+}
+
+/// @brief Return the configured run duration of pump, scaled to deliver the
+/// same volume at a supply of supply_mv.
+static uint32_t pump_on_duration_ms(uint8_t pump, uint16_t supply_mv) {
+  const struct settings *settings = settings_get();
+  return supply_scale_ms(settings->pumps[pump].on_duration_ms,
+                         settings->supply_ref_mv, supply_mv);
+}
 
-  // Enable the pull-up for the button pin
-  PORTB |= (1 << OVERFLOW_SIGNAL_PIN_1);
+/// @brief Arm the run timer of pump for the rest of its run.
+///
+/// In adaptive mode the run is split into ADAPT_POLL_MS periods, reading the
+/// overflow sensor between each - a remainder too short for the WDT to time
+/// is run on by the period before it.
+static void arm_run(uint8_t pump) {
+  uint32_t ms = RUN_DURATION_MS[pump] - RUN_ELAPSED_MS[pump];
+  if (settings_get()->pumps[pump].adaptive &&
+      ms >= ADAPT_POLL_MS + WDT_TIMER_RESOLUTION_MS) {
+    ms = ADAPT_POLL_MS;
+  }
+
+  RUN_ELAPSED_MS[pump] += ms;
+  wdt_timer_arm_ms(EVENT_STATE_WDT_PUMP(pump), ms);
 }
 
-/// @brief Pulse the pin 3 times in quick succession, flashing the pump LED.
-void triple_flash(uint8_t pin) {
-  for (uint8_t i = 3; i > 0; i--) {
-    PORTB |= (1 << pin);
-    _delay_ms(100);
-    PORTB &= ~(1 << pin);
-    _delay_ms(100);
+/// @brief Nudge the stored run duration of pump towards the configured margin
+/// below the point its saucer overflowed.
+/// @param elapsed_ms The time pump ran for, at the supply voltage of
+/// RUN_SUPPLY_MV.
+/// @param overflowed True if the run was cut short by the saucer overflowing,
+/// false if it completed without overflowing.
+static void adapt_duration(uint8_t pump, uint32_t elapsed_ms,
+                           bool overflowed) {
+  struct settings s = *settings_get();
+  uint32_t *duration = &s.pumps[pump].on_duration_ms;
+
+  // The stored duration is for the reference supply voltage.
+  elapsed_ms =
+      supply_scale_ms(elapsed_ms, RUN_SUPPLY_MV[pump], s.supply_ref_mv);
+
+  if (overflowed) {
+    // Aim for the margin below the overflow point, bounding the step so a
+    // single spurious reading can't wreck the duration.
+    uint32_t target =
+        elapsed_ms - (elapsed_ms / 100) * settings_get()->adapt_margin_pct;
+    uint32_t max_step = *duration / ADAPT_SHRINK_DIV;
+    if (*duration > target + max_step) {
+      *duration -= max_step;
+    } else if (*duration > target) {
+      *duration = target;
+    }
+  } else {
+    // Creep back up to track the plant's changing needs.
+    uint32_t step = *duration / ADAPT_GROW_DIV;
+    if (step < ADAPT_MIN_STEP_MS) {
+      step = ADAPT_MIN_STEP_MS;
+    }
+    if (*duration + step < SETTINGS_MAX_ON_DURATION_MS) {
+      *duration += step;
+    }
   }
+
+  settings_save(&s);
 }
 
-/// @brief Check if the provided overflow pin is high, and if so, turn on the
-/// pump pin.
-/// @param overflow_pin The overflow detection pin, overflowed when low.
-/// @param pump_pin Pump pin to enable
+/// @brief Check if the saucer of pump is dry, and if so, turn on the
+/// pump and arm its run timer - otherwise flash the pump LED to show it was
+/// skipped, stepped by the same timer.
+/// @param pump The index of the pump to start.
 /// @return True if the pump was enabled, false if overflowed.
-static bool check_and_pump(uint8_t overflow_pin, uint8_t pump_pin) {
+static bool check_and_pump(uint8_t pump) {
   // Check if the pump can run.
-  if (!IS_HIGH(overflow_pin)) {
-    triple_flash(pump_pin);
+  if (channel_overflowed(pump)) {
+    history_record(pump, HISTORY_OVERFLOW_SKIPPED, 0);
+    routine_finished(pump);
+    led_start(pump, LED_PATTERN_SKIPPED);
+    pump_state_set(pump, Pump_Flashing);
+    wdt_timer_arm_ms(EVENT_STATE_WDT_PUMP(pump), LED_STEP_MS);
     return false;
   }
 
-  // Turn the pump on.
-  PORTB |= (1 << pump_pin);
+  // Measure the supply before loading it, scaling the run to deliver the
+  // configured volume.
+  RUN_SUPPLY_MV[pump] = supply_read_mv();
+
+  // Turn the pump on, soft-starting it if configured, and stop it early if the
+  // saucer overflows.
+  pump_start(pump);
+  channel_monitor_start(pump);
+  pump_state_set(pump, Pump_Running);
+
+  // Sleep and wait to be woken to turn it off again.
+  RUN_DURATION_MS[pump] = pump_on_duration_ms(pump, RUN_SUPPLY_MV[pump]);
+  RUN_STARTED_MS[pump] = wdt_uptime_ms();
+  RUN_ELAPSED_MS[pump] = 0;
+  arm_run(pump);
 
   return true;
 }
 
-void handle_event_watchdog() {
+/// @brief Turn off pump, returning it to the idle state.
+static void pump_off(uint8_t pump) {
+  channel_monitor_stop(pump);
+  pump_stop(pump);
+  pump_state_set(pump, Pump_Idle);
+}
+
+/// @brief Return true if any pump is part of an in-progress routine.
+static bool routine_running() {
+  for (uint8_t i = 0; i < SETTINGS_PUMP_COUNT; i++) {
+    if (PUMP_STATE[i] != Pump_Idle) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/// @brief Start the next due pump, one at a time.
+static void advance_sequential() {
+  for (uint8_t i = 0; i < SETTINGS_PUMP_COUNT; i++) {
+    if (take_due(i)) {
+      check_and_pump(i);
+      return; // Sleep and wait to be woken by the run (or flash) timer.
+    }
+  }
+}
+
+/// @brief Start all due pumps together, each offset from the previous by the
+/// configured stagger to avoid coinciding inrush currents.
+static void advance_concurrent() {
+  uint16_t offset_ms = 0;
+
+  for (uint8_t i = 0; i < SETTINGS_PUMP_COUNT; i++) {
+    if (!take_due(i)) {
+      continue;
+    }
+
+    if (offset_ms == 0) {
+      // Nothing has started yet - try this pump now.
+      if (check_and_pump(i)) {
+        offset_ms = settings_get()->stagger_ms;
+      }
+      continue;
+    }
 
-  // The watering routine is a simple state machine:
+    // Wait for the start timer before checking the overflow sensor & starting.
+    pump_state_set(i, Pump_Waiting);
+    wdt_timer_arm_ms(EVENT_STATE_WDT_PUMP(i), offset_ms);
+    offset_ms += settings_get()->stagger_ms;
+  }
+}
+
+/// @brief Start the due pumps according to the configured mode.
+static void advance() {
+  if (settings_get()->concurrent) {
+    advance_concurrent();
+  } else {
+    advance_sequential();
+  }
+}
+
+/// @brief Stop the running pump at the end of its run, or as its saucer
+/// overflowed.
+static void run_finished(uint8_t pump, bool overflowed) {
+  pump_off(pump);
+  history_record(pump, overflowed ? HISTORY_OVERFLOW_STOPPED : 0,
+                 RUN_ELAPSED_MS[pump]);
+  routine_finished(pump);
+
+  if (settings_get()->pumps[pump].adaptive) {
+    adapt_duration(pump, RUN_ELAPSED_MS[pump], overflowed);
+  }
+
+  if (!settings_get()->concurrent && PUMPS_DUE != 0) {
+    // Let the pump/current settle before the next starts, sleeping until the
+    // timer wakes this pump's FSM again.
+    pump_state_set(pump, Pump_Settling);
+    wdt_timer_arm_ms(EVENT_STATE_WDT_PUMP(pump), SEQUENTIAL_SETTLE_MS);
+  }
+}
+
+/// @brief Move the watering routine on after a pump FSM transition.
+static void routine_continue() {
+  // Once every pump has stopped (and settled, or finished flashing), start the
+  // next due pump(s) - in sequential mode this moves on to the next channel,
+  // and in either mode this picks up pumps that became due while the routine
+  // was running.
+  if (!routine_running()) {
+    advance();
+  }
+}
+
+void handle_event_pump(uint8_t pump) {
+  // Each pump channel is a simple state machine, driven by its own timer:
+  //
+  //   ┌──────┐ Concurrent ┌─────────┐           ┌─────────────┐
+  //   │ Idle │──────────▶ │ Waiting │── Timer ─▶│ Overflowed? │──No──┐
+  //   └──────┘            └─────────┘           └─────────────┘      │
+  //    ▲ ▲ ▲                                           │             ▼
+  //    │ │ │   ┌──────────┐                           Yes      ┌─────────┐
+  //    │ │ └───│ Flashing │◀───────────────────────────┘       │ Running │
+  //    │ │     └──────────┘                                    └─────────┘
+  //    │ │     ┌──────────┐                                         │
+  //    │ └─────│ Settling │◀──────── Timer (Sequential, more due) ───┤
+  //    │       └──────────┘                                         │
+  //    └──────────────────────────── Timer ─────────────────────────┘
   //
-  //            ┌────────────────┐
-  //            │                │
-  //            │                ▼
-  //            │          ┌───────────┐
-  //            │          │ Pump1_On  │
-  //            │          └───────────┘
-  //            │                │             ┌ ─ ─ ─ ─ ─ ─ ─ ─ ─ ─ ┐
-  //            │                │                  Enable Pump 1
-  //            │          Overflowed? ──No───▶│ Sleep for Pump Time │
-  //            │                │              ─ ─ ─ ─ ─ ─ ─ ─ ─ ─ ─
-  //            │              Yes                        │
-  //            │                │                        │
-  //            │                ▼                        │
-  //            │          ┌───────────┐                  │
-  //            │          │ Pump1_Off │◀─────────────────┘
-  //            │          └───────────┘
-  //     ┌ ─ ─ ─ ─ ─ ─ ┐         │
-  //        Sleep 24h            ▼
-  //     └ ─ ─ ─ ─ ─ ─ ┘   ┌───────────┐
-  //            ▲          │ Pump2_On  │
-  //            │          └───────────┘
-  //            │                │             ┌ ─ ─ ─ ─ ─ ─ ─ ─ ─ ─ ┐
-  //            │                │                  Enable Pump 2
-  //            │          Overflowed? ──No───▶│ Sleep for Pump Time │
-  //            │                │              ─ ─ ─ ─ ─ ─ ─ ─ ─ ─ ─
-  //            │              Yes                        │
-  //            │                │                        │
-  //            │                ▼                        │
-  //            │          ┌───────────┐                  │
-  //            │          │ Pump2_Off │◀─────────────────┘
-  //            │          └───────────┘
-  //            │                │
-  //            │                │
-  //            └────────────────┘
+  // In sequential mode (the default), a pump is started from Idle only once
+  // all the previous pumps have stopped, with a short settling period between
+  // them. In concurrent mode all due pumps start together, each after a
+  // configurable offset from the previous, and each stops at its own deadline.
   //
-  // Where control is yielded back to the event loop at each "sleep" point, and
-  // the FSM resumes the next time this function is called.
+  // A pump skipped as its saucer is wet flashes its LED, stepping through the
+  // pattern on each expiry of its timer until returning to Idle.
   //
-  // The current FSM state can be inferred from the pump pin states:
+  // Control is yielded back to the event loop while waiting on a timer (the
+  // MCU powering down), and the FSM resumes when the pump's timer event fires.
+  //
+  // A Running pump is stopped early if its saucer overflows, signalled by a
+  // pin change interrupt (see handle_event_overflow()). In adaptive mode it is
+  // also woken periodically to read the overflow sensor, adjusting the stored
+  // run duration when it stops.
+
+  switch (PUMP_STATE[pump]) {
+  case Pump_Waiting:
+    check_and_pump(pump);
+    break;
+
+  case Pump_Running: {
+    // Timed from the start of the run, so the rounding of each adaptive period
+    // to the WDT intervals is made up by the next.
+    RUN_ELAPSED_MS[pump] = wdt_uptime_ms() - RUN_STARTED_MS[pump];
+    bool overflowed =
+        settings_get()->pumps[pump].adaptive && channel_overflowed(pump);
+    if (!overflowed && RUN_ELAPSED_MS[pump] + WDT_TIMER_RESOLUTION_MS <
+                           RUN_DURATION_MS[pump]) {
+      // Keep running until the next reading.
+      arm_run(pump);
+      return;
+    }
+    run_finished(pump, overflowed);
+    break;
+  }
 
-  enum PumpRoutineState NEXT_STEP = Pump1_On; // Default to starting the routine
+  case Pump_Flashing:
+    if (led_step(pump)) {
+      wdt_timer_arm_ms(EVENT_STATE_WDT_PUMP(pump), LED_STEP_MS);
+      return;
+    }
+    pump_state_set(pump, Pump_Idle);
+    break;
 
-  if (IS_HIGH(PUMP_PIN_1))
-    NEXT_STEP |= Pump1_Off;
+  case Pump_Settling:
+    pump_state_set(pump, Pump_Idle);
+    break;
 
-  if (IS_HIGH(PUMP_PIN_2))
-    NEXT_STEP |= Pump2_Off;
+  case Pump_Idle:
+    // A timer for a pump that was since stopped (e.g. by a button press).
+    return;
 
-  // At this point, the FSM state has been restored, and it can now be advanced.
-  //
-  // If both pumps were inadvertently enabled prior to this function being
-  // called, the NEXT_STEP state is now invalid, and the default handler will be
-  // invoked to disable the pumps and halt execution.
-
-  switch (NEXT_STEP) {
-  case Pump1_On:
-    if (check_and_pump(OVERFLOW_SIGNAL_PIN_1, PUMP_PIN_1)) {
-      // The pump is now on.
-      wdt_sleep_seconds(eeprom_read_word(&PUMP_ON_DURATION_SECONDS));
-      return; // Sleep and wait to be woken into Pump1_Off handler
+  default:
+    halt();
+  }
+
+  routine_continue();
+}
+
+void handle_event_overflow() {
+  bool stopped = false;
+
+  for (uint8_t i = 0; i < SETTINGS_PUMP_COUNT; i++) {
+    // Confirm the reading, ignoring noise on the probe wires.
+    if (PUMP_STATE[i] != Pump_Running || !channel_overflowed(i)) {
+      continue;
     }
 
-    // Fallthrough
+    // Part way through the run timer - record the time actually run for, to
+    // within half the WDT interval in progress.
+    uint32_t unrun = wdt_timer_remaining_ms(EVENT_STATE_WDT_PUMP(i));
+    RUN_ELAPSED_MS[i] -= unrun < RUN_ELAPSED_MS[i] ? unrun : RUN_ELAPSED_MS[i];
+    wdt_timer_cancel(EVENT_STATE_WDT_PUMP(i));
+    run_finished(i, true);
+    stopped = true;
+  }
+
+  if (stopped) {
+    routine_continue();
+  }
+}
+
+void watering_start(uint8_t pumps) {
+  PUMPS_DUE |= pumps;
 
-  case Pump1_Off:
-    // Turn off PUMP_1
-    PORTB &= ~(1 << PUMP_PIN_1);
+  // Checkpoint the enabled pumps as unfinished until each has run, so a
+  // routine interrupted by a reset is reconciled at boot.
+  for (uint8_t i = 0; i < SETTINGS_PUMP_COUNT; i++) {
+    if ((pumps & (1 << i)) && settings_get()->pumps[i].enabled) {
+      PUMPS_UNFINISHED |= (1 << i);
+    }
+  }
 
-    // Small delay to let the pump/current settle
-    _delay_ms(200);
+  // If a routine is already in progress, the newly due pumps are run by it.
+  if (routine_running()) {
+    checkpoint();
+    return;
+  }
 
-    // Fallthrough
+  history_cycle_start();
+  checkpoint();
 
-  case Pump2_On:
-    if (check_and_pump(OVERFLOW_SIGNAL_PIN_2, PUMP_PIN_2)) {
-      // The pump is now on.
-      wdt_sleep_seconds(eeprom_read_word(&PUMP_ON_DURATION_SECONDS));
-      return; // Sleep and wait to be woken into Pump2_Off handler
+  advance();
+}
+
+void watering_stop() {
+  for (uint8_t i = 0; i < SETTINGS_PUMP_COUNT; i++) {
+    wdt_timer_cancel(EVENT_STATE_WDT_PUMP(i));
+    pump_off(i);
+  }
+  PUMPS_DUE = 0;
+
+  // The routine was abandoned on purpose - nothing to resume after a reset.
+  if (PUMPS_UNFINISHED != 0) {
+    PUMPS_UNFINISHED = 0;
+    RETRYING = false;
+    checkpoint();
+  }
+}
+
+void watering_schedule(uint8_t pumps) {
+  for (uint8_t i = 0; i < SETTINGS_PUMP_COUNT; i++) {
+    const struct pump_settings *pump = &settings_get()->pumps[i];
+    if ((pumps & (1 << i)) == 0) {
+      continue;
+    }
+
+    if (pump->enabled) {
+      // Moved to the time of day within the day before the interval ends.
+      NEXT_WATERING[i] = align_time_of_day(
+          wdt_uptime() + pump->interval_seconds, RTC_DAY_SECONDS);
+      wdt_timer_at(EVENT_STATE_WDT_INTERVAL(i), NEXT_WATERING[i]);
+    } else {
+      wdt_timer_cancel(EVENT_STATE_WDT_INTERVAL(i));
     }
+  }
 
-    // Fallthrough
+  checkpoint_arm();
+  checkpoint();
+}
 
-  case Pump2_Off:
-    PORTB &= ~(1 << PUMP_PIN_2);
+void watering_resume(uint8_t reset_cause) {
+  struct checkpoint c;
+  if (!checkpoint_init(&c)) {
+    watering_schedule(PUMPS_ALL);
     return;
+  }
 
-  default:
-    halt();
+  for (uint8_t i = 0; i < SETTINGS_PUMP_COUNT; i++) {
+    const struct pump_settings *pump = &settings_get()->pumps[i];
+    if (!pump->enabled) {
+      c.unfinished &= ~(1 << i);
+      continue;
+    }
+
+    // The interval may have been shortened (re-provisioned) since.
+    uint32_t remaining = c.remaining_s[i];
+    if (remaining > pump->interval_seconds) {
+      remaining = pump->interval_seconds;
+    }
+    NEXT_WATERING[i] =
+        align_time_of_day(wdt_uptime() + remaining, pump->interval_seconds / 2);
+    wdt_timer_at(EVENT_STATE_WDT_INTERVAL(i), NEXT_WATERING[i]);
+  }
+  checkpoint_arm();
+
+  uint8_t interrupted = c.unfinished & PUMPS_ALL;
+  if (interrupted != 0 && !c.retried && (reset_cause & (1 << PORF))) {
+    // Run the rest of the routine once - should it be interrupted again, the
+    // retried flag checkpointed with it skips it at the next boot.
+    RETRYING = true;
+    watering_start(interrupted);
+    return;
+  }
+
+  // Otherwise drop any interrupted routine.
+  checkpoint();
+}
+
+void handle_event_watering_interval(uint8_t pump) {
+  // The MCU is woken for each scheduled routine anyway - take the opportunity
+  // to re-measure the WDT oscillator, tracking any drift due to temperature or
+  // supply voltage changes. Once per routine, ahead of the checkpoint write
+  // whose time would otherwise go uncredited to the uptime clock (see
+  // wdt_calibrate()).
+  if (!routine_running()) {
+    wdt_calibrate();
+  }
+
+  // Schedule the next watering routine for this pump independently of the
+  // pump timers, a full interval after this one was due - so the time taken
+  // to wake and handle it never accumulates. Any routines missed entirely are
+  // skipped rather than run back to back.
+  uint32_t interval = settings_get()->pumps[pump].interval_seconds;
+  do {
+    NEXT_WATERING[pump] += interval;
+  } while ((int32_t)(NEXT_WATERING[pump] - wdt_uptime()) <= 0);
+
+  // Held to the time of day against the drift of the uptime clock between
+  // the RTC readings - or pulled back onto it, should the interval not be a
+  // whole number of days.
+  NEXT_WATERING[pump] = align_time_of_day(NEXT_WATERING[pump], interval / 2);
+  wdt_timer_at(EVENT_STATE_WDT_INTERVAL(pump), NEXT_WATERING[pump]);
+
+  // And run it now.
+  watering_start(1 << pump);
+}
+
+void handle_event_checkpoint() {
+  // Keep to the hourly grid, as for the watering intervals - re-armed ahead of
+  // the EEPROM write, as re-arming restarts the WDT interval.
+  do {
+    NEXT_CHECKPOINT += CHECKPOINT_INTERVAL_SECONDS;
+  } while ((int32_t)(NEXT_CHECKPOINT - wdt_uptime()) <= 0);
+  wdt_timer_at(EVENT_STATE_WDT_CHECKPOINT, NEXT_CHECKPOINT);
+
+  // A routine in progress is checkpointed as each pump finishes.
+  if (!routine_running()) {
+    checkpoint();
   }
 }
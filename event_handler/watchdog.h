@@ -1,14 +1,49 @@
 #ifndef HANDLER_WATCHDOG_H
 #define HANDLER_WATCHDOG_H
 
-#include <avr/eeprom.h>
+#include "../channel.h"
+#include <avr/io.h>
 
 /// How long to sleep between pump routines.
-#define PUMP_INTERVAL_SECONDS ((uint16_t)60 * 60 * 24)
+#define PUMP_INTERVAL_SECONDS ((uint32_t)60 * 60 * 24)
 
-extern uint16_t EEMEM PUMP_ON_DURATION_SECONDS;
+/// A bitmap of all pumps, for use with watering_start() and
+/// watering_schedule().
+#define PUMPS_ALL CHANNELS_ALL
 
-extern void handle_event_watchdog();
-extern void init_overflow_sensor();
+extern void handle_event_pump(uint8_t pump);
+extern void handle_event_watering_interval(uint8_t pump);
+
+/// Checkpoint the progress of the watering schedule to EEPROM, and arm the
+/// next checkpoint CHECKPOINT_INTERVAL_SECONDS later.
+extern void handle_event_checkpoint();
+
+/// Stop any running pump whose saucer has overflowed.
+extern void handle_event_overflow();
+
+/// Run the watering routine for the pumps in the bitmap (1 << pump index).
+extern void watering_start(uint8_t pumps);
+
+/// Turn off all pumps and abandon any in-progress watering routine.
+extern void watering_stop();
+
+/// (Re)start the watering interval of the enabled pumps in the bitmap, with the
+/// next routine a full interval from now.
+extern void watering_schedule(uint8_t pumps);
+
+/// @brief Restore the watering schedule from the last checkpoint at boot,
+/// reconciling a routine interrupted by the reset with its cause (the MCUSR
+/// value at boot) - or schedule every pump a full interval from now if never
+/// checkpointed.
+///
+/// After a power-on reset the unfinished pumps of the interrupted routine are
+/// run again, once. Any other reset skips them until their next interval: a
+/// brown-out is most likely the pump inrush sagging the supply, and a
+/// watchdog reset a fault - either would recur if retried.
+///
+/// The schedule resumes where the last checkpoint left it, so each routine is
+/// late by at most CHECKPOINT_INTERVAL_SECONDS plus the time spent without
+/// power (the uptime clock stops) - and never early.
+extern void watering_resume(uint8_t reset_cause);
 
 #endif /* HANDLER_WATCHDOG_H */
\ No newline at end of file
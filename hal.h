@@ -0,0 +1,19 @@
+#ifndef HAL_H
+#define HAL_H
+
+#include <avr/io.h>
+
+/// @brief Write value to a register with side effects beyond storing it, such
+/// as the write-one-to-clear interrupt flags of TIFR, GIFR & WDTCR.
+///
+/// On the AVR this is a plain register write. When built for the host (see
+/// host/hal.h) the write is applied by the simulated peripheral instead - all
+/// other register & EEPROM accesses are plain, backed by the host headers in
+/// host/include.
+#ifdef HAL_HOST
+#define hal_write(reg, value) hal_reg_write(HAL_REG_##reg, (value))
+#else
+#define hal_write(reg, value) ((reg) = (value))
+#endif
+
+#endif /* HAL_H */
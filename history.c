@@ -0,0 +1,106 @@
+#include "history.h"
+#include "channel.h"
+#include "clock.h"
+#include <avr/eeprom.h>
+#include <stddef.h>
+#include <util/crc16.h>
+
+/// The EEPROM ring of watering records, appended to in order and overwriting
+/// the oldest once full - not static, so the host simulator can read it back.
+///
+/// The zero-filled initial image (and erased cells) contain no valid records.
+struct history_record EEMEM HISTORY_RECORDS[HISTORY_RECORD_COUNT];
+
+/// The index of the newest valid record, or HISTORY_RECORD_COUNT if none.
+static uint8_t NEWEST = HISTORY_RECORD_COUNT;
+
+/// The sequence number of the newest valid record.
+static uint8_t NEWEST_SEQ = 0;
+
+/// The current watering cycle.
+static uint16_t CYCLE = 0;
+
+/// The reset cause, written into the first record after boot only.
+static uint8_t RESET_CAUSE = 0;
+
+/// @brief Compute the CRC-8 of record, excluding the crc field itself.
+static uint8_t record_crc(const struct history_record *record) {
+  const uint8_t *p = (const uint8_t *)record;
+  uint8_t crc = 0;
+  for (uint8_t i = 0; i < offsetof(struct history_record, crc); i++) {
+    crc = _crc8_ccitt_update(crc, p[i]);
+  }
+  return crc;
+}
+
+/// @brief Return true if record is intact and numbered, rejecting zero-filled
+/// and erased cells.
+static bool record_valid(const struct history_record *record) {
+  return record->crc == record_crc(record) && record->cycle != 0 &&
+         record->cycle != 0xFFFF;
+}
+
+void history_init(uint8_t reset_cause) {
+  struct history_record record;
+
+  NEWEST = HISTORY_RECORD_COUNT;
+  NEWEST_SEQ = 0;
+  CYCLE = 0;
+  RESET_CAUSE = reset_cause & 0x0F;
+
+  for (uint8_t i = 0; i < HISTORY_RECORD_COUNT; i++) {
+    eeprom_read_block(&record, &HISTORY_RECORDS[i], sizeof(record));
+    if (!record_valid(&record)) {
+      continue;
+    }
+
+    // As for the settings ring, all the valid records lie within
+    // HISTORY_RECORD_COUNT of each other, so the signed difference orders
+    // them.
+    if (NEWEST == HISTORY_RECORD_COUNT ||
+        (int8_t)(record.seq - NEWEST_SEQ) > 0) {
+      NEWEST = i;
+      NEWEST_SEQ = record.seq;
+      CYCLE = record.cycle;
+    }
+  }
+}
+
+void history_cycle_start() {
+  CYCLE++;
+
+  // Skip the values reserved to mark empty cells.
+  if (CYCLE == 0xFFFF) {
+    CYCLE = 1;
+  } else if (CYCLE == 0) {
+    CYCLE++;
+  }
+}
+
+void history_record(uint8_t pump, uint8_t flags, uint32_t on_time_ms) {
+  struct history_record record;
+
+  uint32_t on_time_ds = on_time_ms / 100;
+  if (on_time_ds > 0xFFFF) {
+    on_time_ds = 0xFFFF;
+  }
+
+  record.seq = NEWEST_SEQ + 1;
+  record.cycle = CYCLE == 0 ? 1 : CYCLE;
+  record.flags = flags | ((pump & 1) ? HISTORY_PUMP_2 : 0) |
+                 (RESET_CAUSE << HISTORY_RESET_CAUSE_SHIFT);
+#if CHANNEL_COUNT > 2
+  record.flags |= (pump & 2) ? HISTORY_PUMP_3 : 0;
+#endif
+  record.on_time_ds = on_time_ds;
+  record.crc = record_crc(&record);
+
+  NEWEST = NEWEST >= HISTORY_RECORD_COUNT - 1 ? 0 : NEWEST + 1;
+  NEWEST_SEQ = record.seq;
+  RESET_CAUSE = 0;
+
+  // Wait out the EEPROM write cycles at the reduced clock.
+  clock_slow();
+  eeprom_update_block(&record, &HISTORY_RECORDS[NEWEST], sizeof(record));
+  clock_full();
+}
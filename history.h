@@ -0,0 +1,48 @@
+#ifndef HISTORY_H
+#define HISTORY_H
+
+#include <avr/io.h>
+#include <stdbool.h>
+
+/// The number of records in the EEPROM ring, kept small to leave room for the
+/// settings ring.
+///
+/// MUST match tools/history.py.
+#define HISTORY_RECORD_COUNT 16
+
+/// Record flag bits.
+#define HISTORY_PUMP_2 (1 << 0)            // Record is for pump 2 (or 4)
+#define HISTORY_OVERFLOW_SKIPPED (1 << 1)  // Not run, the saucer was wet
+#define HISTORY_OVERFLOW_STOPPED (1 << 2)  // Stopped early, the saucer wetted
+#define HISTORY_PUMP_3 (1 << 3)            // Record is for pump 3 (or 4)
+#define HISTORY_RESET_CAUSE_SHIFT 4        // MCUSR at boot, in the high nibble
+
+/// @brief A single watering record in the EEPROM history ring.
+///
+/// MUST match the layout decoded by tools/history.py.
+struct history_record {
+  /// Incremented (wrapping) for each record written.
+  uint8_t seq;
+  /// The watering cycle the record belongs to, never 0 or 0xFFFF.
+  uint16_t cycle;
+  /// HISTORY_* flag bits.
+  uint8_t flags;
+  /// The time the pump ran for, in tenths of a second (saturating).
+  uint16_t on_time_ds;
+  /// CRC-8 of all the preceding fields.
+  uint8_t crc;
+};
+
+/// Find the newest record in the EEPROM history ring, remembering the reset
+/// cause (the MCUSR value at boot) for the next record written.
+///
+/// MUST be called once at boot, before any other history function.
+extern void history_init(uint8_t reset_cause);
+
+/// Start a new watering cycle, numbering the records that follow.
+extern void history_cycle_start();
+
+/// Append a record of pump to the history, with the HISTORY_OVERFLOW_* flags.
+extern void history_record(uint8_t pump, uint8_t flags, uint32_t on_time_ms);
+
+#endif /* HISTORY_H */
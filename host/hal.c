@@ -0,0 +1,965 @@
+// Copyright 2024 Dominic Dwyer (dom@itsallbroken.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+//             http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+// The simulated ATtiny85 behind the host build (see hal.h).
+//
+// Virtual time only advances when the firmware touches the hardware: each
+// register access costs HAL_ACCESS_CYCLES, and delays, EEPROM writes & sleeps
+// advance the clock by their duration. A sleep jumps straight to the next
+// interrupt, so months of (mostly powered down) operation simulate in seconds,
+// and every run is deterministic.
+//
+// Modelled peripherals: the system clock prescaler, PORTB (with pull-ups, pin
+// change interrupts & digital input disables), timer 0 (normal & CTC), timer 1
+// (normal & CTC1), the timer prescaler resets, the power reduction register,
+// the WDT (interrupt & reset modes, timed change sequence, oscillator error),
+// the sleep modes (with the timed BOD disable sequence), the USI clock strobes
+// (USICLK & USITC, in three-wire mode, and in two-wire mode with open drain
+// outputs released to the board pull-ups), the ADC (polled single conversions
+// of the single-ended inputs or the bandgap, against VCC or the internal
+// reference) and the EEPROM write time.
+//
+// The BOD is assumed to be enabled by the fuses (see the Makefile).
+//
+// Board models react to the output pins, the levels of the pulled-up bus
+// lines (see hal_config.on_line) and a timer of their own (see
+// hal_timer_at()).
+//
+// A run can also resume after a power loss (see hal_config.start_us), with the
+// EEPROM contents carried over by the caller.
+//
+// Virtual time is counted in cycles of the undivided system clock (F_CPU) -
+// while the clock is divided by CLKPR, the CPU & timers run correspondingly
+// slower, while the WDT & EEPROM timings are unaffected.
+
+#include "hal.h"
+#include <avr/io.h>
+#include <stdlib.h>
+#include <string.h>
+
+/// The (approximate) cost of each register access, in CPU cycles.
+#define HAL_ACCESS_CYCLES 2
+
+/// The cost of entering & returning from an ISR, in CPU cycles.
+#define HAL_ISR_CYCLES 8
+
+/// The duration of an EEPROM write (erase & program) of a single byte.
+#define HAL_EEPROM_WRITE_CYCLES (F_CPU * 34 / 10000) // 3.4ms
+
+/// The WDT oscillator runs at 128kHz.
+#define HAL_WDT_HZ 128000
+
+/// The internal bandgap reference, and the supply if not modelled by the
+/// board (see hal_config.analog_mv).
+#define HAL_BANDGAP_MV 1100
+#define HAL_VCC_MV 3000
+
+/// The length of an ADC conversion in ADC clocks, and of the first after
+/// enabling the ADC.
+#define HAL_ADC_CLOCKS 13
+#define HAL_ADC_FIRST_CLOCKS 25
+
+#define CYCLES_PER_US (F_CPU / 1000000)
+#define NEVER UINT64_MAX
+
+/// The register file, indexed by enum hal_reg.
+static volatile uint8_t REGS[HAL_REG_COUNT];
+#define R(reg) REGS[HAL_REG_##reg]
+
+/// The state of the CPU, selecting which clocks are running.
+enum mode {
+  Mode_Active = 0,
+  Mode_Idle,
+  Mode_AdcNoise,
+  Mode_PwrDown,
+};
+
+static const struct hal_config *CONFIG;
+static struct hal_stats STATS;
+
+/// The virtual time, and the end of the run.
+static uint64_t NOW;
+static uint64_t END;
+
+/// The global interrupt enable flag (I in SREG).
+static bool I_FLAG;
+
+static void (*ISRS[HAL_VECTOR_COUNT])(void);
+
+/// The index of the next scripted input to apply, and the current drive of
+/// each pin.
+static uint16_t NEXT_INPUT;
+static uint8_t DRIVE[8];
+
+/// The level held by the USI data output latch, and the USCK (PB2) output
+/// level as of the previous update.
+static uint8_t USI_DO;
+static bool USCK_LOW;
+
+/// The last computed PINB, the levels of the lines pulled up by the board, and
+/// the pins driven high as outputs.
+static uint8_t LAST_PINS;
+static uint8_t LAST_LINES;
+static uint8_t LAST_HIGH;
+static uint64_t HIGH_SINCE[8];
+
+/// The time the clock prescaler change sequence was started (valid for 4
+/// cycles).
+static bool CLOCK_CHANGE_OPEN;
+static uint64_t CLOCK_CHANGE_AT;
+
+/// The time the BOD sleep disable sequence was started (valid for 4 cycles),
+/// and the time BODS was then set (valid for 3 cycles, the sleep instruction
+/// turning off the BOD).
+static bool BOD_CHANGE_OPEN;
+static uint64_t BOD_CHANGE_AT;
+static bool BOD_SLEEP_OPEN;
+static uint64_t BOD_SLEEP_AT;
+
+/// True while sleeping with the BOD disabled.
+static bool BOD_OFF;
+
+/// Cycles accumulated towards the next tick of each timer's prescaler.
+static uint32_t TIMER0_RESIDUE;
+static uint32_t TIMER1_RESIDUE;
+
+/// True while an ADC conversion is running, and the cycles until its result.
+static bool ADC_BUSY;
+static uint64_t ADC_REMAINING;
+
+/// True until the first conversion after enabling the ADC starts.
+static bool ADC_FIRST;
+
+/// The cycle the board timer expires at (see hal_timer_at()), or NEVER.
+static uint64_t BOARD_TIMER;
+
+/// Cycles counted towards the next WDT timeout, and the time the WDT change
+/// enable sequence was started (valid for 4 cycles).
+static uint64_t WDT_COUNT;
+static bool WDT_CHANGE_OPEN;
+static uint64_t WDT_CHANGE_AT;
+
+/// @brief An interrupt source, checked in vector (priority) order.
+struct vector {
+  uint8_t vector;
+  uint8_t flag_reg;
+  uint8_t flag;
+  uint8_t mask_reg;
+  uint8_t mask;
+  /// True if the hardware clears the flag when the ISR is entered.
+  bool clear;
+};
+
+static const struct vector VECTORS[] = {
+    {PCINT0_vect, HAL_REG_GIFR, 1 << PCIF, HAL_REG_GIMSK, 1 << PCIE, true},
+    {TIM1_COMPA_vect, HAL_REG_TIFR, 1 << OCF1A, HAL_REG_TIMSK, 1 << OCIE1A,
+     true},
+    {TIM1_OVF_vect, HAL_REG_TIFR, 1 << TOV1, HAL_REG_TIMSK, 1 << TOIE1, true},
+    {TIM0_OVF_vect, HAL_REG_TIFR, 1 << TOV0, HAL_REG_TIMSK, 1 << TOIE0, true},
+    {TIM1_COMPB_vect, HAL_REG_TIFR, 1 << OCF1B, HAL_REG_TIMSK, 1 << OCIE1B,
+     true},
+    {TIM0_COMPA_vect, HAL_REG_TIFR, 1 << OCF0A, HAL_REG_TIMSK, 1 << OCIE0A,
+     true},
+    {TIM0_COMPB_vect, HAL_REG_TIFR, 1 << OCF0B, HAL_REG_TIMSK, 1 << OCIE0B,
+     true},
+    {WDT_vect, HAL_REG_WDTCR, 1 << WDIF, HAL_REG_WDTCR, 1 << WDIE, true},
+    {USI_OVF_vect, HAL_REG_USISR, 1 << USIOIF, HAL_REG_USICR, 1 << USIOIE,
+     false},
+};
+
+#define VECTOR_COUNT (sizeof(VECTORS) / sizeof(VECTORS[0]))
+
+/// @brief A compare value of a timer, and the TIFR flag set when the counter
+/// reaches it.
+struct compare {
+  uint8_t value;
+  uint8_t flag;
+};
+
+static void finish(enum hal_done why) __attribute__((noreturn));
+static uint32_t clock_div();
+
+/// @brief Recompute PINB from the outputs, pull-ups & external drive, raising
+/// pin change interrupts and tracking output edges.
+static void update_pins() {
+  uint8_t ddr = R(DDRB);
+  uint8_t out = R(PORTB);
+
+  // In three-wire mode the USI data output overrides PORTB for PB1. With an
+  // external clock the output latch holds the MSB of USIDR from the rising
+  // edge of USCK for the second half of the clock cycle, else it is
+  // transparent - opening only once USCK has fallen, so the data never moves
+  // with a clock edge.
+  bool usck_low = (R(PORTB) & (1 << PB2)) == 0;
+  if ((R(USICR) & (1 << USICS1)) == 0 || (usck_low && USCK_LOW)) {
+    USI_DO = R(USIDR) >> 7;
+  }
+  USCK_LOW = usck_low;
+  if ((R(USICR) & ((1 << USIWM1) | (1 << USIWM0))) == (1 << USIWM0)) {
+    out = (out & ~(1 << PB1)) | (USI_DO << PB1);
+  }
+
+  // In two-wire mode SDA (PB0) is also pulled low by the output latch, and
+  // both SDA & SCL (PB2) are open drain - an output driven high releases the
+  // line, without the internal pull-up.
+  uint8_t released = 0;
+  if ((R(USICR) & ((1 << USIWM1) | (1 << USIWM0))) == (1 << USIWM1)) {
+    out &= ~((USI_DO ^ 1) << PB0);
+    released = ddr & out & ((1 << PB0) | (1 << PB2));
+    ddr &= ~released;
+  }
+
+  bool pull_ups = (R(MCUCR) & (1 << PUD)) == 0;
+  uint8_t in = 0;
+  for (uint8_t i = 0; i < 6; i++) {
+    bool pulled = (CONFIG->pull_ups & (1 << i)) ||
+                  (pull_ups && (out & ~released & (1 << i)));
+    bool level = DRIVE[i] == Hal_High || (DRIVE[i] == Hal_Float && pulled);
+    in |= level << i;
+  }
+
+  // A pin with its digital input buffer disabled always reads low.
+  uint8_t lines = ((ddr & out) | (~ddr & in)) & 0x3F;
+  uint8_t pins = lines & ~R(DIDR0);
+  if ((pins ^ LAST_PINS) & R(PCMSK)) {
+    R(GIFR) |= 1 << PCIF;
+  }
+  LAST_PINS = pins;
+  R(PINB) = pins;
+
+  uint8_t high = ddr & out & 0x3F;
+  uint8_t changed = high ^ LAST_HIGH;
+  LAST_HIGH = high;
+  for (uint8_t i = 0; changed && i < 8; i++) {
+    if ((changed & (1 << i)) == 0) {
+      continue;
+    }
+    bool level = (high & (1 << i)) != 0;
+    if (level) {
+      HIGH_SINCE[i] = NOW;
+    } else {
+      STATS.pin_high_cycles[i] += NOW - HIGH_SINCE[i];
+    }
+    if (CONFIG->on_output) {
+      CONFIG->on_output(i, level, NOW);
+    }
+  }
+
+  // A board model reacting to a line may drive another, reporting that change
+  // from the nested call - skip any line it has since moved.
+  changed = (lines ^ LAST_LINES) & CONFIG->pull_ups;
+  LAST_LINES = lines;
+  for (uint8_t i = 0; changed && i < 8; i++) {
+    uint8_t bit = 1 << i;
+    if ((changed & bit) == 0 || ((LAST_LINES ^ lines) & bit)) {
+      continue;
+    }
+    if (CONFIG->on_line) {
+      CONFIG->on_line(i, (lines & bit) != 0, NOW);
+    }
+  }
+}
+
+/// @brief Shift the USI data register, sampling the data input (PB0).
+static void usi_shift() { R(USIDR) = (R(USIDR) << 1) | (LAST_PINS & 1); }
+
+/// @brief Advance the USI 4-bit counter, flagging the overflow.
+static void usi_count() {
+  uint8_t count = (R(USISR) + 1) & 0x0F;
+  R(USISR) = (R(USISR) & 0xF0) | count;
+  if (count == 0) {
+    R(USISR) |= 1 << USIOIF;
+  }
+}
+
+/// @brief Apply the side effects of the firmware's previous register access,
+/// which are only observable once it has completed.
+/// @brief Return the division of the system clock clocking the ADC.
+static uint32_t adc_div() {
+  uint8_t ps = R(ADCSRA) & ((1 << ADPS2) | (1 << ADPS1) | (1 << ADPS0));
+  return (ps == 0 ? 2 : (uint32_t)1 << ps) * clock_div();
+}
+
+/// @brief Return the voltage (in mV) of an analog input of the board.
+static uint32_t analog_mv(uint8_t input) {
+  if (CONFIG->analog_mv) {
+    return CONFIG->analog_mv(input);
+  }
+  return input == HAL_ANALOG_VCC ? HAL_VCC_MV : 0;
+}
+
+/// @brief Complete the running ADC conversion, storing its (right adjusted)
+/// result.
+static void adc_complete() {
+  uint8_t mux =
+      R(ADMUX) & ((1 << MUX3) | (1 << MUX2) | (1 << MUX1) | (1 << MUX0));
+  uint32_t vin = 0;
+  if (mux <= 3) {
+    vin = analog_mv(mux); // ADC0-3, single-ended
+  } else if (mux == ((1 << MUX3) | (1 << MUX2))) {
+    vin = HAL_BANDGAP_MV;
+  }
+
+  // REFS1 selects the internal reference, otherwise VCC.
+  uint32_t vref = (R(ADMUX) & (1 << REFS1)) ? HAL_BANDGAP_MV
+                                            : analog_mv(HAL_ANALOG_VCC);
+  uint32_t result = vref ? vin * 1024 / vref : 0;
+  if (result > 1023) {
+    result = 1023;
+  }
+
+  R(ADCL) = result & 0xFF;
+  R(ADCH) = result >> 8;
+  R(ADCSRA) = (R(ADCSRA) & ~(1 << ADSC)) | (1 << ADIF);
+  ADC_BUSY = false;
+}
+
+static void sync() {
+  // A USI software clock strobe shifts the data register and advances the
+  // counter - ignored while the USI is powered down.
+  if ((R(USICR) & (1 << USICLK)) && (R(PRR) & (1 << PRUSI)) == 0) {
+    uint8_t cs = R(USICR) & ((1 << USICS1) | (1 << USICS0));
+    if (cs == 0) {
+      R(USICR) &= ~(1 << USICLK);
+      usi_shift();
+      usi_count();
+    }
+  }
+
+  // USITC toggles USCK, which in the external clock modes with USICLK set
+  // clocks the counter on each strobe, and the data register on the selected
+  // edge.
+  if (R(USICR) & (1 << USITC)) {
+    R(USICR) &= ~(1 << USITC);
+    R(PORTB) ^= 1 << PB2;
+
+    bool rising = (R(PORTB) & (1 << PB2)) != 0;
+    if ((R(USICR) & ((1 << USICS1) | (1 << USICLK))) ==
+            ((1 << USICS1) | (1 << USICLK)) &&
+        (R(PRR) & (1 << PRUSI)) == 0) {
+      if (rising == ((R(USICR) & (1 << USICS0)) == 0)) {
+        usi_shift();
+      }
+      usi_count();
+    }
+  }
+
+  // Setting PSR0 (or PSR1) resets the prescaler of timer 0 (or 1), the bit
+  // clearing itself.
+  if (R(GTCCR) & (1 << PSR0)) {
+    R(GTCCR) &= ~(1 << PSR0);
+    TIMER0_RESIDUE = 0;
+  }
+  if (R(GTCCR) & (1 << PSR1)) {
+    R(GTCCR) &= ~(1 << PSR1);
+    TIMER1_RESIDUE = 0;
+  }
+
+  // Setting ADSC starts a conversion - abandoned if the ADC is disabled or
+  // powered down.
+  if ((R(ADCSRA) & (1 << ADEN)) == 0 || (R(PRR) & (1 << PRADC))) {
+    R(ADCSRA) &= ~(1 << ADSC);
+    ADC_BUSY = false;
+    ADC_FIRST = true;
+  } else if ((R(ADCSRA) & (1 << ADSC)) && !ADC_BUSY) {
+    ADC_BUSY = true;
+    ADC_REMAINING =
+        (ADC_FIRST ? HAL_ADC_FIRST_CLOCKS : HAL_ADC_CLOCKS) * adc_div();
+    ADC_FIRST = false;
+  }
+
+  update_pins();
+}
+
+/// @brief Return the number of ticks before a timer counting up from count
+/// (and wrapping after top) next reaches value.
+static uint64_t ticks_until(uint8_t count, uint8_t top, uint8_t value) {
+  if (value > top) {
+    return NEVER;
+  }
+  // A counter set beyond top first counts up to 0xFF and wraps.
+  if (count > top) {
+    return (256 - count) + value;
+  }
+  uint16_t period = top + 1;
+  uint16_t d = (value + period - count) % period;
+  return d == 0 ? period : d;
+}
+
+/// @brief Advance the counter at tcnt of a timer by ticks, setting the TIFR
+/// flag of each compare value it reaches.
+static void timer_advance(uint8_t tcnt, uint8_t top, uint64_t ticks,
+                          const struct compare *compare, uint8_t n) {
+  if (ticks == 0) {
+    return;
+  }
+
+  uint8_t count = REGS[tcnt];
+  for (uint8_t i = 0; i < n; i++) {
+    if (ticks >= ticks_until(count, top, compare[i].value)) {
+      R(TIFR) |= compare[i].flag;
+    }
+  }
+
+  uint16_t period = top + 1;
+  if (count > top) {
+    uint16_t to_wrap = 256 - count;
+    REGS[tcnt] = ticks < to_wrap ? count + ticks : (ticks - to_wrap) % period;
+  } else {
+    REGS[tcnt] = (count + ticks) % period;
+  }
+}
+
+/// @brief Return the number of cycles before the next enabled compare of a
+/// timer.
+static uint64_t timer_next(uint8_t tcnt, uint8_t top, uint32_t div,
+                           uint32_t residue, const struct compare *compare,
+                           uint8_t n) {
+  uint64_t next = NEVER;
+  for (uint8_t i = 0; i < n; i++) {
+    if ((R(TIMSK) & compare[i].flag) == 0) {
+      continue;
+    }
+    uint64_t ticks = ticks_until(REGS[tcnt], top, compare[i].value);
+    if (ticks != NEVER && ticks * div - residue < next) {
+      next = ticks * div - residue;
+    }
+  }
+  return next;
+}
+
+/// @brief Return the division of the system clock by the CLKPR prescaler.
+static uint32_t clock_div() {
+  uint8_t prescale = R(CLKPR) & 0x0F;
+  return (uint32_t)1 << (prescale > 8 ? 8 : prescale);
+}
+
+/// @brief Return the division of the system clock ticking timer 0, or 0 if
+/// stopped.
+static uint32_t timer0_div() {
+  static const uint16_t DIVS[] = {0, 1, 8, 64, 256, 1024, 0, 0};
+  if (R(PRR) & (1 << PRTIM0)) {
+    return 0;
+  }
+  return DIVS[R(TCCR0B) & 0x07] * clock_div();
+}
+
+/// @brief Return the compare values of timer 0 and its top.
+static uint8_t timer0_compare(struct compare *c, uint8_t *top) {
+  uint8_t n = 0;
+  bool ctc = (R(TCCR0A) & (1 << WGM01)) != 0;
+  *top = ctc ? R(OCR0A) : 0xFF;
+  c[n++] = (struct compare){R(OCR0A), 1 << OCF0A};
+  c[n++] = (struct compare){R(OCR0B), 1 << OCF0B};
+  if (!ctc) {
+    c[n++] = (struct compare){0, 1 << TOV0};
+  }
+  return n;
+}
+
+/// @brief Return the division of the system clock ticking timer 1, or 0 if
+/// stopped.
+static uint32_t timer1_div() {
+  uint8_t cs = R(TCCR1) & 0x0F;
+  if ((R(PRR) & (1 << PRTIM1)) || cs == 0) {
+    return 0;
+  }
+  return ((uint32_t)1 << (cs - 1)) * clock_div();
+}
+
+/// @brief Return the compare values of timer 1 and its top.
+static uint8_t timer1_compare(struct compare *c, uint8_t *top) {
+  *top = (R(TCCR1) & (1 << CTC1)) ? R(OCR1C) : 0xFF;
+  c[0] = (struct compare){R(OCR1A), 1 << OCF1A};
+  c[1] = (struct compare){R(OCR1B), 1 << OCF1B};
+  c[2] = (struct compare){0, 1 << TOV1};
+  return 3;
+}
+
+/// @brief Return the configured WDT timeout, in cycles of F_CPU.
+static uint64_t wdt_period() {
+  uint8_t prescale = (R(WDTCR) & 0x07) | ((R(WDTCR) >> WDP3) & 1) << 3;
+  if (prescale > 9) {
+    prescale = 9;
+  }
+  return ((2048ULL << prescale) * F_CPU * (1000000 + CONFIG->wdt_error_ppm)) /
+         ((uint64_t)HAL_WDT_HZ * 1000000);
+}
+
+static bool wdt_running() {
+  return (R(WDTCR) & ((1 << WDE) | (1 << WDIE))) != 0;
+}
+
+/// @brief Step all the clocked peripherals by cycles.
+static void tick(uint64_t cycles, enum mode mode) {
+  struct compare c[3];
+  uint8_t top, n;
+
+  // The timers are clocked by clkIO, which stops in the deeper sleep modes.
+  if (mode == Mode_Active || mode == Mode_Idle) {
+    uint32_t div = timer0_div();
+    if (div) {
+      n = timer0_compare(c, &top);
+      uint64_t total = TIMER0_RESIDUE + cycles;
+      timer_advance(HAL_REG_TCNT0, top, total / div, c, n);
+      TIMER0_RESIDUE = total % div;
+    }
+
+    div = timer1_div();
+    if (div) {
+      n = timer1_compare(c, &top);
+      uint64_t total = TIMER1_RESIDUE + cycles;
+      timer_advance(HAL_REG_TCNT1, top, total / div, c, n);
+      TIMER1_RESIDUE = total % div;
+    }
+  }
+
+  // The ADC clock stops only when powered down.
+  if (ADC_BUSY && mode != Mode_PwrDown) {
+    if (cycles >= ADC_REMAINING) {
+      adc_complete();
+    } else {
+      ADC_REMAINING -= cycles;
+    }
+  }
+
+  // The WDT runs from its own oscillator in every mode.
+  if (wdt_running()) {
+    WDT_COUNT += cycles;
+    uint64_t period = wdt_period();
+    if (WDT_COUNT >= period) {
+      WDT_COUNT %= period;
+      if (R(WDTCR) & (1 << WDIE)) {
+        R(WDTCR) |= 1 << WDIF;
+      } else {
+        finish(Hal_DoneReset);
+      }
+    }
+  }
+}
+
+/// @brief Return the cycle at which the next scripted input applies.
+static uint64_t next_input() {
+  if (NEXT_INPUT >= CONFIG->n_inputs) {
+    return NEVER;
+  }
+  return CONFIG->inputs[NEXT_INPUT].at_us * CYCLES_PER_US;
+}
+
+/// @brief Apply all the scripted inputs due by now.
+static void apply_inputs() {
+  while (next_input() <= NOW) {
+    const struct hal_input *in = &CONFIG->inputs[NEXT_INPUT++];
+    if (in->pin >= HAL_BOARD_PIN) {
+      CONFIG->on_input(in->pin, in->drive);
+    } else {
+      DRIVE[in->pin] = in->drive;
+    }
+  }
+  update_pins();
+}
+
+/// @brief Advance the virtual clock by cycles in mode.
+///
+/// Callers bound cycles by next_event(), so at most one timeout or compare of
+/// each peripheral occurs.
+static void advance(uint64_t cycles, enum mode mode) {
+  if (END - NOW < cycles) {
+    cycles = END - NOW;
+  }
+
+  if (wdt_running()) {
+    STATS.wdt_cycles += cycles;
+  }
+
+  tick(cycles, mode);
+  NOW += cycles;
+
+  switch (mode) {
+  case Mode_Active:
+    STATS.active_cycles += cycles;
+    STATS.active_clocks += cycles / clock_div();
+    break;
+  case Mode_Idle:
+  case Mode_AdcNoise:
+    STATS.idle_cycles += cycles;
+    STATS.idle_clocks += cycles / clock_div();
+    break;
+  case Mode_PwrDown:
+    STATS.pwr_down_cycles += cycles;
+    break;
+  }
+  if (!BOD_OFF) {
+    STATS.bod_cycles += cycles;
+  }
+
+  if (BOARD_TIMER <= NOW) {
+    BOARD_TIMER = NEVER;
+    CONFIG->on_timer();
+  }
+
+  apply_inputs();
+  if (NOW >= END) {
+    finish(Hal_DoneTime);
+  }
+}
+
+/// @brief Return the number of cycles until the next event that could raise an
+/// interrupt in mode.
+static uint64_t next_event(enum mode mode) {
+  uint64_t next = END - NOW;
+
+  uint64_t input = next_input();
+  if (input - NOW < next) {
+    next = input - NOW;
+  }
+
+  struct compare c[3];
+  uint8_t top, n;
+  if (mode == Mode_Active || mode == Mode_Idle) {
+    uint32_t div = timer0_div();
+    if (div) {
+      n = timer0_compare(c, &top);
+      uint64_t t =
+          timer_next(HAL_REG_TCNT0, top, div, TIMER0_RESIDUE, c, n);
+      next = t < next ? t : next;
+    }
+    div = timer1_div();
+    if (div) {
+      n = timer1_compare(c, &top);
+      uint64_t t =
+          timer_next(HAL_REG_TCNT1, top, div, TIMER1_RESIDUE, c, n);
+      next = t < next ? t : next;
+    }
+  }
+
+  if (ADC_BUSY && mode != Mode_PwrDown) {
+    next = ADC_REMAINING < next ? ADC_REMAINING : next;
+  }
+
+  if (wdt_running()) {
+    uint64_t t = wdt_period() - WDT_COUNT;
+    next = t < next ? t : next;
+  }
+
+  if (BOARD_TIMER - NOW < next) {
+    next = BOARD_TIMER - NOW;
+  }
+
+  return next == 0 ? 1 : next;
+}
+
+/// @brief Return the highest priority pending & enabled interrupt, or NULL.
+static const struct vector *pending() {
+  for (uint8_t i = 0; i < VECTOR_COUNT; i++) {
+    const struct vector *v = &VECTORS[i];
+    if ((REGS[v->flag_reg] & v->flag) && (REGS[v->mask_reg] & v->mask)) {
+      return v;
+    }
+  }
+  return NULL;
+}
+
+/// @brief Run the ISRs of all pending interrupts, if interrupts are enabled.
+static void service() {
+  const struct vector *v;
+  while (I_FLAG && (v = pending())) {
+    // An interrupt without an ISR jumps to the reset vector.
+    if (ISRS[v->vector] == NULL) {
+      finish(Hal_DoneReset);
+    }
+
+    if (v->clear) {
+      REGS[v->flag_reg] &= ~v->flag;
+    }
+    // In interrupt & reset mode, the first timeout only disables the
+    // interrupt - the next resets the MCU.
+    if (v->vector == WDT_vect && (R(WDTCR) & (1 << WDE))) {
+      R(WDTCR) &= ~(1 << WDIE);
+    }
+
+    I_FLAG = false;
+    advance(HAL_ISR_CYCLES / 2 * clock_div(), Mode_Active);
+    ISRS[v->vector]();
+    sync();
+    advance(HAL_ISR_CYCLES / 2 * clock_div(), Mode_Active);
+    I_FLAG = true;
+  }
+}
+
+/// @brief Account for a single register access by the firmware.
+static void access() {
+  sync();
+  advance(HAL_ACCESS_CYCLES * clock_div(), Mode_Active);
+  service();
+}
+
+/// @brief Busy-wait for cycles of the undivided system clock, servicing any
+/// interrupts.
+static void busy_wait(uint64_t cycles) {
+  sync();
+  uint64_t until = NOW + cycles;
+  while (NOW < until) {
+    uint64_t step = next_event(Mode_Active);
+    advance(until - NOW < step ? until - NOW : step, Mode_Active);
+    service();
+  }
+}
+
+/// @brief Write the clock prescaler register, enforcing the timed change
+/// sequence.
+static void clock_write(uint8_t value) {
+  bool change = CLOCK_CHANGE_OPEN && NOW - CLOCK_CHANGE_AT <= 4 * clock_div();
+  CLOCK_CHANGE_OPEN = false;
+
+  if (value == (1 << CLKPCE)) {
+    CLOCK_CHANGE_OPEN = true;
+    CLOCK_CHANGE_AT = NOW;
+  } else if (change && (value & (1 << CLKPCE)) == 0) {
+    R(CLKPR) = value & 0x0F;
+  }
+}
+
+/// @brief Write the MCU control register, enforcing the timed BOD sleep
+/// disable sequence.
+///
+/// BODS & BODSE read as zero - the BOD is turned off by a sleep within 3 cycles
+/// of BODS being set (see hal_sleep()).
+static void mcucr_write(uint8_t value) {
+  uint8_t bod = (1 << BODS) | (1 << BODSE);
+  bool change = BOD_CHANGE_OPEN && NOW - BOD_CHANGE_AT <= 4 * clock_div();
+  BOD_CHANGE_OPEN = false;
+
+  if ((value & bod) == bod) {
+    BOD_CHANGE_OPEN = true;
+    BOD_CHANGE_AT = NOW;
+  } else if (change && (value & bod) == (1 << BODS)) {
+    BOD_SLEEP_OPEN = true;
+    BOD_SLEEP_AT = NOW;
+  }
+  R(MCUCR) = value & ~bod;
+}
+
+/// @brief Write the WDT control register, enforcing the timed change sequence.
+static void wdt_write(uint8_t value) {
+  uint8_t old = R(WDTCR);
+  bool was_running = wdt_running();
+
+  bool change = WDT_CHANGE_OPEN && NOW - WDT_CHANGE_AT <= 4 * clock_div();
+  WDT_CHANGE_OPEN = false;
+  if ((value & (1 << WDCE)) && (value & (1 << WDE))) {
+    WDT_CHANGE_OPEN = true;
+    WDT_CHANGE_AT = NOW;
+  }
+
+  // The prescaler & clearing WDE require the change sequence, and WDIF is
+  // cleared by writing a one to it.
+  uint8_t prescaler = (1 << WDP3) | (1 << WDP2) | (1 << WDP1) | (1 << WDP0);
+  uint8_t next = value & (1 << WDIE);
+  next |= old & ~value & (1 << WDIF);
+  if (change) {
+    next |= value & (prescaler | (1 << WDE));
+  } else {
+    next |= old & prescaler;
+    next |= (old | value) & (1 << WDE);
+  }
+  R(WDTCR) = next;
+
+  if (!was_running && wdt_running()) {
+    WDT_COUNT = 0;
+  }
+}
+
+volatile uint8_t *hal_reg(uint8_t reg) {
+  access();
+  return &REGS[reg];
+}
+
+uint8_t hal_reg_read(uint8_t reg) {
+  access();
+  return REGS[reg];
+}
+
+void hal_reg_write(uint8_t reg, uint8_t value) {
+  access();
+  switch (reg) {
+  case HAL_REG_TIFR:
+  case HAL_REG_GIFR:
+    REGS[reg] &= ~value;
+    break;
+  case HAL_REG_WDTCR:
+    wdt_write(value);
+    break;
+  case HAL_REG_CLKPR:
+    clock_write(value);
+    break;
+  case HAL_REG_MCUCR:
+    mcucr_write(value);
+    break;
+  case HAL_REG_PINB:
+    // Writing a one to PINB toggles the PORTB bit.
+    R(PORTB) ^= value;
+    break;
+  case HAL_REG_USISR:
+    R(USISR) = (R(USISR) & ~value & 0xE0) | (R(USISR) & (1 << USIDC)) |
+               (value & 0x0F);
+    break;
+  default:
+    REGS[reg] = value;
+    break;
+  }
+  sync();
+}
+
+void hal_sei() {
+  sync();
+  // Pending interrupts are serviced from the next access - the instruction
+  // following SEI always executes first, so `sei(); sleep_cpu();` is atomic.
+  I_FLAG = true;
+}
+
+void hal_cli() {
+  sync();
+  I_FLAG = false;
+}
+
+bool hal_interrupts_enabled() { return I_FLAG; }
+
+void hal_isr_register(uint8_t vector, void (*isr)(void)) {
+  ISRS[vector] = isr;
+}
+
+void hal_sleep() {
+  sync();
+  if ((R(MCUCR) & (1 << SE)) == 0) {
+    return;
+  }
+
+  // With interrupts disabled nothing can wake the MCU (see halt()).
+  if (!I_FLAG) {
+    finish(Hal_DoneHalted);
+  }
+
+  enum mode mode;
+  switch (R(MCUCR) & ((1 << SM1) | (1 << SM0))) {
+  case 0:
+    mode = Mode_Idle;
+    break;
+  case 1 << SM0:
+    mode = Mode_AdcNoise;
+    break;
+  default:
+    mode = Mode_PwrDown;
+    break;
+  }
+
+  // The BOD is only turned off in power-down, and only if BODS was set by the
+  // timed sequence just before.
+  BOD_OFF = mode == Mode_PwrDown && BOD_SLEEP_OPEN &&
+            NOW - BOD_SLEEP_AT <= 3 * clock_div();
+  BOD_SLEEP_OPEN = false;
+
+  // A pending interrupt wakes the MCU immediately.
+  if (pending() == NULL) {
+    STATS.wakeups++;
+    while (pending() == NULL) {
+      advance(next_event(mode), mode);
+    }
+  }
+  BOD_OFF = false;
+
+  service();
+}
+
+void hal_delay_cycles(uint64_t cycles) { busy_wait(cycles * clock_div()); }
+
+void hal_drive(uint8_t pin, uint8_t drive) {
+  if (DRIVE[pin] != drive) {
+    DRIVE[pin] = drive;
+    update_pins();
+  }
+}
+
+void hal_timer_at(uint64_t cycle) { BOARD_TIMER = cycle; }
+
+void hal_wdt_reset() {
+  access();
+  WDT_COUNT = 0;
+}
+
+void hal_eeprom_written(uint16_t bytes) {
+  STATS.eeprom_bytes_written += bytes;
+  // Self-timed, regardless of the CPU clock.
+  busy_wait((uint64_t)bytes * HAL_EEPROM_WRITE_CYCLES);
+}
+
+/// The bounds of the section holding the EEMEM variables, defined by the
+/// linker.
+extern uint8_t __start_eeprom[];
+extern uint8_t __stop_eeprom[];
+
+uint8_t *hal_eeprom() { return __start_eeprom; }
+
+size_t hal_eeprom_size() { return __stop_eeprom - __start_eeprom; }
+
+void hal_start(const struct hal_config *config) {
+  CONFIG = config;
+  memset((void *)REGS, 0, sizeof(REGS));
+  memset(&STATS, 0, sizeof(STATS));
+  memset(DRIVE, Hal_Float, sizeof(DRIVE));
+
+  R(MCUSR) = config->reset_cause != 0 ? config->reset_cause : 1 << PORF;
+  NOW = config->start_us * CYCLES_PER_US;
+  END = config->duration_us * CYCLES_PER_US;
+  I_FLAG = false;
+  NEXT_INPUT = 0;
+  USI_DO = 0;
+  USCK_LOW = true;
+  LAST_PINS = 0;
+  LAST_LINES = config->pull_ups;
+  LAST_HIGH = 0;
+  BOARD_TIMER = NEVER;
+  TIMER0_RESIDUE = 0;
+  TIMER1_RESIDUE = 0;
+  WDT_COUNT = 0;
+  WDT_CHANGE_OPEN = false;
+  ADC_BUSY = false;
+  ADC_FIRST = true;
+  CLOCK_CHANGE_OPEN = false;
+  BOD_CHANGE_OPEN = false;
+  BOD_SLEEP_OPEN = false;
+  BOD_OFF = false;
+
+  apply_inputs();
+}
+
+uint64_t hal_cycles() { return NOW; }
+
+const struct hal_stats *hal_stats() {
+  static struct hal_stats snapshot;
+  snapshot = STATS;
+  for (uint8_t i = 0; i < 8; i++) {
+    if (LAST_HIGH & (1 << i)) {
+      snapshot.pin_high_cycles[i] += NOW - HIGH_SINCE[i];
+    }
+  }
+  return &snapshot;
+}
+
+/// @brief End the run, handing control to the caller's on_done.
+static void finish(enum hal_done why) {
+  update_pins();
+  CONFIG->on_done(why);
+  abort();
+}
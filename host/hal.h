@@ -0,0 +1,194 @@
+#ifndef HOST_HAL_H
+#define HOST_HAL_H
+
+// The x86 backend of the hardware abstraction: simulated ATtiny85 registers,
+// peripherals and EEPROM driven by a virtual clock.
+//
+// The firmware sources are compiled unchanged against the headers in
+// host/include (standing in for avr-libc), which route register accesses
+// through hal_reg() / hal_reg_read(). Each access advances the virtual clock,
+// steps the timers, WDT & pin change logic, and services any pending interrupt
+// exactly as the firmware's ISR() definitions would be on the MCU.
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/// Simulated registers.
+enum hal_reg {
+  HAL_REG_PORTB = 0,
+  HAL_REG_PINB,
+  HAL_REG_DDRB,
+  HAL_REG_PCMSK,
+  HAL_REG_GIMSK,
+  HAL_REG_GIFR,
+  HAL_REG_WDTCR,
+  HAL_REG_MCUCR,
+  HAL_REG_MCUSR,
+  HAL_REG_TCCR0A,
+  HAL_REG_TCCR0B,
+  HAL_REG_TCNT0,
+  HAL_REG_OCR0A,
+  HAL_REG_OCR0B,
+  HAL_REG_TIMSK,
+  HAL_REG_TIFR,
+  HAL_REG_TCCR1,
+  HAL_REG_GTCCR,
+  HAL_REG_TCNT1,
+  HAL_REG_OCR1A,
+  HAL_REG_OCR1B,
+  HAL_REG_OCR1C,
+  HAL_REG_PLLCSR,
+  HAL_REG_CLKPR,
+  HAL_REG_OSCCAL,
+  HAL_REG_PRR,
+  HAL_REG_DIDR0,
+  HAL_REG_ADMUX,
+  HAL_REG_ADCSRA,
+  HAL_REG_ADCSRB,
+  HAL_REG_ADCL,
+  HAL_REG_ADCH,
+  HAL_REG_ACSR,
+  HAL_REG_USIDR,
+  HAL_REG_USISR,
+  HAL_REG_USICR,
+  HAL_REG_USIBR,
+  HAL_REG_COUNT,
+};
+
+/// Return the register, after advancing the virtual clock for the access.
+extern volatile uint8_t *hal_reg(uint8_t reg);
+
+/// Read a register with read side effects or no plain write semantics (the
+/// PINB inputs, and the write-one-to-clear flag registers).
+extern uint8_t hal_reg_read(uint8_t reg);
+
+/// Write a register through its simulated write semantics (see hal_write()).
+extern void hal_reg_write(uint8_t reg, uint8_t value);
+
+/// Global interrupt enable / disable, servicing any pending interrupt.
+extern void hal_sei();
+extern void hal_cli();
+extern bool hal_interrupts_enabled();
+
+/// Register the ISR for vector (see ISR() in host/include/avr/interrupt.h).
+extern void hal_isr_register(uint8_t vector, void (*isr)(void));
+
+/// Sleep in the configured sleep mode, if sleep is enabled in MCUCR.
+extern void hal_sleep();
+
+/// Busy-wait for the given number of CPU cycles (at the current clock).
+extern void hal_delay_cycles(uint64_t cycles);
+
+/// Restart the WDT count.
+extern void hal_wdt_reset();
+
+/// Account for a write to the EEPROM of the given number of bytes.
+extern void hal_eeprom_written(uint16_t bytes);
+
+/// The simulated EEPROM - every EEMEM variable, gathered into one section - and
+/// its size, for carrying its contents across a power cycle.
+extern uint8_t *hal_eeprom();
+extern size_t hal_eeprom_size();
+
+/// The level driven onto a pin by the outside world.
+enum hal_drive {
+  Hal_Float = 0, // Undriven - reads the pull-up (if enabled), else low
+  Hal_Low,
+  Hal_High,
+};
+
+/// Inputs numbered from here are external to the MCU, handled by the board
+/// model (see hal_config.on_input) rather than driving a pin.
+#define HAL_BOARD_PIN 8
+
+/// The analog input of the supply voltage (see hal_config.analog_mv), beyond
+/// the ADC channels 0-3.
+#define HAL_ANALOG_VCC 0xFF
+
+/// @brief A scripted change of an input, at an absolute virtual time.
+struct hal_input {
+  uint64_t at_us;
+  uint8_t pin; // A PORTB pin, or a board input from HAL_BOARD_PIN
+  uint8_t drive; // An enum hal_drive
+};
+
+/// Drive pin (in PORTB) from outside the MCU - for board models reacting to
+/// the outputs or board inputs.
+extern void hal_drive(uint8_t pin, uint8_t drive);
+
+/// Call hal_config.on_timer once the virtual clock reaches cycle (of the
+/// undivided system clock), replacing any earlier call - for board models
+/// keeping time of their own.
+extern void hal_timer_at(uint64_t cycle);
+
+/// @brief Cycle accounting for a run.
+struct hal_stats {
+  uint64_t wakeups;
+  /// Time spent in each state, in cycles of the undivided system clock.
+  uint64_t active_cycles;
+  uint64_t idle_cycles;
+  uint64_t pwr_down_cycles;
+  /// CPU clock cycles while active / idle - fewer than the above while the
+  /// clock is divided by CLKPR.
+  uint64_t active_clocks;
+  uint64_t idle_clocks;
+  /// Cycles with the BOD running - all but those powered down with the BOD
+  /// disabled for the sleep.
+  uint64_t bod_cycles;
+  /// Cycles with the WDT oscillator running.
+  uint64_t wdt_cycles;
+  uint64_t eeprom_bytes_written;
+  /// Cycles each pin of PORTB spent driven high as an output.
+  uint64_t pin_high_cycles[8];
+};
+
+/// Why a run ended.
+enum hal_done {
+  Hal_DoneTime = 0, // The configured duration elapsed
+  Hal_DoneHalted,   // The firmware slept with interrupts disabled (halt())
+  Hal_DoneReset,    // The WDT reset the MCU
+};
+
+/// @brief The configuration of a run.
+struct hal_config {
+  /// The virtual time the run ends at.
+  uint64_t duration_us;
+  /// The virtual time the MCU powers up at, resuming a run cut short by a
+  /// power loss - scripted inputs due before it apply at once.
+  uint64_t start_us;
+  /// The reset flags in MCUSR at power up, or 0 for a power-on reset (PORF).
+  uint8_t reset_cause;
+  /// Scripted input changes, in time order.
+  const struct hal_input *inputs;
+  uint16_t n_inputs;
+  /// The error of the WDT oscillator in parts per million (positive is slow).
+  int32_t wdt_error_ppm;
+  /// Called on each change of an output pin level.
+  void (*on_output)(uint8_t pin, bool level, uint64_t cycle);
+  /// The pins (1 << pin) pulled up on the board, reading high when released.
+  uint8_t pull_ups;
+  /// Called on each change of the level of a pin in pull_ups, whoever drives
+  /// it.
+  void (*on_line)(uint8_t pin, bool level, uint64_t cycle);
+  /// Called once the virtual clock reaches the cycle set by hal_timer_at().
+  void (*on_timer)(void);
+  /// Called for each scripted change of a board input (from HAL_BOARD_PIN).
+  void (*on_input)(uint8_t pin, uint8_t drive);
+  /// Return the voltage (in mV) of an analog input - an ADC channel (0-3) or
+  /// HAL_ANALOG_VCC. If NULL, VCC is 3V and the channels read 0V.
+  uint16_t (*analog_mv)(uint8_t input);
+  /// Called once the run ends - MUST NOT return.
+  void (*on_done)(enum hal_done why);
+};
+
+/// Reset the simulated MCU and start a run, with all inputs floating.
+extern void hal_start(const struct hal_config *config);
+
+/// The current virtual time, in cycles of the undivided system clock.
+extern uint64_t hal_cycles();
+
+/// The cycle accounting of the run so far.
+extern const struct hal_stats *hal_stats();
+
+#endif /* HOST_HAL_H */
@@ -0,0 +1,11 @@
+#ifndef HOST_AVR_CPUFUNC_H
+#define HOST_AVR_CPUFUNC_H
+
+// Host stand-in for <avr/cpufunc.h>.
+
+#include <avr/io.h>
+
+#define _NOP() hal_delay_cycles(1)
+#define _MemoryBarrier() __asm__ __volatile__("" ::: "memory")
+
+#endif /* HOST_AVR_CPUFUNC_H */
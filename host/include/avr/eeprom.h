@@ -0,0 +1,55 @@
+#ifndef HOST_AVR_EEPROM_H
+#define HOST_AVR_EEPROM_H
+
+// Host stand-in for <avr/eeprom.h>.
+//
+// EEMEM variables live in ordinary memory, starting out with the contents
+// `make flash` would program into the EEPROM. Each byte changed by a write
+// busy-waits for the duration of an EEPROM write cycle.
+//
+// They are gathered into a single section, so the simulator can carry the
+// EEPROM contents across a power cycle (see hal_eeprom()).
+
+#include <avr/io.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#define EEMEM __attribute__((section("eeprom")))
+
+static inline void eeprom_read_block(void *dst, const void *src, size_t n) {
+  hal_delay_cycles(4 * n);
+  memcpy(dst, src, n);
+}
+
+static inline void eeprom_update_block(const void *src, void *dst, size_t n) {
+  uint16_t changed = 0;
+  for (size_t i = 0; i < n; i++) {
+    if (((uint8_t *)dst)[i] != ((const uint8_t *)src)[i]) {
+      ((uint8_t *)dst)[i] = ((const uint8_t *)src)[i];
+      changed++;
+    }
+  }
+  hal_eeprom_written(changed);
+}
+
+static inline void eeprom_write_block(const void *src, void *dst, size_t n) {
+  memcpy(dst, src, n);
+  hal_eeprom_written(n);
+}
+
+static inline uint8_t eeprom_read_byte(const uint8_t *p) {
+  uint8_t b;
+  eeprom_read_block(&b, p, 1);
+  return b;
+}
+
+static inline void eeprom_update_byte(uint8_t *p, uint8_t b) {
+  eeprom_update_block(&b, p, 1);
+}
+
+static inline void eeprom_write_byte(uint8_t *p, uint8_t b) {
+  eeprom_write_block(&b, p, 1);
+}
+
+#endif /* HOST_AVR_EEPROM_H */
@@ -0,0 +1,25 @@
+#ifndef HOST_AVR_INTERRUPT_H
+#define HOST_AVR_INTERRUPT_H
+
+// Host stand-in for <avr/interrupt.h>.
+//
+// Each ISR() registers itself with the simulated MCU before main() runs, which
+// calls it whenever the vector's interrupt is enabled, pending and interrupts
+// are globally enabled.
+
+#include <avr/io.h>
+
+#define sei() hal_sei()
+#define cli() hal_cli()
+
+#define ISR(vector, ...)                                                       \
+  static void vector##_handler(void);                                          \
+  __attribute__((constructor)) static void vector##_register(void) {           \
+    hal_isr_register(vector, vector##_handler);                                \
+  }                                                                            \
+  static void vector##_handler(void)
+
+#define EMPTY_INTERRUPT(vector)                                                \
+  ISR(vector) {}
+
+#endif /* HOST_AVR_INTERRUPT_H */
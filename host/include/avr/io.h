@@ -0,0 +1,274 @@
+#ifndef HOST_AVR_IO_H
+#define HOST_AVR_IO_H
+
+// Host stand-in for <avr/io.h> (ATtiny85), routing every register access
+// through the simulated MCU in host/hal.c.
+//
+// Registers are lvalues into the simulated register file, except for those
+// with write semantics a plain store cannot express (the write-one-to-clear
+// flag registers, the WDT & clock prescaler change sequences and PINB
+// toggling) - these are rvalues, so a write that bypasses hal_write() fails to
+// compile.
+
+#include "../../hal.h"
+#include <stdint.h>
+
+#define _BV(bit) (1 << (bit))
+#define bit_is_set(sfr, bit) ((sfr) & _BV(bit))
+#define bit_is_clear(sfr, bit) (!((sfr) & _BV(bit)))
+#define loop_until_bit_is_set(sfr, bit)                                        \
+  do {                                                                         \
+  } while (bit_is_clear(sfr, bit))
+#define loop_until_bit_is_clear(sfr, bit)                                      \
+  do {                                                                         \
+  } while (bit_is_set(sfr, bit))
+
+#define HAL_SFR(reg) (*hal_reg(HAL_REG_##reg))
+#define HAL_SFR_RO(reg) (hal_reg_read(HAL_REG_##reg))
+
+#define PORTB HAL_SFR(PORTB)
+#define PINB HAL_SFR_RO(PINB)
+#define DDRB HAL_SFR(DDRB)
+#define PCMSK HAL_SFR(PCMSK)
+#define GIMSK HAL_SFR(GIMSK)
+#define GIFR HAL_SFR_RO(GIFR)
+#define WDTCR HAL_SFR_RO(WDTCR)
+#define MCUCR HAL_SFR(MCUCR)
+#define MCUSR HAL_SFR(MCUSR)
+#define TCCR0A HAL_SFR(TCCR0A)
+#define TCCR0B HAL_SFR(TCCR0B)
+#define TCNT0 HAL_SFR(TCNT0)
+#define OCR0A HAL_SFR(OCR0A)
+#define OCR0B HAL_SFR(OCR0B)
+#define TIMSK HAL_SFR(TIMSK)
+#define TIFR HAL_SFR_RO(TIFR)
+#define TCCR1 HAL_SFR(TCCR1)
+#define GTCCR HAL_SFR(GTCCR)
+#define TCNT1 HAL_SFR(TCNT1)
+#define OCR1A HAL_SFR(OCR1A)
+#define OCR1B HAL_SFR(OCR1B)
+#define OCR1C HAL_SFR(OCR1C)
+#define PLLCSR HAL_SFR(PLLCSR)
+#define CLKPR HAL_SFR_RO(CLKPR)
+#define OSCCAL HAL_SFR(OSCCAL)
+#define PRR HAL_SFR(PRR)
+#define DIDR0 HAL_SFR(DIDR0)
+#define ADMUX HAL_SFR(ADMUX)
+#define ADCSRA HAL_SFR(ADCSRA)
+#define ADCSRB HAL_SFR(ADCSRB)
+#define ADCL HAL_SFR(ADCL)
+#define ADCH HAL_SFR(ADCH)
+#define ACSR HAL_SFR(ACSR)
+#define USIDR HAL_SFR(USIDR)
+#define USISR HAL_SFR_RO(USISR)
+#define USICR HAL_SFR(USICR)
+#define USIBR HAL_SFR(USIBR)
+
+// PORTB / PINB / DDRB
+#define PB0 0
+#define PB1 1
+#define PB2 2
+#define PB3 3
+#define PB4 4
+#define PB5 5
+#define PORTB0 0
+#define PORTB1 1
+#define PORTB2 2
+#define PORTB3 3
+#define PORTB4 4
+#define PORTB5 5
+#define PINB0 0
+#define PINB1 1
+#define PINB2 2
+#define PINB3 3
+#define PINB4 4
+#define PINB5 5
+#define DDB0 0
+#define DDB1 1
+#define DDB2 2
+#define DDB3 3
+#define DDB4 4
+#define DDB5 5
+
+// PCMSK
+#define PCINT0 0
+#define PCINT1 1
+#define PCINT2 2
+#define PCINT3 3
+#define PCINT4 4
+#define PCINT5 5
+
+// GIMSK / GIFR
+#define INT0 6
+#define PCIE 5
+#define INTF0 6
+#define PCIF 5
+
+// WDTCR
+#define WDIF 7
+#define WDIE 6
+#define WDP3 5
+#define WDCE 4
+#define WDE 3
+#define WDP2 2
+#define WDP1 1
+#define WDP0 0
+
+// MCUCR
+#define BODS 7
+#define PUD 6
+#define SE 5
+#define SM1 4
+#define SM0 3
+#define BODSE 2
+#define ISC01 1
+#define ISC00 0
+
+// MCUSR
+#define WDRF 3
+#define BORF 2
+#define EXTRF 1
+#define PORF 0
+
+// TCCR0A / TCCR0B
+#define COM0A1 7
+#define COM0A0 6
+#define COM0B1 5
+#define COM0B0 4
+#define WGM01 1
+#define WGM00 0
+#define FOC0A 7
+#define FOC0B 6
+#define WGM02 3
+#define CS02 2
+#define CS01 1
+#define CS00 0
+
+// TIMSK / TIFR
+#define OCIE1A 6
+#define OCIE1B 5
+#define OCIE0A 4
+#define OCIE0B 3
+#define TOIE1 2
+#define TOIE0 1
+#define OCF1A 6
+#define OCF1B 5
+#define OCF0A 4
+#define OCF0B 3
+#define TOV1 2
+#define TOV0 1
+
+// TCCR1 / GTCCR
+#define CTC1 7
+#define PWM1A 6
+#define COM1A1 5
+#define COM1A0 4
+#define CS13 3
+#define CS12 2
+#define CS11 1
+#define CS10 0
+#define TSM 7
+#define PWM1B 6
+#define COM1B1 5
+#define COM1B0 4
+#define FOC1B 3
+#define FOC1A 2
+#define PSR1 1
+#define PSR0 0
+
+// PLLCSR
+#define LSM 7
+#define PCKE 2
+#define PLLE 1
+#define PLOCK 0
+
+// CLKPR
+#define CLKPCE 7
+#define CLKPS3 3
+#define CLKPS2 2
+#define CLKPS1 1
+#define CLKPS0 0
+
+// PRR
+#define PRTIM1 3
+#define PRTIM0 2
+#define PRUSI 1
+#define PRADC 0
+
+// DIDR0
+#define ADC0D 5
+#define ADC2D 4
+#define ADC3D 3
+#define ADC1D 2
+#define AIN1D 1
+#define AIN0D 0
+
+// ADMUX / ADCSRA / ADCSRB
+#define REFS1 7
+#define REFS0 6
+#define ADLAR 5
+#define REFS2 4
+#define MUX3 3
+#define MUX2 2
+#define MUX1 1
+#define MUX0 0
+#define ADEN 7
+#define ADSC 6
+#define ADATE 5
+#define ADIF 4
+#define ADIE 3
+#define ADPS2 2
+#define ADPS1 1
+#define ADPS0 0
+#define BIN 7
+#define ACME 6
+#define IPR 5
+#define ADTS2 2
+#define ADTS1 1
+#define ADTS0 0
+
+// ACSR
+#define ACD 7
+#define ACBG 6
+#define ACO 5
+#define ACI 4
+#define ACIE 3
+#define ACIS1 1
+#define ACIS0 0
+
+// USICR / USISR
+#define USISIE 7
+#define USIOIE 6
+#define USIWM1 5
+#define USIWM0 4
+#define USICS1 3
+#define USICS0 2
+#define USICLK 1
+#define USITC 0
+#define USISIF 7
+#define USIOIF 6
+#define USIPF 5
+#define USIDC 4
+#define USICNT3 3
+#define USICNT2 2
+#define USICNT1 1
+#define USICNT0 0
+
+// Interrupt vectors, numbered as in the MCU vector table.
+#define INT0_vect 1
+#define PCINT0_vect 2
+#define TIM1_COMPA_vect 3
+#define TIM1_OVF_vect 4
+#define TIM0_OVF_vect 5
+#define EE_RDY_vect 6
+#define ANA_COMP_vect 7
+#define ADC_vect 8
+#define TIM1_COMPB_vect 9
+#define TIM0_COMPA_vect 10
+#define TIM0_COMPB_vect 11
+#define WDT_vect 12
+#define USI_START_vect 13
+#define USI_OVF_vect 14
+#define HAL_VECTOR_COUNT 15
+
+#endif /* HOST_AVR_IO_H */
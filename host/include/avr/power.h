@@ -0,0 +1,48 @@
+#ifndef HOST_AVR_POWER_H
+#define HOST_AVR_POWER_H
+
+// Host stand-in for <avr/power.h> (ATtiny85).
+
+#include <avr/io.h>
+
+#define power_adc_enable() (PRR &= (uint8_t) ~(1 << PRADC))
+#define power_adc_disable() (PRR |= (uint8_t)(1 << PRADC))
+#define power_usi_enable() (PRR &= (uint8_t) ~(1 << PRUSI))
+#define power_usi_disable() (PRR |= (uint8_t)(1 << PRUSI))
+#define power_timer0_enable() (PRR &= (uint8_t) ~(1 << PRTIM0))
+#define power_timer0_disable() (PRR |= (uint8_t)(1 << PRTIM0))
+#define power_timer1_enable() (PRR &= (uint8_t) ~(1 << PRTIM1))
+#define power_timer1_disable() (PRR |= (uint8_t)(1 << PRTIM1))
+
+#define HAL_PRR_ALL                                                            \
+  ((1 << PRADC) | (1 << PRUSI) | (1 << PRTIM0) | (1 << PRTIM1))
+#define power_all_enable() (PRR &= (uint8_t) ~HAL_PRR_ALL)
+#define power_all_disable() (PRR |= (uint8_t)HAL_PRR_ALL)
+
+typedef enum {
+  clock_div_1 = 0,
+  clock_div_2 = 1,
+  clock_div_4 = 2,
+  clock_div_8 = 3,
+  clock_div_16 = 4,
+  clock_div_32 = 5,
+  clock_div_64 = 6,
+  clock_div_128 = 7,
+  clock_div_256 = 8,
+} clock_div_t;
+
+/// Write the system clock prescaler with the timed change sequence, with
+/// interrupts disabled.
+static inline void clock_prescale_set(clock_div_t div) {
+  bool enabled = hal_interrupts_enabled();
+  hal_cli();
+  hal_reg_write(HAL_REG_CLKPR, 1 << CLKPCE);
+  hal_reg_write(HAL_REG_CLKPR, div);
+  if (enabled) {
+    hal_sei();
+  }
+}
+
+#define clock_prescale_get() ((clock_div_t)(CLKPR & 0x0F))
+
+#endif /* HOST_AVR_POWER_H */
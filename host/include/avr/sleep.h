@@ -0,0 +1,32 @@
+#ifndef HOST_AVR_SLEEP_H
+#define HOST_AVR_SLEEP_H
+
+// Host stand-in for <avr/sleep.h>.
+
+#include <avr/io.h>
+
+#define SLEEP_MODE_IDLE 0
+#define SLEEP_MODE_ADC (1 << SM0)
+#define SLEEP_MODE_PWR_DOWN (1 << SM1)
+
+#define set_sleep_mode(mode)                                                   \
+  (MCUCR = (MCUCR & ~((1 << SM1) | (1 << SM0))) | (mode))
+#define sleep_enable() (MCUCR |= (1 << SE))
+#define sleep_disable() (MCUCR &= ~(1 << SE))
+#define sleep_cpu() hal_sleep()
+
+/// Disable the BOD for the next sleep with the timed BODS/BODSE sequence.
+#define sleep_bod_disable()                                                    \
+  do {                                                                         \
+    uint8_t mcucr = MCUCR | (1 << BODS) | (1 << BODSE);                        \
+    hal_reg_write(HAL_REG_MCUCR, mcucr);                                       \
+    hal_reg_write(HAL_REG_MCUCR, mcucr & ~(1 << BODSE));                       \
+  } while (0)
+#define sleep_mode()                                                           \
+  do {                                                                         \
+    sleep_enable();                                                            \
+    sleep_cpu();                                                               \
+    sleep_disable();                                                           \
+  } while (0)
+
+#endif /* HOST_AVR_SLEEP_H */
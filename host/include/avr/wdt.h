@@ -0,0 +1,10 @@
+#ifndef HOST_AVR_WDT_H
+#define HOST_AVR_WDT_H
+
+// Host stand-in for <avr/wdt.h>.
+
+#include <avr/io.h>
+
+#define wdt_reset() hal_wdt_reset()
+
+#endif /* HOST_AVR_WDT_H */
@@ -0,0 +1,37 @@
+#ifndef HOST_UTIL_ATOMIC_H
+#define HOST_UTIL_ATOMIC_H
+
+// Host stand-in for <util/atomic.h>, saving and restoring the simulated global
+// interrupt flag around the block.
+
+#include <avr/interrupt.h>
+#include <stdint.h>
+
+static inline uint8_t hal_atomic_enter(void) {
+  hal_cli();
+  return 1;
+}
+
+static inline void hal_atomic_restore(uint8_t *enabled) {
+  if (*enabled) {
+    hal_sei();
+  }
+}
+
+static inline void hal_atomic_force_on(uint8_t *unused) {
+  (void)unused;
+  hal_sei();
+}
+
+#define ATOMIC_BLOCK(type)                                                     \
+  for (type, hal_atomic_todo = hal_atomic_enter(); hal_atomic_todo;            \
+       hal_atomic_todo = 0)
+
+#define ATOMIC_RESTORESTATE                                                    \
+  uint8_t hal_atomic_state __attribute__((__cleanup__(hal_atomic_restore))) =  \
+      hal_interrupts_enabled()
+#define ATOMIC_FORCEON                                                         \
+  uint8_t hal_atomic_state __attribute__((__cleanup__(hal_atomic_force_on))) = \
+      0
+
+#endif /* HOST_UTIL_ATOMIC_H */
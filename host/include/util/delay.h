@@ -0,0 +1,11 @@
+#ifndef HOST_UTIL_DELAY_H
+#define HOST_UTIL_DELAY_H
+
+// Host stand-in for <util/delay.h>, advancing the virtual clock.
+
+#include <avr/io.h>
+
+#define _delay_us(us) hal_delay_cycles((uint64_t)((us) * (F_CPU / 1000000.0)))
+#define _delay_ms(ms) hal_delay_cycles((uint64_t)((ms) * (F_CPU / 1000.0)))
+
+#endif /* HOST_UTIL_DELAY_H */
@@ -0,0 +1,1342 @@
+// Copyright 2024 Dominic Dwyer (dom@itsallbroken.com)
+//
+// Licensed under the Apache License, Version 2.0 (the "License"); you may not
+// use this file except in compliance with the License. You may obtain a copy of
+// the License at
+//
+//             http://www.apache.org/licenses/LICENSE-2.0
+//
+// Unless required by applicable law or agreed to in writing, software
+// distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+// WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+// License for the specific language governing permissions and limitations under
+// the License.
+
+// Native simulation of the firmware.
+//
+// The firmware sources are compiled for the host against the simulated MCU in
+// hal.c, and run against a set of scripted scenarios spanning days to months of
+// virtual time - each completing in seconds. For each scenario the pump runs,
+// wake-ups, cycle accounting and any trained duration are reported, and the
+// outcome checked: the scheduled routines and their spacing, each run's length,
+// any trained duration, and the history ring against the runs observed.
+//
+// Each scenario runs in a child process, starting from a freshly reset MCU
+// (and the flashed EEPROM image). A scenario that halts (unless made to) or
+// resets the MCU, or fails the checks of its outcome, fails the run.
+//
+// A scenario may cut the power part way through - the run up to the outage
+// and the run after it are separate child processes, the second starting the
+// firmware afresh from the EEPROM contents the first left behind.
+//
+// In an RTC build (`make sim RTC=1 CHANNELS=1`) a DS3231 is modelled on the
+// two-wire bus, its alarm output sharing the button line.
+//
+// This file is built for the host by `make sim` and is excluded from the
+// firmware sources.
+
+#include "../halt.h"
+#include "../history.h"
+#include "../settings.h"
+#include "../supply.h"
+#include "hal.h"
+#include <avr/io.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+// The firmware's main() is renamed by the build, freeing the name for the
+// simulator.
+#undef main
+extern int firmware_main(void);
+
+/// The firmware's EEPROM history ring (see history.c).
+extern struct history_record HISTORY_RECORDS[HISTORY_RECORD_COUNT];
+
+/// Pins in PORTB, mirroring pins.h.
+#if defined(RTC)
+#define RTC_SDA_PIN 0
+#define OVERFLOW_SIGNAL_PIN_1 1
+#define RTC_SCL_PIN 2
+#define PUMP_PIN_1 3
+#define BUTTON_LINE_PIN 4
+
+/// The button is a board input, sharing its line with the RTC alarm output.
+#define BUTTON_PIN HAL_BOARD_PIN
+
+/// The overflow probe of the channel, wetting its saucer when driven low.
+#define PROBE(channel) OVERFLOW_SIGNAL_PIN_1
+#elif defined(CHANNEL_EXPANDER)
+#define BUTTON_PIN 0
+#define EXPANDER_DATA_PIN 1
+#define EXPANDER_CLOCK_PIN 2
+#define EXPANDER_LATCH_PIN 3
+#define OVERFLOW_SENSE_PIN 4
+
+/// The overflow probe of each channel is a board input, wetting its saucer
+/// when driven low.
+#define PROBE(channel) (HAL_BOARD_PIN + (channel))
+#else
+#define BUTTON_PIN 0
+#define OVERFLOW_SIGNAL_PIN_1 1
+#define OVERFLOW_SIGNAL_PIN_2 2
+#define PUMP_PIN_1 3
+#define PUMP_PIN_2 4
+
+/// The overflow probe of each channel, wetting its saucer when driven low.
+#define PROBE(channel)                                                         \
+  ((channel) == 0 ? OVERFLOW_SIGNAL_PIN_1 : OVERFLOW_SIGNAL_PIN_2)
+#endif
+
+#define MS(x) ((uint64_t)(x) * 1000)
+#define SECS(x) (MS(x) * 1000)
+#define HOURS(x) (SECS(x) * 60 * 60)
+#define DAYS(x) (HOURS(x) * 24)
+
+/// A pump run recorded in the history may be shorter than observed by this
+/// (the record is in whole tenths of a second), and either may be longer than
+/// the other by this tolerance - half the longest WDT interval timing a
+/// period of an adaptive run, the resolution of a run cut short by an
+/// overflow. A non-adaptive run is timed by a single timer, resolved to half
+/// the interval in progress (see wdt_interval_within()).
+#define HISTORY_TRUNCATE_MS 100
+#define HISTORY_TOLERANCE_MS 128
+
+/// A run may differ from its (supply scaled) duration by this, plus the
+/// percentage of the duration - the supply is measured by the firmware with
+/// the resolution of the ADC.
+#define RUN_TOLERANCE_MS 100
+#define RUN_TOLERANCE_PCT 2
+
+/// The scheduled runs may be spaced this far from the interval, in parts per
+/// million - well within the calibration of the WDT.
+#define INTERVAL_TOLERANCE_PPM 200
+
+/// A duration trained by holding the button may differ from the hold by this.
+#define TRAINED_TOLERANCE_MS 100
+
+/// The number of runs of each pump whose start & length are kept for the
+/// checks.
+#define RUN_LOG_SIZE 128
+
+/// A pump pin low for less than this is still the same run (PWM periods and
+/// the soft-start ramp).
+#define RUN_GAP_US MS(50)
+
+/// Runs shorter than this are the triple flash of a skipped pump.
+#define FLASH_US MS(150)
+
+/// The supply voltage (shared by the MCU & pumps) at the start of each
+/// scenario, and the divider feeding it to the sense pin in a SUPPLY_SENSE
+/// build (matching the default settings).
+#define SUPPLY_MV 3000
+#define SUPPLY_SENSE_DIV 11
+
+/// Supply current model for the ATtiny85 at VCC = 3V, in microamps.
+///
+/// Typical figures read from the "Typical Characteristics" section of the
+/// ATtiny25/45/85 datasheet (internal RC oscillator, 25C) - the active & idle
+/// currents are a fixed part plus a part proportional to the CPU clock
+/// (fitted to the 1MHz & 8MHz curves).
+#define CURRENT_ACTIVE_UA 200.0
+#define CURRENT_ACTIVE_UA_PER_MHZ 300.0
+#define CURRENT_IDLE_UA 40.0
+#define CURRENT_IDLE_UA_PER_MHZ 89.0
+#define CURRENT_PWR_DOWN_UA 0.15 // With the WDT stopped
+#define CURRENT_WDT_UA 4.35      // While the WDT runs, in any mode
+#define CURRENT_BOD_UA 17.0      // When enabled by the fuses, in any mode
+
+/// A press (or release) of the button, bouncing for ~1ms before settling.
+#define BOUNCE(at, drive, settled)                                             \
+  {(at), BUTTON_PIN, (drive)}, {(at) + 150, BUTTON_PIN, (settled)},            \
+      {(at) + 300, BUTTON_PIN, (drive)}, {(at) + 550, BUTTON_PIN, (settled)},  \
+      {(at) + 900, BUTTON_PIN, (drive)}
+#define PRESS(at) BOUNCE(at, Hal_Low, Hal_Float)
+#define RELEASE(at) BOUNCE(at, Hal_Float, Hal_Low)
+
+/// A named sequence of input changes, run for duration_us.
+struct scenario {
+  const char *name;
+  uint64_t duration_us;
+  int32_t wdt_error_ppm;
+  const struct hal_input *inputs;
+  uint16_t n_inputs;
+  /// The supply voltage at the end, falling linearly from SUPPLY_MV - or 0 to
+  /// hold it steady.
+  uint16_t supply_end_mv;
+  /// The time the power is cut at (or 0 for none), for how long, and the reset
+  /// flags (MCUSR) as it returns.
+  uint64_t outage_at_us;
+  uint64_t outage_us;
+  uint8_t outage_cause;
+  /// The time the firmware halts at (as a failed ASSERT would), or 0 for none
+  /// - the run is then expected to end halted.
+  uint64_t halt_at_us;
+  /// Checks the outcome once run, printing and returning false on a failure -
+  /// or NULL for none.
+  bool (*check)(void);
+};
+
+/// No inputs - the unit sleeps & waters for three months.
+static const struct hal_input QUARTER_YEAR[] = {};
+
+/// Hold the button for 5 seconds (bouncing on press and release), training a
+/// new pump duration, then water for two days.
+static const struct hal_input BOUNCY_TRAINING[] = {
+    PRESS(SECS(2)),
+    {SECS(2) + MS(40), BUTTON_PIN, Hal_Float}, // A glitch mid-press
+    {SECS(2) + MS(40) + 200, BUTTON_PIN, Hal_Low},
+    RELEASE(SECS(7)),
+};
+
+/// Hold the button for 20 minutes, training a run longer than the debounce
+/// timer's 16-bit period count once reached.
+static const struct hal_input LONG_TRAINING[] = {
+    PRESS(SECS(2)),
+    RELEASE(SECS(2) + SECS(20 * 60)),
+};
+
+/// Tap the button for 300ms, triggering a test run of the pumps.
+static const struct hal_input TEST_TAP[] = {
+    PRESS(SECS(2)),
+    RELEASE(SECS(2) + MS(300)),
+};
+
+/// The saucer of pump 1 overflows part way through a test run, and has dried
+/// out by the first scheduled run.
+static const struct hal_input OVERFLOW_MIDRUN[] = {
+    PRESS(SECS(2)),
+    RELEASE(SECS(2) + MS(300)),
+    {SECS(4), PROBE(0), Hal_Low},
+    {HOURS(1), PROBE(0), Hal_Float},
+};
+
+/// Train a 5 second run, then water for a month as the supply sags.
+static const struct hal_input SAGGING_SUPPLY[] = {
+    PRESS(SECS(2)),
+    RELEASE(SECS(7)),
+};
+
+/// Every saucer is wet for the whole week.
+static const struct hal_input WET_SAUCER[] = {
+    {0, PROBE(0), Hal_Low},
+#if CHANNEL_COUNT > 1
+    {0, PROBE(1), Hal_Low},
+#endif
+#if CHANNEL_COUNT > 2
+    {0, PROBE(2), Hal_Low},
+#endif
+#if CHANNEL_COUNT > 3
+    {0, PROBE(3), Hal_Low},
+#endif
+};
+
+static bool check_scheduled(void);
+static bool check_training(void);
+static bool check_long_training(void);
+static bool check_test_tap(void);
+static bool check_overflow_midrun(void);
+static bool check_wet_saucer(void);
+static bool check_power_cut(void);
+static bool check_brownout(void);
+#ifndef RTC
+static bool check_halted(void);
+#endif
+#ifdef RTC
+static bool check_rtc_week(void);
+#endif
+
+#define SCENARIO(name, duration, ppm, inputs, check)                           \
+  {name, duration, ppm, inputs, sizeof(inputs) / sizeof(inputs[0]),           \
+   0,    0,        0,   0,      0,                                            \
+   check}
+#define SCENARIO_SAG(name, duration, end_mv, inputs, check)                    \
+  {name,   duration, 0, inputs, sizeof(inputs) / sizeof(inputs[0]),            \
+   end_mv, 0,        0, 0,      0,                                             \
+   check}
+#define SCENARIO_OUTAGE(name, duration, at, length, cause, inputs, check)      \
+  {name, duration, 0,      inputs, sizeof(inputs) / sizeof(inputs[0]),        \
+   0,    at,       length, cause,  0,                                         \
+   check}
+#define SCENARIO_HALT(name, duration, at, inputs, check)                       \
+  {name, duration, 0, inputs, sizeof(inputs) / sizeof(inputs[0]),             \
+   0,    0,        0, 0,      at,                                             \
+   check}
+
+static const struct scenario SCENARIOS[] = {
+    SCENARIO("quarter_year", DAYS(90), 0, QUARTER_YEAR, check_scheduled),
+    SCENARIO("bouncy_training", DAYS(2), 0, BOUNCY_TRAINING, check_training),
+    SCENARIO("long_training", DAYS(2), 0, LONG_TRAINING, check_long_training),
+    SCENARIO("test_tap", HOURS(1), 0, TEST_TAP, check_test_tap),
+    // The run cut short by the overflow is recorded for the time it ran.
+    SCENARIO("overflow_midrun", DAYS(2), 0, OVERFLOW_MIDRUN,
+             check_overflow_midrun),
+    SCENARIO("wet_saucer", DAYS(7), 0, WET_SAUCER, check_wet_saucer),
+    // A WDT oscillator running 10% slow, corrected by the calibration.
+    SCENARIO("wdt_drift", DAYS(30), 100000, QUARTER_YEAR, check_scheduled),
+    // The supply falling by a fifth, each run lengthened to deliver the
+    // trained volume.
+    SCENARIO_SAG("sagging_supply", DAYS(30), 2400, SAGGING_SUPPLY,
+                 check_training),
+    // The power is cut for 10 minutes part way through pump 1's test run - the
+    // unfinished routine is run again once it returns, and the schedule
+    // resumes from the checkpoint.
+    SCENARIO_OUTAGE("power_cut", DAYS(2), SECS(4), SECS(600), 1 << PORF,
+                    TEST_TAP, check_power_cut),
+    // As above, but a brown-out resets the MCU - the routine is dropped.
+    SCENARIO_OUTAGE("brownout", DAYS(2), SECS(4), SECS(1), 1 << BORF,
+                    TEST_TAP, check_brownout),
+#ifndef RTC
+    // The firmware halts part way through pump 1's test run - every pump is
+    // turned off, including those latched on the shift register outputs.
+    SCENARIO_HALT("halt_midrun", HOURS(1), SECS(4), TEST_TAP, check_halted),
+#endif
+#ifdef RTC
+    // A WDT oscillator running 10% slow, with the routines held to 07:00 by
+    // the RTC from a start at 22:00.
+    SCENARIO("rtc_week", DAYS(7), 100000, QUARTER_YEAR, check_rtc_week),
+#endif
+};
+
+/// The pump runs observed on a single pump output.
+struct pump_runs {
+  uint64_t count;
+  uint64_t flashes;
+  uint64_t first_start;
+  uint64_t last_start;
+  uint64_t last_length;
+  /// The start & length of each run, up to RUN_LOG_SIZE of them.
+  uint64_t starts[RUN_LOG_SIZE];
+  uint64_t lengths[RUN_LOG_SIZE];
+  /// The start of the current run, and the time its output last went low.
+  uint64_t start;
+  uint64_t last_low;
+  /// The cycles the output spent high, and the time it last went high.
+  uint64_t high_cycles;
+  uint64_t last_high;
+  bool level;
+};
+
+static const struct scenario *SCENARIO_RUNNING;
+static struct pump_runs RUNS[CHANNEL_COUNT];
+
+/// In the run up to a power outage, the pipe handing its state to the run
+/// after it - or -1 otherwise.
+static int OUTAGE_PIPE = -1;
+
+/// The cycle accounting of the run before a power outage, if any.
+static struct hal_stats OUTAGE_STATS;
+
+/// Count the run (or flash) ending at r->last_low.
+static void run_ended(struct pump_runs *r) {
+  if (r->last_low - r->start < FLASH_US * (F_CPU / 1000000)) {
+    r->flashes++;
+    return;
+  }
+
+  if (r->count < RUN_LOG_SIZE) {
+    r->starts[r->count] = r->start;
+    r->lengths[r->count] = r->last_low - r->start;
+  }
+  if (r->count++ == 0) {
+    r->first_start = r->start;
+  }
+  r->last_start = r->start;
+  r->last_length = r->last_low - r->start;
+}
+
+/// Track a change of the output of pump.
+static void on_pump(uint8_t pump, bool level, uint64_t cycle) {
+  struct pump_runs *r = &RUNS[pump];
+  if (level == r->level) {
+    return;
+  }
+  r->level = level;
+
+  if (!level) {
+    r->high_cycles += cycle - r->last_high;
+    r->last_low = cycle;
+    return;
+  }
+  r->last_high = cycle;
+
+  // A rising edge soon after the output went low continues the same run.
+  if (r->start != 0 &&
+      cycle - r->last_low < RUN_GAP_US * (F_CPU / 1000000)) {
+    return;
+  }
+  if (r->start != 0) {
+    run_ended(r);
+  }
+  r->start = cycle;
+}
+
+#ifdef CHANNEL_EXPANDER
+
+/// The 74HC595 driving the pumps & probe selects: the shift register, the
+/// latched outputs, and the clock & latch inputs.
+static uint8_t SHIFT;
+static uint8_t LATCHED;
+static bool DATA;
+static bool CLOCK;
+static bool LATCH;
+
+/// The probes (1 << channel) in a wet saucer.
+static uint8_t WET;
+
+/// @brief Pull the sense line low if a selected (low) probe is wet.
+static void drive_sense() {
+  bool low = false;
+  for (uint8_t i = 0; i < CHANNEL_COUNT; i++) {
+    if ((WET & (1 << i)) && (LATCHED & (1 << (i + 4))) == 0) {
+      low = true;
+    }
+  }
+  hal_drive(OVERFLOW_SENSE_PIN, low ? Hal_Low : Hal_Float);
+}
+
+static void on_output(uint8_t pin, bool level, uint64_t cycle) {
+  switch (pin) {
+  case EXPANDER_DATA_PIN:
+    DATA = level;
+    break;
+  case EXPANDER_CLOCK_PIN:
+    if (level && !CLOCK) {
+      SHIFT = (SHIFT << 1) | DATA;
+    }
+    CLOCK = level;
+    break;
+  case EXPANDER_LATCH_PIN:
+    if (level && !LATCH) {
+      LATCHED = SHIFT;
+      for (uint8_t i = 0; i < CHANNEL_COUNT; i++) {
+        on_pump(i, (LATCHED & (1 << i)) != 0, cycle);
+      }
+      drive_sense();
+    }
+    LATCH = level;
+    break;
+  }
+}
+
+static void on_input(uint8_t pin, uint8_t drive) {
+  uint8_t probe = 1 << (pin - HAL_BOARD_PIN);
+  WET = drive == Hal_Low ? WET | probe : WET & ~probe;
+  drive_sense();
+}
+
+#elif defined(RTC)
+
+static void on_output(uint8_t pin, bool level, uint64_t cycle) {
+  if (pin == PUMP_PIN_1) {
+    on_pump(0, level, cycle);
+  }
+}
+
+#else
+
+static void on_output(uint8_t pin, bool level, uint64_t cycle) {
+  if (pin == PUMP_PIN_1 || pin == PUMP_PIN_2) {
+    on_pump(pin == PUMP_PIN_2, level, cycle);
+  }
+}
+
+#endif /* CHANNEL_EXPANDER */
+
+#ifndef RTC
+
+/// Halt the firmware at the time set by the scenario, as a failed ASSERT
+/// would - from whatever it is doing.
+static void on_timer() { halt(); }
+
+#endif /* RTC */
+
+#ifdef RTC
+
+/// The RTC time as each scenario starts - 22:00 on 2 March 2026, in seconds
+/// since 2000-01-01.
+#define RTC_START ((uint64_t)9557 * 24 * 60 * 60 + 22 * 60 * 60)
+
+/// The Unix time of 2000-01-01.
+#define RTC_EPOCH 946684800
+
+/// The 7-bit bus address of the DS3231.
+#define RTC_ADDRESS 0x68
+
+/// The DS3231 registers - the time & date (latched at each start condition),
+/// alarm 1 & 2, control & status, aging offset and temperature.
+#define RTC_REG_COUNT 0x13
+#define RTC_REG_ALARM1 0x07
+#define RTC_REG_CONTROL 0x0E
+#define RTC_REG_STATUS 0x0F
+
+#define RTC_INTCN (1 << 2)
+#define RTC_A1IE (1 << 0)
+#define RTC_OSF (1 << 7)
+#define RTC_EN32KHZ (1 << 3)
+#define RTC_A1F (1 << 0)
+#define RTC_A2F (1 << 1)
+
+/// The state of the bus slave.
+enum i2c_state {
+  I2c_Idle = 0, // Waiting for a start condition
+  I2c_Address,  // Receiving the address & direction
+  I2c_Write,    // Receiving the register pointer, then register values
+  I2c_Read,     // Sending register values
+  I2c_Ignore,   // Addressed elsewhere, or the master ended the read
+};
+
+/// The registers, set to a running clock with the alarm interrupt off.
+static uint8_t RTC_REGS[RTC_REG_COUNT] = {
+    [RTC_REG_CONTROL] = RTC_INTCN,
+    [RTC_REG_STATUS] = RTC_EN32KHZ,
+};
+
+/// The bus slave state, the bit (0-7, or 8 for the acknowledge) being
+/// clocked, the byte being received or sent, and the register pointer.
+static uint8_t I2C_STATE;
+static uint8_t I2C_BIT;
+static uint8_t I2C_BYTE;
+static uint8_t I2C_POINTER;
+
+/// True once the register pointer has been written in I2c_Write, and if the
+/// master acknowledged the last byte sent in I2c_Read.
+static bool I2C_POINTED;
+static bool I2C_ACKED;
+
+/// The levels of the bus lines.
+static bool SDA = true;
+static bool SCL = true;
+
+/// True while the button is pressed.
+static bool BUTTON_PRESSED;
+
+/// @brief Return the RTC time at cycle, in seconds since 2000-01-01.
+static uint64_t rtc_seconds(uint64_t cycle) { return RTC_START + cycle / F_CPU; }
+
+static uint8_t to_bcd(uint8_t value) { return (value / 10) << 4 | value % 10; }
+
+static uint8_t from_bcd(uint8_t bcd) { return (bcd >> 4) * 10 + (bcd & 0x0F); }
+
+/// @brief Drive the button line low while the button is pressed or the alarm
+/// interrupt is asserted.
+static void drive_button_line() {
+  uint8_t control = RTC_REGS[RTC_REG_CONTROL];
+  bool alarm = (control & RTC_INTCN) && (control & RTC_A1IE) &&
+               (RTC_REGS[RTC_REG_STATUS] & RTC_A1F);
+  hal_drive(BUTTON_LINE_PIN, BUTTON_PRESSED || alarm ? Hal_Low : Hal_Float);
+}
+
+/// @brief Schedule the next match of alarm 1 after the RTC time at cycle.
+///
+/// Only the once-a-day match of the hours, minutes & seconds (A1M4 alone
+/// set) is modelled - any other alarm never fires.
+static void alarm_schedule(uint64_t cycle) {
+  const uint8_t *a = &RTC_REGS[RTC_REG_ALARM1];
+  if ((a[0] | a[1] | a[2]) & 0x80 || (a[3] & 0x80) == 0) {
+    hal_timer_at(UINT64_MAX);
+    return;
+  }
+
+  uint64_t time_of_day = from_bcd(a[2] & 0x3F) * 60 * 60 +
+                         from_bcd(a[1] & 0x7F) * 60 + from_bcd(a[0] & 0x7F);
+  uint64_t now = rtc_seconds(cycle);
+  uint64_t at = now - now % (24 * 60 * 60) + time_of_day;
+  if (at <= now) {
+    at += 24 * 60 * 60;
+  }
+  hal_timer_at((at - RTC_START) * F_CPU);
+}
+
+/// Set the alarm 1 flag on a match, and schedule the next.
+static void on_timer() {
+  RTC_REGS[RTC_REG_STATUS] |= RTC_A1F;
+  alarm_schedule(hal_cycles() + F_CPU);
+  drive_button_line();
+}
+
+/// @brief Latch the time & date registers from the RTC time at cycle.
+static void rtc_latch(uint64_t cycle) {
+  time_t t = RTC_EPOCH + rtc_seconds(cycle);
+  struct tm tm;
+  gmtime_r(&t, &tm);
+  RTC_REGS[0] = to_bcd(tm.tm_sec);
+  RTC_REGS[1] = to_bcd(tm.tm_min);
+  RTC_REGS[2] = to_bcd(tm.tm_hour);
+  RTC_REGS[3] = tm.tm_wday + 1;
+  RTC_REGS[4] = to_bcd(tm.tm_mday);
+  RTC_REGS[5] = to_bcd(tm.tm_mon + 1);
+  RTC_REGS[6] = to_bcd(tm.tm_year - 100);
+}
+
+/// @brief Store a byte written by the master at the register pointer.
+///
+/// The time & date are not writable, and the status flags are only cleared.
+static void rtc_write(uint8_t value) {
+  uint8_t reg = I2C_POINTER;
+  I2C_POINTER = (I2C_POINTER + 1) % RTC_REG_COUNT;
+
+  if (reg == RTC_REG_STATUS) {
+    uint8_t flags = RTC_OSF | RTC_A2F | RTC_A1F;
+    RTC_REGS[reg] =
+        (RTC_REGS[reg] & flags & value) | (value & RTC_EN32KHZ);
+  } else if (reg >= RTC_REG_ALARM1) {
+    RTC_REGS[reg] = value;
+  }
+  alarm_schedule(hal_cycles());
+  drive_button_line();
+}
+
+/// @brief Drive SDA low, or release it.
+static void sda_drive(bool low) {
+  hal_drive(RTC_SDA_PIN, low ? Hal_Low : Hal_Float);
+}
+
+/// @brief Step the bus slave on a change of SDA or SCL.
+static void on_line(uint8_t pin, bool level, uint64_t cycle) {
+  if (pin == RTC_SDA_PIN) {
+    SDA = level;
+    if (!SCL) {
+      return;
+    }
+
+    // SDA changing while SCL is high is a start (falling) or stop (rising)
+    // condition.
+    sda_drive(false);
+    if (!level) {
+      rtc_latch(cycle);
+      I2C_STATE = I2c_Address;
+      I2C_BIT = 0;
+      I2C_BYTE = 0;
+    } else {
+      I2C_STATE = I2c_Idle;
+    }
+    return;
+  }
+  if (pin != RTC_SCL_PIN) {
+    return;
+  }
+  SCL = level;
+  if (I2C_STATE == I2c_Idle || I2C_STATE == I2c_Ignore) {
+    return;
+  }
+
+  // Bits (numbered from the start of each byte, the acknowledge last) are
+  // sampled on the rising edge of SCL.
+  if (level) {
+    if (I2C_BIT < 8 && I2C_STATE != I2c_Read) {
+      I2C_BYTE = I2C_BYTE << 1 | SDA;
+    } else if (I2C_BIT == 8 && I2C_STATE == I2c_Read) {
+      I2C_ACKED = !SDA;
+    }
+    I2C_BIT++;
+    return;
+  }
+
+  // And driven after the falling edge - ignoring that of the start condition.
+  if (I2C_BIT == 0) {
+    return;
+  }
+  if (I2C_BIT < 8) {
+    if (I2C_STATE == I2c_Read) {
+      sda_drive(((I2C_BYTE << I2C_BIT) & 0x80) == 0);
+    }
+    return;
+  }
+
+  if (I2C_BIT == 8) {
+    // The byte is complete - acknowledge it, or release SDA for the master
+    // to acknowledge a byte read.
+    switch (I2C_STATE) {
+    case I2c_Address:
+      if ((I2C_BYTE >> 1) != RTC_ADDRESS) {
+        I2C_STATE = I2c_Ignore;
+        return;
+      }
+      I2C_STATE = (I2C_BYTE & 1) ? I2c_Read : I2c_Write;
+      I2C_POINTED = false;
+      I2C_ACKED = true;
+      sda_drive(true);
+      break;
+    case I2c_Write:
+      if (!I2C_POINTED) {
+        I2C_POINTER = I2C_BYTE % RTC_REG_COUNT;
+        I2C_POINTED = true;
+      } else {
+        rtc_write(I2C_BYTE);
+      }
+      sda_drive(true);
+      break;
+    case I2c_Read:
+      sda_drive(false);
+      break;
+    }
+    return;
+  }
+
+  // The acknowledge is complete - send the next byte of a read the master
+  // acknowledged, or release SDA for the next byte written.
+  I2C_BIT = 0;
+  I2C_BYTE = 0;
+  sda_drive(false);
+  if (I2C_STATE == I2c_Read) {
+    if (!I2C_ACKED) {
+      I2C_STATE = I2c_Ignore;
+      return;
+    }
+    I2C_BYTE = RTC_REGS[I2C_POINTER];
+    I2C_POINTER = (I2C_POINTER + 1) % RTC_REG_COUNT;
+    sda_drive((I2C_BYTE & 0x80) == 0);
+  }
+}
+
+static void on_input(uint8_t pin, uint8_t drive) {
+  BUTTON_PRESSED = drive == Hal_Low;
+  drive_button_line();
+}
+
+#endif /* RTC */
+
+/// The supply voltage at cycle, falling linearly over the scenario if it sags.
+static double supply_mv_at(uint64_t cycle) {
+  const struct scenario *s = SCENARIO_RUNNING;
+  double mv = SUPPLY_MV;
+  if (s->supply_end_mv != 0) {
+    mv += ((double)s->supply_end_mv - SUPPLY_MV) * cycle /
+          ((double)s->duration_us * (F_CPU / 1000000));
+  }
+  return mv;
+}
+
+static uint16_t analog_mv(uint8_t input) {
+  double mv = supply_mv_at(hal_cycles());
+
+  // In a SUPPLY_SENSE build, the supply is also divided down onto ADC1.
+  return input == HAL_ANALOG_VCC ? mv : input == 1 ? mv / SUPPLY_SENSE_DIV : 0;
+}
+
+/// Estimate the charge drawn by the MCU while awake (active or idle), in
+/// microcoulombs.
+static double awake_charge_uc(const struct hal_stats *s) {
+  return (s->active_cycles * CURRENT_ACTIVE_UA +
+          s->idle_cycles * CURRENT_IDLE_UA) /
+             F_CPU +
+         (s->active_clocks * CURRENT_ACTIVE_UA_PER_MHZ +
+          s->idle_clocks * CURRENT_IDLE_UA_PER_MHZ) /
+             1000000;
+}
+
+/// @brief Add the cycle accounting of b to a.
+static void stats_add(struct hal_stats *a, const struct hal_stats *b) {
+  a->wakeups += b->wakeups;
+  a->active_cycles += b->active_cycles;
+  a->idle_cycles += b->idle_cycles;
+  a->pwr_down_cycles += b->pwr_down_cycles;
+  a->active_clocks += b->active_clocks;
+  a->idle_clocks += b->idle_clocks;
+  a->bod_cycles += b->bod_cycles;
+  a->wdt_cycles += b->wdt_cycles;
+  a->eeprom_bytes_written += b->eeprom_bytes_written;
+  for (uint8_t i = 0; i < 8; i++) {
+    a->pin_high_cycles[i] += b->pin_high_cycles[i];
+  }
+}
+
+static void print_result(enum hal_done why) {
+  struct hal_stats total = *hal_stats();
+  stats_add(&total, &OUTAGE_STATS);
+  const struct hal_stats *s = &total;
+  const struct settings *settings = settings_get();
+  static const char *const DONE[] = {"", " (halted)", " (reset)"};
+
+  printf("== %s%s\n", SCENARIO_RUNNING->name, DONE[why]);
+  for (uint8_t i = 0; i < CHANNEL_COUNT; i++) {
+    struct pump_runs *r = &RUNS[i];
+    if (r->level) {
+      r->high_cycles += hal_cycles() - r->last_high;
+      r->last_low = hal_cycles();
+    }
+    if (r->start != 0) {
+      run_ended(r);
+    }
+    printf("  pump %u runs            %12llu, on %.3fs", i + 1,
+           (unsigned long long)r->count, (double)r->high_cycles / F_CPU);
+    if (r->flashes > 0) {
+      printf(", %llu skip flashes", (unsigned long long)r->flashes);
+    }
+    if (r->count > 0) {
+      printf(", last %.3fs", (double)r->last_length / F_CPU);
+    }
+    if (r->count > 1) {
+      printf(", every %.4fh",
+             (double)(r->last_start - r->first_start) / (r->count - 1) /
+                 F_CPU / 3600);
+    }
+    printf("\n");
+  }
+#ifdef RTC
+  if (RUNS[0].count > 0) {
+    uint64_t t = rtc_seconds(RUNS[0].first_start) % (24 * 60 * 60);
+    printf("  first run (RTC)            %02u:%02u:%02u\n",
+           (unsigned)(t / 3600), (unsigned)(t / 60 % 60), (unsigned)(t % 60));
+  }
+#endif
+  printf("  pump duration (ms)     %12lu",
+         (unsigned long)settings->pumps[0].on_duration_ms);
+  for (uint8_t i = 1; i < CHANNEL_COUNT; i++) {
+    printf(" / %lu", (unsigned long)settings->pumps[i].on_duration_ms);
+  }
+  printf("\n");
+  printf("  wake-ups               %12llu\n", (unsigned long long)s->wakeups);
+  printf("  active cycles          %12llu\n",
+         (unsigned long long)s->active_cycles);
+  printf("  idle cycles            %12llu\n",
+         (unsigned long long)s->idle_cycles);
+  printf("  power-down cycles      %12llu\n",
+         (unsigned long long)s->pwr_down_cycles);
+  printf("  awake charge / wake-up (nC) %7.1f\n",
+         s->wakeups ? awake_charge_uc(s) * 1000 / s->wakeups : 0.0);
+  printf("  MCU charge (uAh)       %12.1f\n",
+         (awake_charge_uc(s) +
+          ((double)s->pwr_down_cycles * CURRENT_PWR_DOWN_UA +
+           (double)s->wdt_cycles * CURRENT_WDT_UA +
+           (double)s->bod_cycles * CURRENT_BOD_UA) /
+              F_CPU) /
+             3600);
+  printf("  EEPROM bytes written   %12llu\n\n",
+         (unsigned long long)s->eeprom_bytes_written);
+  fflush(stdout);
+}
+
+/// @brief Print a failed check of the scenario's outcome, returning false.
+static bool fail(const char *format, ...) {
+  va_list args;
+  va_start(args, format);
+  printf("  FAIL: ");
+  vprintf(format, args);
+  printf("\n");
+  va_end(args);
+  return false;
+}
+
+/// @brief Return true if the overflow probe of channel is wired - a debug
+/// output (or the supply sense) takes over its pin in some builds.
+static bool probe_wired(uint8_t channel) {
+#if defined(RTC) || defined(CHANNEL_EXPANDER)
+  return true;
+#else
+  bool taken = false;
+#ifdef TELEMETRY
+  taken |= PROBE(channel) == OVERFLOW_SIGNAL_PIN_1;
+#endif
+#ifdef PROFILE_PIN
+  taken |= PROBE(channel) == PROFILE_PIN;
+#endif
+  return !taken;
+#endif
+}
+
+/// @brief Return the number of routines due in the scenario for pump, on its
+/// interval from the start.
+static uint64_t routines_due(uint8_t pump) {
+  uint32_t interval = settings_get()->pumps[pump].interval_seconds;
+  return SCENARIO_RUNNING->duration_us / SECS(interval);
+}
+
+/// @brief Return the length of run i of r in milliseconds.
+static double run_ms(const struct pump_runs *r, uint64_t i) {
+  return (double)r->lengths[i] * 1000 / F_CPU;
+}
+
+/// @brief Return true if run i of r was cut off by the end of the scenario.
+static bool run_cut_off(const struct pump_runs *r, uint64_t i) {
+  return r->level && i == r->count - 1;
+}
+
+/// @brief Copy the records written to the history ring to out, newest first,
+/// returning how many.
+static uint8_t history_newest_first(struct history_record *out) {
+  // The ring is zero-filled until written, and never erased by the firmware.
+  uint8_t newest = HISTORY_RECORD_COUNT;
+  for (uint8_t i = 0; i < HISTORY_RECORD_COUNT; i++) {
+    if (HISTORY_RECORDS[i].cycle != 0 &&
+        (newest == HISTORY_RECORD_COUNT ||
+         (int8_t)(HISTORY_RECORDS[i].seq - HISTORY_RECORDS[newest].seq) > 0)) {
+      newest = i;
+    }
+  }
+
+  uint8_t n = 0;
+  for (uint8_t k = 0; newest < HISTORY_RECORD_COUNT && k < HISTORY_RECORD_COUNT;
+       k++) {
+    const struct history_record *h =
+        &HISTORY_RECORDS[(newest + HISTORY_RECORD_COUNT - k) %
+                         HISTORY_RECORD_COUNT];
+    if (h->cycle != 0) {
+      out[n++] = *h;
+    }
+  }
+  return n;
+}
+
+/// @brief Return the pump index of a history record.
+static uint8_t record_pump(const struct history_record *h) {
+  return ((h->flags & HISTORY_PUMP_2) ? 1 : 0) |
+         ((h->flags & HISTORY_PUMP_3) ? 2 : 0);
+}
+
+/// @brief Return true if a record in the history ring is of pump with all the
+/// flags set.
+static bool history_has(uint8_t pump, uint8_t flags) {
+  struct history_record records[HISTORY_RECORD_COUNT];
+  uint8_t n = history_newest_first(records);
+  for (uint8_t i = 0; i < n; i++) {
+    if (record_pump(&records[i]) == pump &&
+        (records[i].flags & flags) == flags) {
+      return true;
+    }
+  }
+  return false;
+}
+
+/// @brief Return the longest WDT interval (in ms) no longer than duration_ms -
+/// the longest a run of that duration may be part way through.
+static uint32_t wdt_interval_within(uint32_t duration_ms) {
+  uint32_t ms = 16;
+  while (ms < 8192 && ms * 2 <= duration_ms) {
+    ms *= 2;
+  }
+  return ms;
+}
+
+/// @brief Check the on-time of each run of pump in the history ring against
+/// the run observed on its output, pairing them newest first.
+static bool check_history_runs(uint8_t pump) {
+  const struct pump_settings *pump_settings = &settings_get()->pumps[pump];
+  const struct pump_runs *r = &RUNS[pump];
+  struct history_record records[HISTORY_RECORD_COUNT];
+  uint8_t n = history_newest_first(records);
+
+  // A run cut off by the end of the scenario is not yet recorded.
+  uint64_t run = r->level ? 1 : 0;
+  for (uint8_t i = 0; i < n && run < r->count; i++) {
+    const struct history_record *h = &records[i];
+    if (record_pump(h) != pump || (h->flags & HISTORY_OVERFLOW_SKIPPED)) {
+      continue;
+    }
+
+    uint64_t index = r->count - 1 - run;
+    if (index >= RUN_LOG_SIZE) {
+      return fail("pump %u ran too often to check", pump + 1);
+    }
+    double observed_ms = run_ms(r, index);
+    double recorded_ms = h->on_time_ds * 100.0;
+    double tolerance_ms = HISTORY_TOLERANCE_MS;
+    if ((h->flags & HISTORY_OVERFLOW_STOPPED) && !pump_settings->adaptive) {
+      tolerance_ms = wdt_interval_within(pump_settings->on_duration_ms) / 2;
+    }
+    if (recorded_ms < observed_ms - HISTORY_TRUNCATE_MS - tolerance_ms ||
+        recorded_ms > observed_ms + tolerance_ms) {
+      return fail("pump %u run of %.3fs recorded as %.1fs", pump + 1,
+                  observed_ms / 1000, recorded_ms / 1000);
+    }
+    run++;
+  }
+  return true;
+}
+
+/// @brief Check every record in the history ring is of a pump, numbered by
+/// cycle in order, and matches the run observed.
+static bool check_history() {
+  struct history_record records[HISTORY_RECORD_COUNT];
+  uint8_t n = history_newest_first(records);
+
+  for (uint8_t i = 0; i < n; i++) {
+    if (record_pump(&records[i]) >= CHANNEL_COUNT) {
+      return fail("history record of pump %u", record_pump(&records[i]) + 1);
+    }
+    if (i > 0 && records[i].cycle > records[i - 1].cycle) {
+      return fail("history cycle %u recorded after %u", records[i - 1].cycle,
+                  records[i].cycle);
+    }
+  }
+
+  bool ok = true;
+  for (uint8_t i = 0; i < CHANNEL_COUNT; i++) {
+    ok &= check_history_runs(i);
+  }
+  return ok;
+}
+
+/// @brief Check pump ran each of its scheduled routines, on its interval,
+/// after the first manual runs (started by the button, or re-run after an
+/// outage) - and that each of its runs from the first skip onwards lasted its
+/// duration, scaled for the supply.
+static bool check_pump(uint8_t pump, uint64_t manual, uint64_t skip) {
+  const struct settings *settings = settings_get();
+  const struct pump_runs *r = &RUNS[pump];
+  uint32_t interval = settings->pumps[pump].interval_seconds;
+
+  uint64_t due = routines_due(pump);
+  if (r->count < manual || r->count - manual > due ||
+      r->count - manual + 1 < due) {
+    return fail("pump %u ran %llu times, expected %llu manual and %llu "
+                "scheduled",
+                pump + 1, (unsigned long long)r->count,
+                (unsigned long long)manual, (unsigned long long)due);
+  }
+  if (r->count > RUN_LOG_SIZE) {
+    return fail("pump %u ran too often to check", pump + 1);
+  }
+
+  double tolerance_s = interval * (INTERVAL_TOLERANCE_PPM / 1e6);
+  for (uint64_t i = manual + 1; i < r->count; i++) {
+    double gap_s = (double)(r->starts[i] - r->starts[i - 1]) / F_CPU;
+    if (gap_s < interval - tolerance_s || gap_s > interval + tolerance_s) {
+      return fail("pump %u runs %.1fs apart, expected %lus", pump + 1, gap_s,
+                  (unsigned long)interval);
+    }
+  }
+
+  for (uint64_t i = skip; i < r->count; i++) {
+    if (run_cut_off(r, i)) {
+      continue;
+    }
+    double expected_ms =
+        supply_scale_ms(settings->pumps[pump].on_duration_ms,
+                        settings->supply_ref_mv, supply_mv_at(r->starts[i]));
+    double tolerance_ms =
+        RUN_TOLERANCE_MS + expected_ms * RUN_TOLERANCE_PCT / 100;
+    double ms = run_ms(r, i);
+    if (ms < expected_ms - tolerance_ms || ms > expected_ms + tolerance_ms) {
+      return fail("pump %u run %llu lasted %.3fs, expected %.3fs", pump + 1,
+                  (unsigned long long)i + 1, ms / 1000, expected_ms / 1000);
+    }
+  }
+  return true;
+}
+
+/// @brief Check each pump's (trained) duration is within
+/// TRAINED_TOLERANCE_MS of duration_ms.
+static bool check_duration(uint32_t duration_ms) {
+  for (uint8_t i = 0; i < CHANNEL_COUNT; i++) {
+    uint32_t ms = settings_get()->pumps[i].on_duration_ms;
+    if (ms + TRAINED_TOLERANCE_MS < duration_ms ||
+        ms > duration_ms + TRAINED_TOLERANCE_MS) {
+      return fail("pump %u duration %lums, expected %lums", i + 1,
+                  (unsigned long)ms, (unsigned long)duration_ms);
+    }
+  }
+  return true;
+}
+
+/// @brief Check a record in the history ring carries the reset cause (MCUSR
+/// bits).
+static bool check_reset_cause(uint8_t cause) {
+  for (uint8_t i = 0; i < CHANNEL_COUNT; i++) {
+    if (history_has(i, cause << HISTORY_RESET_CAUSE_SHIFT)) {
+      return true;
+    }
+  }
+  return fail("no history record of reset cause 0x%02x", cause);
+}
+
+/// Only scheduled routines, at the default duration.
+static bool check_scheduled(void) {
+  bool ok = check_history() && check_duration(5000);
+  for (uint8_t i = 0; i < CHANNEL_COUNT; i++) {
+    ok &= check_pump(i, 0, 0);
+  }
+  return ok;
+}
+
+/// @brief Check a hold of the button trained every pump to duration_ms,
+/// running pump 1 once the hold is recognised - then the scheduled routines.
+static bool check_trained(uint32_t duration_ms) {
+  bool ok = check_history() && check_duration(duration_ms);
+  for (uint8_t i = 0; i < CHANNEL_COUNT; i++) {
+    ok &= check_pump(i, i == 0 ? 1 : 0, i == 0 ? 1 : 0);
+  }
+  return ok;
+}
+
+/// A 5 second hold of the button.
+static bool check_training(void) { return check_trained(5000); }
+
+/// A 20 minute hold of the button.
+static bool check_long_training(void) { return check_trained(20 * 60 * 1000); }
+
+/// A test run of every pump.
+static bool check_test_tap(void) {
+  bool ok = check_history() && check_duration(5000);
+  for (uint8_t i = 0; i < CHANNEL_COUNT; i++) {
+    ok &= check_pump(i, 1, 0);
+  }
+  return ok;
+}
+
+/// The test run of pump 1 is stopped by its saucer overflowing.
+static bool check_overflow_midrun(void) {
+  bool ok = check_history() && check_duration(5000);
+  if (probe_wired(0) && !history_has(0, HISTORY_OVERFLOW_STOPPED)) {
+    ok = fail("no record of pump 1 stopped by the overflow");
+  }
+  for (uint8_t i = 0; i < CHANNEL_COUNT; i++) {
+    ok &= check_pump(i, 1, i == 0 && probe_wired(0) ? 1 : 0);
+  }
+  return ok;
+}
+
+/// Every pump with a probe is skipped, flashing its LED at each routine.
+static bool check_wet_saucer(void) {
+  bool ok = check_history() && check_duration(5000);
+  for (uint8_t i = 0; i < CHANNEL_COUNT; i++) {
+    if (!probe_wired(i)) {
+      ok &= check_pump(i, 0, 0);
+      continue;
+    }
+    if (RUNS[i].count != 0 || RUNS[i].flashes + 1 < routines_due(i)) {
+      ok = fail("pump %u ran %llu times and flashed %llu, expected only "
+                "flashes",
+                i + 1, (unsigned long long)RUNS[i].count,
+                (unsigned long long)RUNS[i].flashes);
+    }
+    if (!history_has(i, HISTORY_OVERFLOW_SKIPPED)) {
+      ok = fail("no record of pump %u skipped", i + 1);
+    }
+  }
+  return ok;
+}
+
+/// Pump 1's test run is cut off by the outage, and the whole routine run
+/// again after it.
+static bool check_power_cut(void) {
+  bool ok = check_history() && check_duration(5000) &&
+            check_reset_cause(1 << PORF);
+  for (uint8_t i = 0; i < CHANNEL_COUNT; i++) {
+    ok &= check_pump(i, i == 0 ? 2 : 1, i == 0 ? 1 : 0);
+  }
+  return ok;
+}
+
+#ifndef RTC
+
+/// Pump 1's test run is cut off by the halt, which turns off every pump.
+static bool check_halted(void) {
+  bool ok = true;
+  if (RUNS[0].count != 1) {
+    ok = fail("pump 1 ran %llu times before the halt, expected once",
+              (unsigned long long)RUNS[0].count);
+  }
+  for (uint8_t i = 0; i < CHANNEL_COUNT; i++) {
+    if (RUNS[i].level) {
+      ok = fail("pump %u left running by the halt", i + 1);
+    }
+  }
+  return ok;
+}
+
+#endif /* RTC */
+
+/// Pump 1's test run is cut off by the brown-out, and the routine dropped.
+static bool check_brownout(void) {
+  bool ok = check_history() && check_duration(5000) &&
+            check_reset_cause(1 << BORF);
+  for (uint8_t i = 0; i < CHANNEL_COUNT; i++) {
+    ok &= check_pump(i, i == 0 ? 1 : 0, i == 0 ? 1 : 0);
+  }
+  return ok;
+}
+
+#ifdef RTC
+
+/// Each run starts within this many seconds of the time of day configured.
+#define WATER_AT_TOLERANCE_S 2
+
+/// The scheduled routines, held to the configured time of day by the RTC.
+static bool check_rtc_week(void) {
+  bool ok = check_scheduled();
+  uint32_t water_at = (uint32_t)settings_get()->water_at_min * 60;
+  for (uint64_t i = 0; i < RUNS[0].count && i < RUN_LOG_SIZE; i++) {
+    uint64_t t = rtc_seconds(RUNS[0].starts[i]) % (24 * 60 * 60);
+    if (t + WATER_AT_TOLERANCE_S < water_at ||
+        t > water_at + WATER_AT_TOLERANCE_S) {
+      ok = fail("run %llu at %02u:%02u:%02u", (unsigned long long)i + 1,
+                (unsigned)(t / 3600), (unsigned)(t / 60 % 60),
+                (unsigned)(t % 60));
+    }
+  }
+  return ok;
+}
+
+#endif /* RTC */
+
+/// @brief Write n bytes from p to fd, returning false on failure.
+static bool write_all(int fd, const void *p, size_t n) {
+  while (n > 0) {
+    ssize_t w = write(fd, p, n);
+    if (w <= 0) {
+      return false;
+    }
+    p = (const uint8_t *)p + w;
+    n -= w;
+  }
+  return true;
+}
+
+/// @brief Read n bytes from fd into p, returning false on failure.
+static bool read_all(int fd, void *p, size_t n) {
+  while (n > 0) {
+    ssize_t r = read(fd, p, n);
+    if (r <= 0) {
+      return false;
+    }
+    p = (uint8_t *)p + r;
+    n -= r;
+  }
+  return true;
+}
+
+/// @brief Cut the power at the end of the run up to an outage, handing the
+/// pump runs, cycle accounting & EEPROM contents to the run after it.
+static bool power_cut() {
+  // Every output drops with the supply.
+  for (uint8_t i = 0; i < CHANNEL_COUNT; i++) {
+    on_pump(i, false, hal_cycles());
+  }
+
+  return write_all(OUTAGE_PIPE, RUNS, sizeof(RUNS)) &&
+         write_all(OUTAGE_PIPE, hal_stats(), sizeof(struct hal_stats)) &&
+         write_all(OUTAGE_PIPE, hal_eeprom(), hal_eeprom_size());
+}
+
+static void on_done(enum hal_done why) {
+  if (OUTAGE_PIPE >= 0 && why == Hal_DoneTime) {
+    _exit(power_cut() ? 0 : 1);
+  }
+  print_result(why);
+
+  bool ok = why == (SCENARIO_RUNNING->halt_at_us != 0 ? Hal_DoneHalted
+                                                      : Hal_DoneTime);
+  if (ok && SCENARIO_RUNNING->check != NULL) {
+    ok = SCENARIO_RUNNING->check();
+    fflush(stdout);
+  }
+  _exit(ok ? 0 : 1);
+}
+
+/// @brief Run s in a child process from start_us to end_us, returning true if
+/// it ran to completion.
+///
+/// If fd_in is valid, the state left by the run up to a power outage is read
+/// from it first - and if fd_out is valid, the run ends in a power outage,
+/// writing its state to it.
+static bool run_child(const struct scenario *s, uint64_t start_us,
+                      uint64_t end_us, int fd_in, int fd_out) {
+  fflush(stdout);
+  pid_t pid = fork();
+  if (pid < 0) {
+    perror("fork");
+    return false;
+  }
+
+  if (pid == 0) {
+    SCENARIO_RUNNING = s;
+    OUTAGE_PIPE = fd_out;
+    if (fd_in >= 0 &&
+        !(read_all(fd_in, RUNS, sizeof(RUNS)) &&
+          read_all(fd_in, &OUTAGE_STATS, sizeof(OUTAGE_STATS)) &&
+          read_all(fd_in, hal_eeprom(), hal_eeprom_size()))) {
+      _exit(1);
+    }
+
+    struct hal_config config = {
+        .duration_us = end_us,
+        .start_us = start_us,
+        .reset_cause = start_us != 0 ? s->outage_cause : 0,
+        .inputs = s->inputs,
+        .n_inputs = s->n_inputs,
+        .wdt_error_ppm = s->wdt_error_ppm,
+        .on_output = on_output,
+#if defined(CHANNEL_EXPANDER) || defined(RTC)
+        .on_input = on_input,
+#endif
+#ifdef RTC
+        .pull_ups = (1 << RTC_SDA_PIN) | (1 << RTC_SCL_PIN),
+        .on_line = on_line,
+#endif
+        .on_timer = on_timer,
+        .analog_mv = analog_mv,
+        .on_done = on_done,
+    };
+    hal_start(&config);
+    if (s->halt_at_us != 0) {
+      hal_timer_at(s->halt_at_us * (F_CPU / 1000000));
+    }
+    firmware_main();
+    _exit(1);
+  }
+
+  int status;
+  if (waitpid(pid, &status, 0) < 0) {
+    perror("waitpid");
+    return false;
+  }
+  return WIFEXITED(status) && WEXITSTATUS(status) == 0;
+}
+
+/// Run s, returning true if it ran to completion.
+static bool run_scenario(const struct scenario *s) {
+  if (s->outage_at_us == 0) {
+    return run_child(s, 0, s->duration_us, -1, -1);
+  }
+
+  // The state handed over fits in the pipe buffer, so the first run can exit
+  // before the second starts reading.
+  int fds[2];
+  if (pipe(fds) < 0) {
+    perror("pipe");
+    return false;
+  }
+
+  bool ok = run_child(s, 0, s->outage_at_us, -1, fds[1]);
+  close(fds[1]);
+  ok = ok && run_child(s, s->outage_at_us + s->outage_us, s->duration_us,
+                       fds[0], -1);
+  close(fds[0]);
+  return ok;
+}
+
+int main(int argc, char **argv) {
+  if (argc > 2) {
+    fprintf(stderr, "usage: %s [scenario]\n", argv[0]);
+    return 1;
+  }
+
+  bool matched = false;
+  bool ok = true;
+  for (size_t i = 0; i < sizeof(SCENARIOS) / sizeof(SCENARIOS[0]); i++) {
+    if (argc > 1 && strcmp(argv[1], SCENARIOS[i].name) != 0) {
+      continue;
+    }
+    matched = true;
+
+    if (!run_scenario(&SCENARIOS[i])) {
+      fprintf(stderr, "scenario %s failed\n", SCENARIOS[i].name);
+      ok = false;
+    }
+  }
+
+  if (!matched) {
+    fprintf(stderr, "unknown scenario %s\n", argv[1]);
+    return 1;
+  }
+
+  return ok ? 0 : 1;
+}
@@ -0,0 +1,31 @@
+#include "led.h"
+#include "channel.h"
+
+/// The steps of the pattern left to play on each channel, including the end
+/// marker.
+static uint8_t PATTERN[CHANNEL_COUNT];
+
+/// @brief Drive the output of channel to the level of the next step.
+static void drive(uint8_t channel) {
+  if (PATTERN[channel] & 1) {
+    channel_on(channel);
+  } else {
+    channel_off(channel);
+  }
+  PATTERN[channel] >>= 1;
+}
+
+void led_start(uint8_t channel, uint8_t pattern) {
+  PATTERN[channel] = pattern;
+  drive(channel);
+}
+
+bool led_step(uint8_t channel) {
+  if (PATTERN[channel] <= 1) {
+    channel_off(channel);
+    return false;
+  }
+
+  drive(channel);
+  return true;
+}
@@ -0,0 +1,29 @@
+#ifndef LED_H
+#define LED_H
+
+#include <avr/io.h>
+#include <stdbool.h>
+
+/// Patterns flashed on the LED of a pump output, each step lasting
+/// LED_STEP_MS.
+///
+/// The level of each step is a bit of the pattern, played from the LSB up to
+/// (but excluding) the highest set bit, which marks the end.
+///
+/// Steps are timed by the WDT, so last a whole number of its 16ms periods (96ms
+/// for 100ms).
+#define LED_STEP_MS 100
+
+#define LED_PATTERN_SKIPPED 0x55 // Three flashes - the saucer was wet
+
+/// Start playing pattern on the pump output of channel, driving its first
+/// step.
+///
+/// The caller wakes after each LED_STEP_MS to call led_step().
+extern void led_start(uint8_t channel, uint8_t pattern);
+
+/// Drive the next step of the pattern playing on channel, returning false
+/// (with the output low) once the pattern has finished.
+extern bool led_step(uint8_t channel);
+
+#endif /* LED_H */
@@ -12,18 +12,56 @@
 // License for the specific language governing permissions and limitations under
 // the License.
 
+#include "channel.h"
 #include "event.h"
 #include "event_handler/button.h"
 #include "event_handler/watchdog.h"
 #include "halt.h"
+#include "history.h"
 #include "pins.h"
+#include "power.h"
+#include "profile.h"
+#include "settings.h"
+#include "telemetry.h"
 #include "wdt.h"
 #include <avr/interrupt.h>
 #include <avr/io.h>
-#include <avr/power.h>
 
 // Pin change interrupt service routine.
-ISR(PCINT0_vect) { event_flag_set(EVENT_STATE_BUTTON); }
+//
+// The overflow pins only raise pin change interrupts while their pump is
+// running (see handle_event_overflow()) - a monitored pin reading low is an
+// overflow, and a change of the button pin is the button. Changes of the
+// button pin are timestamped while it is being debounced.
+ISR(PCINT0_vect) {
+  PROFILE_BEGIN(profile);
+
+#ifdef RTC
+  // While the WDT is suspended, the change is handed to wdt_resume() - woken
+  // by the RTC alarm, or the button sharing its line.
+  if (wdt_suspended()) {
+    event_flag_set(EVENT_STATE_RTC_WAKE);
+    PROFILE_END(Profile_IsrPcint0, profile);
+    return;
+  }
+#endif
+
+  // A probe changing (wetting, or drying out) never restarts the debounce.
+  bool button = button_edge();
+
+  uint8_t monitored = PCMSK & OVERFLOW_SIGNAL_PINS;
+  if ((PINB & monitored) != monitored) {
+    event_flag_set(EVENT_STATE_OVERFLOW);
+  }
+
+  // The button changed - or is held, never missing a press whose edge
+  // coincided with an overflow.
+  if (button || ((PCMSK & (1 << BUTTON_PIN)) && !IS_HIGH(BUTTON_PIN))) {
+    event_flag_set(EVENT_STATE_BUTTON);
+  }
+
+  PROFILE_END(Profile_IsrPcint0, profile);
+}
 
 // Watchdog interrupt service routine.
 //
@@ -31,21 +69,43 @@ ISR(PCINT0_vect) { event_flag_set(EVENT_STATE_BUTTON); }
 ISR(WDT_vect) { wdt_tick(); }
 
 int main(void) {
-  // Disable all the peripherals (ADC, ACA, BOD, etc) to minimise current draw.
-  power_all_disable();
+  // Capture (and clear) the cause of this reset for the watering history.
+  uint8_t reset_cause = MCUSR;
+  MCUSR = 0;
 
-  // Set all the pins to output.
-  DDRB = 0xFF;
+  // Power down all the peripherals & unused inputs to minimise current draw.
+  power_init();
+
+  // Start the profiling clock, if built with it.
+  profile_init();
+
+  // Load the newest persisted settings into SRAM.
+  settings_init();
+
+  // Find the end of the watering history, ready to append to it.
+  history_init(reset_cause);
+
+  // Read the RTC timing the long sleeps, if built with it - ahead of the
+  // button, whose pin change interrupt is shared with the alarm line.
+  wdt_rtc_init();
 
   // Configure the button pin & change interrupts.
   init_event_button();
 
-  // Configure the water overflow sensor pin.
-  init_overflow_sensor();
+  // Configure the pump outputs & water overflow sensor pins.
+  channel_init();
+
+  // Take over the USI data output pin for telemetry, if built with it.
+  telemetry_init();
+
+  // Measure the WDT oscillator against the system clock so countdowns are
+  // corrected for its drift.
+  wdt_calibrate();
 
-  // Start the watchdog timer to trigger an interrupt every WDT_INTERVAL
-  // duration of time.
-  wdt_sleep_seconds(PUMP_INTERVAL_SECONDS);
+  // Start the watchdog timer to trigger the next watering routine of each
+  // pump, resuming the schedule checkpointed before the reset (and finishing
+  // or skipping any routine it interrupted, depending on its cause).
+  watering_resume(reset_cause);
 
   // And drive the event loop.
   run_event_loop();
@@ -1,10 +1,118 @@
 #ifndef PIN_DEF_H
 #define PIN_DEF_H
 
+#include "channel.h"
 #include <avr/io.h>
 
 /// Pins in PORTB.
+#ifdef RTC
+/// The USI two-wire bus takes PB0 - the button moves to the pin of the second
+/// pump, shared with the (active low, open drain) alarm output of the RTC, the
+/// pin pull-up serving both.
+#define BUTTON_PIN PINB4
+#else
 #define BUTTON_PIN PINB0
+#endif
+
+/// The const BUTTON_PIN is reused in the place of these values - they must be
+/// equal. Change these as necessary when changing BUTTON_PIN.
+#ifdef RTC
+_Static_assert(DDB4 == BUTTON_PIN);
+_Static_assert(PORTB4 == BUTTON_PIN);
+_Static_assert(PCINT4 == BUTTON_PIN);
+#else
+_Static_assert(DDB0 == BUTTON_PIN);
+_Static_assert(PORTB0 == BUTTON_PIN);
+_Static_assert(PCINT0 == BUTTON_PIN);
+#endif
+
+#if defined(RTC)
+
+/// The DS3231 on the USI two-wire bus, pulled up on the board (see rtc.h).
+#define RTC_SDA_PIN PINB0
+#define RTC_SCL_PIN PINB2
+
+#define PUMP_PIN_1 PINB3
+#define OVERFLOW_SIGNAL_PIN_1 PINB1
+
+/// The pins read by the overflow probes.
+#define OVERFLOW_SIGNAL_PINS (1 << OVERFLOW_SIGNAL_PIN_1)
+
+/// The USI data & clock lines are fixed in hardware.
+_Static_assert(RTC_SDA_PIN == PB0);
+_Static_assert(RTC_SCL_PIN == PB2);
+
+/// As above, but for the overflow pin.
+_Static_assert(DDB1 == OVERFLOW_SIGNAL_PIN_1);
+_Static_assert(PORTB1 == OVERFLOW_SIGNAL_PIN_1);
+
+/// All pins differ.
+_Static_assert(PUMP_PIN_1 != BUTTON_PIN);
+_Static_assert(PUMP_PIN_1 != OVERFLOW_SIGNAL_PIN_1);
+_Static_assert(PUMP_PIN_1 != RTC_SDA_PIN);
+_Static_assert(PUMP_PIN_1 != RTC_SCL_PIN);
+_Static_assert(BUTTON_PIN != OVERFLOW_SIGNAL_PIN_1);
+_Static_assert(BUTTON_PIN != RTC_SDA_PIN);
+_Static_assert(BUTTON_PIN != RTC_SCL_PIN);
+_Static_assert(OVERFLOW_SIGNAL_PIN_1 != RTC_SDA_PIN);
+_Static_assert(OVERFLOW_SIGNAL_PIN_1 != RTC_SCL_PIN);
+
+/// The bus & alarm take the pins of the second channel, and the USI.
+#if CHANNEL_COUNT != 1
+#error "RTC builds drive a single channel (CHANNELS=1)"
+#endif
+#ifdef TELEMETRY
+#error "TELEMETRY needs the USI, which drives the RTC bus"
+#endif
+#ifdef PROFILE_PIN
+#error "PROFILE_PIN has no free pin with the RTC"
+#endif
+#ifdef SUPPLY_SENSE
+#error "SUPPLY_SENSE has no free pin with the RTC"
+#endif
+
+#elif defined(CHANNEL_EXPANDER)
+
+/// The 74HC595 shift register, clocked by the USI in three-wire mode - its
+/// output enable tied low and its clear tied high.
+#define EXPANDER_DATA_PIN PINB1  // USI DO, to SER
+#define EXPANDER_CLOCK_PIN PINB2 // USI USCK, to SRCLK
+#define EXPANDER_LATCH_PIN PINB3 // To RCLK
+
+/// The common wire of all the overflow probes. The other wire of each probe
+/// returns to its (active low) select output on the shift register through a
+/// diode (cathode at the register), so deselected probes never pull the line
+/// either way.
+#define OVERFLOW_SENSE_PIN PINB4
+
+/// The pins read by the overflow probes.
+#define OVERFLOW_SIGNAL_PINS (1 << OVERFLOW_SENSE_PIN)
+
+/// The USI data output & clock are fixed in hardware.
+_Static_assert(EXPANDER_DATA_PIN == PB1);
+_Static_assert(EXPANDER_CLOCK_PIN == PB2);
+
+/// All pins differ.
+_Static_assert(EXPANDER_LATCH_PIN != BUTTON_PIN);
+_Static_assert(EXPANDER_LATCH_PIN != EXPANDER_DATA_PIN);
+_Static_assert(EXPANDER_LATCH_PIN != EXPANDER_CLOCK_PIN);
+_Static_assert(OVERFLOW_SENSE_PIN != BUTTON_PIN);
+_Static_assert(OVERFLOW_SENSE_PIN != EXPANDER_DATA_PIN);
+_Static_assert(OVERFLOW_SENSE_PIN != EXPANDER_CLOCK_PIN);
+_Static_assert(OVERFLOW_SENSE_PIN != EXPANDER_LATCH_PIN);
+
+/// Every pin is taken, and the USI is driven by the expander.
+#ifdef TELEMETRY
+#error "TELEMETRY needs the USI, which drives the shift register"
+#endif
+#ifdef PROFILE_PIN
+#error "PROFILE_PIN has no free pin with the shift register"
+#endif
+#ifdef SUPPLY_SENSE
+#error "SUPPLY_SENSE has no free pin with the shift register"
+#endif
+
+#else
 
 #define PUMP_PIN_1 PINB3
 #define OVERFLOW_SIGNAL_PIN_1 PINB1
@@ -12,15 +120,15 @@
 #define PUMP_PIN_2 PINB4
 #define OVERFLOW_SIGNAL_PIN_2 PINB2
 
-/// The const BUTTON_PIN is reused in the place of these values - they must be
-/// equal. Change these as necessary when changing BUTTON_PIN.
-_Static_assert(DDB0 == BUTTON_PIN);
-_Static_assert(PORTB0 == BUTTON_PIN);
-_Static_assert(PCINT0 == BUTTON_PIN);
+/// The pins read by the overflow probes.
+#define OVERFLOW_SIGNAL_PINS                                                   \
+  ((1 << OVERFLOW_SIGNAL_PIN_1) | (1 << OVERFLOW_SIGNAL_PIN_2))
 
 /// As above, but for the overflow pin.
 _Static_assert(DDB1 == OVERFLOW_SIGNAL_PIN_1);
 _Static_assert(PORTB1 == OVERFLOW_SIGNAL_PIN_1);
+_Static_assert(DDB2 == OVERFLOW_SIGNAL_PIN_2);
+_Static_assert(PORTB2 == OVERFLOW_SIGNAL_PIN_2);
 
 /// All pins differ.
 _Static_assert(PUMP_PIN_1 != BUTTON_PIN);
@@ -34,6 +142,26 @@ _Static_assert(BUTTON_PIN != OVERFLOW_SIGNAL_PIN_1);
 _Static_assert(BUTTON_PIN != OVERFLOW_SIGNAL_PIN_2);
 _Static_assert(OVERFLOW_SIGNAL_PIN_1 != OVERFLOW_SIGNAL_PIN_2);
 
+#ifdef SUPPLY_SENSE
+/// The pump rail, through a divider, read by the ADC (ADC1) - on the overflow
+/// sensor pin of the second channel, left as an input without a pull-up by
+/// channel_init().
+#define SUPPLY_SENSE_PIN OVERFLOW_SIGNAL_PIN_2
+#define SUPPLY_SENSE_MUX (1 << MUX0)
+_Static_assert(SUPPLY_SENSE_PIN == PB2);
+
+/// The divider would silently stand in for the overflow sensor of pump 2.
+#if CHANNEL_COUNT != 1
+#error "SUPPLY_SENSE takes the overflow sensor pin of pump 2 (CHANNELS=1)"
+#endif
+
+#if defined(PROFILE_PIN) && PROFILE_PIN == SUPPLY_SENSE_PIN
+#error "PROFILE_PIN MUST differ from the SUPPLY_SENSE pin"
+#endif
+#endif
+
+#endif /* RTC, CHANNEL_EXPANDER */
+
 /// Helper macro returning true if pin is set high in PORTB.
 #define IS_HIGH(pin) (((PINB >> pin) & 1) > 0)
 
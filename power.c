@@ -0,0 +1,127 @@
+#include "power.h"
+#include "clock.h"
+#include <avr/interrupt.h>
+#include <avr/power.h>
+#include <avr/sleep.h>
+#include <stdbool.h>
+#include <util/atomic.h>
+
+/// Each bit of DIDR0 disables the digital input buffer of the PORTB pin of the
+/// same index.
+_Static_assert(AIN0D == PB0);
+_Static_assert(AIN1D == PB1);
+_Static_assert(ADC1D == PB2);
+_Static_assert(ADC3D == PB3);
+_Static_assert(ADC2D == PB4);
+_Static_assert(ADC0D == PB5);
+
+/// The users (POWER_* bits) currently holding a peripheral.
+static volatile uint16_t USERS = 0;
+
+void power_init() {
+  // Disable all the peripherals (ADC, timers & USI) to minimise current draw.
+  power_all_disable();
+
+  // The analog comparator is left running after reset - it is never used.
+  ACSR |= (1 << ACD);
+
+  // Drive all the pins low, with their input buffers disabled so nothing
+  // floats - the button & overflow sensor reclaim their pins.
+  DDRB = 0xFF;
+  DIDR0 = (1 << ADC0D) | (1 << ADC2D) | (1 << ADC3D) | (1 << ADC1D) |
+          (1 << AIN1D) | (1 << AIN0D);
+}
+
+/// @brief Power up or down each peripheral to match the users holding it.
+///
+/// MUST be called while interrupts are disabled.
+static void apply(uint16_t users) {
+  if (users & POWER_TIMER0_USERS) {
+    power_timer0_enable();
+  } else {
+    power_timer0_disable();
+  }
+
+  if (users & POWER_TIMER1_USERS) {
+    power_timer1_enable();
+  } else {
+    power_timer1_disable();
+  }
+
+  if (users & POWER_USI_USERS) {
+    power_usi_enable();
+  } else {
+    power_usi_disable();
+  }
+
+  if (users & POWER_ADC_USERS) {
+    power_adc_enable();
+  } else {
+    power_adc_disable();
+  }
+}
+
+void power_acquire(uint16_t user) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    USERS |= user;
+    apply(USERS);
+  }
+}
+
+void power_release(uint16_t user) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    USERS &= ~user;
+    apply(USERS);
+  }
+}
+
+uint16_t power_users() { return USERS; }
+
+void power_input_enable(uint8_t pin) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { DIDR0 &= ~(1 << pin); }
+}
+
+void power_input_disable(uint8_t pin) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { DIDR0 |= (1 << pin); }
+}
+
+void power_sleep() {
+  // While the button is being debounced, a pump is driven by PWM or telemetry
+  // is being sent, the timer driving it must keep running, which requires the
+  // idle sleep mode. This is evaluated with interrupts disabled, as an ISR
+  // may release the timer in the meantime (completing a PWM ramp), leaving the
+  // MCU idling with only the WDT to wake it.
+  //
+  // Idling on a timer is bound by time rather than CPU cycles, so waits at
+  // the reduced clock (if the running timers allow it) - the events it wakes
+  // for are handled at full speed.
+  bool idle = (USERS & POWER_IDLE_USERS) != 0;
+  if (idle) {
+    set_sleep_mode(SLEEP_MODE_IDLE);
+    clock_slow();
+  } else {
+    set_sleep_mode(SLEEP_MODE_PWR_DOWN);
+  }
+
+  sleep_enable();
+
+  // The brown-out detector (if enabled by the fuses) guards the EEPROM writes
+  // and pump inrush while awake, but is not needed while powered down - turn
+  // it off for the duration of the sleep with the timed BODS/BODSE sequence,
+  // which MUST be followed by the sleep within 3 cycles.
+  //
+  // Ignored by revisions of the ATtiny85 before C.
+  if (!idle) {
+    sleep_bod_disable();
+  }
+
+  // Re-enable interrupts.
+  //
+  // This guarantees next instruction is executed atomically (no interrupt can
+  // happen before the CPU sleep). Any pending (but not yet serviced)
+  // interrupts will immediately wake the device.
+  sei();
+  sleep_cpu();
+  sleep_disable(); // Wake here and restore system
+  clock_full();
+}
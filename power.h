@@ -0,0 +1,68 @@
+#ifndef POWER_H
+#define POWER_H
+
+#include <avr/io.h>
+
+/// The users of each peripheral, each a distinct bit.
+///
+/// A peripheral is powered while any of its users holds it (see
+/// power_acquire()), and each user releases only its own claim - so a handler
+/// finishing with a timer never powers it down underneath another.
+#define POWER_TIMER0_DEBOUNCE (1 << 0)  // Button debounce samples
+#define POWER_TIMER0_TELEMETRY (1 << 1) // Telemetry bit clock
+#define POWER_TIMER1_PWM (1 << 2)       // Pump PWM soft-start
+#define POWER_TIMER1_CALIBRATE (1 << 3) // WDT oscillator calibration
+#define POWER_TIMER1_PROFILE (1 << 4)   // Profiling clock
+#define POWER_USI_TELEMETRY (1 << 5)    // Telemetry shift register
+#define POWER_USI_EXPANDER (1 << 6)     // Pump & probe shift register output
+#define POWER_ADC_SUPPLY (1 << 7)       // Pump supply voltage readings
+#define POWER_USI_RTC (1 << 8)          // RTC two-wire bus
+
+#define POWER_TIMER0_USERS (POWER_TIMER0_DEBOUNCE | POWER_TIMER0_TELEMETRY)
+#define POWER_TIMER1_USERS                                                     \
+  (POWER_TIMER1_PWM | POWER_TIMER1_CALIBRATE | POWER_TIMER1_PROFILE)
+#define POWER_USI_USERS                                                        \
+  (POWER_USI_TELEMETRY | POWER_USI_EXPANDER | POWER_USI_RTC)
+#define POWER_ADC_USERS (POWER_ADC_SUPPLY)
+
+/// Users whose timer interrupts must keep waking the MCU, requiring the idle
+/// sleep mode (the timers are stopped in power-down).
+///
+/// The profiling clock only measures time spent awake, and calibration never
+/// sleeps.
+#define POWER_IDLE_USERS                                                       \
+  (POWER_TIMER0_DEBOUNCE | POWER_TIMER0_TELEMETRY | POWER_TIMER1_PWM)
+
+/// Power down all the peripherals, the analog comparator and the digital input
+/// buffers of all pins, and drive every pin as a low output.
+///
+/// MUST be called first at boot - pins used as inputs are configured by their
+/// owners afterwards.
+extern void power_init();
+
+/// Power up the peripheral of user (a POWER_* bit), if not already held by
+/// another of its users.
+extern void power_acquire(uint16_t user);
+
+/// Drop the claim of user (a POWER_* bit), powering down its peripheral if no
+/// other user holds it.
+extern void power_release(uint16_t user);
+
+/// The users (POWER_* bits) currently holding a peripheral.
+extern uint16_t power_users();
+
+/// Enable the digital input buffer of pin (in PORTB), for reading it or
+/// raising pin change interrupts from it.
+extern void power_input_enable(uint8_t pin);
+
+/// Disable the digital input buffer of pin, avoiding the current drawn by a
+/// floating input.
+extern void power_input_disable(uint8_t pin);
+
+/// @brief Sleep until the next interrupt in the lowest power state the held
+/// peripherals allow.
+///
+/// MUST be called with interrupts disabled, which are enabled on return.
+extern void power_sleep();
+
+#endif /* POWER_H */
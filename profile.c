@@ -0,0 +1,141 @@
+#include "profile.h"
+
+#ifdef PROFILE
+
+#include "hal.h"
+#include "power.h"
+#include "telemetry.h"
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+
+struct profile_stats PROFILE_STATS[PROFILE_HOOK_COUNT];
+
+volatile uint8_t PROFILE_EPOCH = 0;
+
+/// The upper bits of the profiling clock, counting timer 1 overflows.
+static volatile uint16_t OVERFLOWS = 0;
+
+/// The cycles measured by an empty span, subtracted from each measurement.
+static uint32_t OVERHEAD = 0;
+
+#ifdef PROFILE_PIN
+/// The number of spans in progress (nested, or interrupted by an ISR).
+static volatile uint8_t DEPTH = 0;
+#endif
+
+#ifdef TELEMETRY
+/// The next hook to consider in profile_report(), and the call count of each
+/// hook when last reported.
+static uint8_t REPORT_NEXT = 0;
+static uint16_t REPORTED_CALLS[PROFILE_HOOK_COUNT];
+#endif
+
+// Extend the 8-bit timer to the 24-bit profiling clock.
+//
+// Every 256 cycles - the cost of this ISR is included in any span it
+// interrupts.
+ISR(TIM1_OVF_vect) { OVERFLOWS++; }
+
+/// @brief Read the 24-bit profiling clock.
+static uint32_t now() {
+  uint32_t t;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    uint8_t lo = TCNT1;
+    uint16_t hi = OVERFLOWS;
+
+    // An overflow pending while interrupts are disabled has not yet been
+    // counted.
+    if ((TIFR & (1 << TOV1)) && lo < 128) {
+      hi++;
+    }
+    t = ((uint32_t)hi << 8) | lo;
+  }
+  return t;
+}
+
+void profile_init() {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    power_acquire(POWER_TIMER1_PROFILE);
+    TCCR1 = 0;
+    TCNT1 = 0;
+    OVERFLOWS = 0;
+    hal_write(TIFR, 1 << TOV1);
+    TIMSK |= (1 << TOIE1);
+    TCCR1 = (1 << CS10); // Pre-scaler: DIV1, counting cycles
+    PROFILE_EPOCH++;
+  }
+
+#ifdef PROFILE_PIN
+  DDRB |= (1 << PROFILE_PIN);
+#endif
+
+  uint32_t start = profile_begin();
+  OVERHEAD = 0;
+  OVERHEAD = now() - start;
+}
+
+uint32_t profile_begin() {
+#ifdef PROFILE_PIN
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    if (DEPTH++ == 0) {
+      PORTB |= (1 << PROFILE_PIN);
+    }
+  }
+#endif
+  return now();
+}
+
+void profile_end(uint8_t hook, uint32_t start, uint8_t epoch) {
+  uint32_t cycles = now() - start;
+
+#ifdef PROFILE_PIN
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    if (--DEPTH == 0) {
+      PORTB &= ~(1 << PROFILE_PIN);
+    }
+  }
+#endif
+
+  cycles = cycles > OVERHEAD ? cycles - OVERHEAD : 0;
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    if (epoch != PROFILE_EPOCH) {
+      return;
+    }
+
+    struct profile_stats *s = &PROFILE_STATS[hook];
+    if (s->calls == 0 || cycles < s->min) {
+      s->min = cycles;
+    }
+    if (cycles > s->max) {
+      s->max = cycles;
+    }
+    s->total += cycles;
+    s->calls++;
+  }
+}
+
+void profile_report() {
+#ifdef TELEMETRY
+  if (telemetry_busy()) {
+    return;
+  }
+
+  for (uint8_t i = 0; i < PROFILE_HOOK_COUNT; i++) {
+    uint8_t hook = REPORT_NEXT;
+    REPORT_NEXT = (REPORT_NEXT + 1) % PROFILE_HOOK_COUNT;
+
+    struct profile_stats s;
+    ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { s = PROFILE_STATS[hook]; }
+    if (s.calls == REPORTED_CALLS[hook]) {
+      continue;
+    }
+
+    REPORTED_CALLS[hook] = s.calls;
+    telemetry_profile(hook, s.calls, s.min, s.max, s.total);
+    return;
+  }
+#endif
+}
+
+#endif /* PROFILE */
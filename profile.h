@@ -0,0 +1,99 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <avr/io.h>
+
+/// Cycle profiling hooks, timestamping the entry & exit of the event handlers
+/// and ISRs.
+///
+/// Only built when PROFILE is defined (`make PROFILE=1`) - otherwise the hooks
+/// below generate no code. The min/max/total cycles of each hook are kept in
+/// PROFILE_STATS, which can be printed over debugWIRE (`print PROFILE_STATS`)
+/// or, in a TELEMETRY build, is sent over the serial channel.
+///
+/// Timer 1 is dedicated to the profiling clock, so the pump PWM soft-start is
+/// disabled in profiling builds.
+///
+/// If PROFILE_PIN is also defined (`make PROFILE=1 PROFILE_PIN=PINB2`) that
+/// pin is driven high while any hook is active, for a logic analyser - the pin
+/// is lost to its usual function.
+
+/// The profiled handlers & ISRs, indexing PROFILE_STATS.
+enum ProfileHook {
+  Profile_EventButton = 0,
+  Profile_EventButtonSample,
+  Profile_EventOverflow,
+  Profile_EventPump,
+  Profile_EventInterval,
+  Profile_EventCheckpoint,
+  Profile_EventRtcWake,
+  Profile_WdtTick,
+  Profile_ConfigureSleep,
+  Profile_IsrPcint0,
+  Profile_IsrTim0CompA,
+  Profile_IsrTim0CompB,
+  PROFILE_HOOK_COUNT,
+};
+
+#ifdef PROFILE
+
+/// @brief The cycles spent in a single hook.
+struct profile_stats {
+  uint16_t calls;
+  uint32_t min;
+  uint32_t max;
+  /// Wraps after ~9 minutes of cycles in the hook.
+  uint32_t total;
+};
+
+extern struct profile_stats PROFILE_STATS[PROFILE_HOOK_COUNT];
+
+/// Incremented each time the profiling clock is restarted, invalidating any
+/// measurement spanning it.
+extern volatile uint8_t PROFILE_EPOCH;
+
+/// Start the profiling clock, measuring the overhead of the hooks themselves.
+///
+/// MUST be called at boot, and again whenever timer 1 is borrowed (by
+/// wdt_calibrate()).
+extern void profile_init();
+
+/// The current profiling clock timestamp, in cycles.
+extern uint32_t profile_begin();
+
+/// Record the cycles elapsed since start (returned by profile_begin()) against
+/// hook, unless the clock was restarted since epoch.
+extern void profile_end(uint8_t hook, uint32_t start, uint8_t epoch);
+
+/// In a TELEMETRY build, send the stats of the next changed hook if the channel
+/// is idle.
+extern void profile_report();
+
+/// Mark the start of a profiled span, declaring the variable name to hold its
+/// start.
+#define PROFILE_BEGIN(name)                                                    \
+  uint8_t name##_epoch = PROFILE_EPOCH;                                        \
+  uint32_t name = profile_begin()
+
+/// Mark the end of the profiled span started by PROFILE_BEGIN(name), recording
+/// it against hook.
+#define PROFILE_END(hook, name) profile_end(hook, name, name##_epoch)
+
+#else
+
+#define profile_init()                                                         \
+  do {                                                                         \
+  } while (0)
+#define profile_report()                                                       \
+  do {                                                                         \
+  } while (0)
+#define PROFILE_BEGIN(name)                                                    \
+  do {                                                                         \
+  } while (0)
+#define PROFILE_END(hook, name)                                                \
+  do {                                                                         \
+  } while (0)
+
+#endif /* PROFILE */
+
+#endif /* PROFILE_H */
@@ -0,0 +1,219 @@
+#include "pump.h"
+#include "channel.h"
+#include "hal.h"
+#include "power.h"
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+
+/// The following timer configuration assumes a clock frequency of 8MHz
+_Static_assert(F_CPU == 8000000);
+
+/// Timer 1 counts at F_CPU/64 and overflows every 256 ticks, giving a PWM
+/// period of 2.048ms (~488Hz).
+#define PWM_PERIOD_US 2048
+
+#ifdef PROFILE
+
+// Timer 1 is taken by the profiling clock (see profile.h) - the pumps are
+// always switched straight on.
+void pump_start(uint8_t pump) { channel_on(pump); }
+void pump_stop(uint8_t pump) { channel_off(pump); }
+
+#else
+
+/// @brief The PWM state of a single pump.
+///
+/// Duty cycles are 8.8 fixed-point values, with the integer part compared
+/// against the timer (255 being fully on).
+struct pump_pwm {
+  /// The current duty cycle.
+  uint16_t duty;
+  /// The duty cycle to hold once the ramp completes.
+  uint16_t target;
+  /// The increase in duty cycle per PWM period while ramping up.
+  uint16_t step;
+};
+
+static volatile struct pump_pwm PWM[SETTINGS_PUMP_COUNT];
+
+/// A bitmap of pumps (1 << pump index) driven by PWM.
+static volatile uint8_t PWM_ACTIVE = 0;
+
+#ifdef CHANNEL_EXPANDER
+
+/// @brief Return the TIMSK compare-match interrupt bit ending the "on" part of
+/// the period for pump.
+///
+/// There are more pumps than compare registers - compare register A is shared,
+/// stepping through the duty cycles of the pumps in ascending order (see
+/// next_compare()).
+static uint8_t compare_interrupt(uint8_t pump) {
+  (void)pump;
+  return (1 << OCIE1A);
+}
+
+/// @brief Set the compare register ending the "on" part of the period.
+///
+/// NOP - the shared compare register is set at the start of each period.
+static void pwm_set(uint8_t pump, uint8_t duty) {
+  (void)pump;
+  (void)duty;
+}
+
+/// @brief Return the lowest duty cycle of the PWM driven pumps above after,
+/// or 255 if none are.
+static uint8_t next_compare(uint8_t after) {
+  uint8_t next = 255;
+  for (uint8_t i = 0; i < SETTINGS_PUMP_COUNT; i++) {
+    uint8_t duty = PWM[i].duty >> 8;
+    if ((PWM_ACTIVE & (1 << i)) && duty > after && duty < next) {
+      next = duty;
+    }
+  }
+  return next;
+}
+
+#else
+
+/// @brief Return the TIMSK compare-match interrupt bit ending the "on" part of
+/// the period for pump.
+///
+/// Pump 1 uses compare register A, and pump 2 compare register B.
+static uint8_t compare_interrupt(uint8_t pump) {
+  return pump == 0 ? (1 << OCIE1A) : (1 << OCIE1B);
+}
+
+/// @brief Set the compare register ending the "on" part of the period.
+static void pwm_set(uint8_t pump, uint8_t duty) {
+  if (pump == 0) {
+    OCR1A = duty;
+  } else {
+    OCR1B = duty;
+  }
+}
+
+#endif /* CHANNEL_EXPANDER */
+
+/// @brief Stop generating PWM for pump, powering down timer 1 if no other pump
+/// uses it.
+///
+/// MUST be called while interrupts are disabled.
+static void pwm_release(uint8_t pump) {
+  PWM_ACTIVE &= ~(1 << pump);
+#ifndef CHANNEL_EXPANDER
+  TIMSK &= ~compare_interrupt(pump);
+#endif
+
+  if (PWM_ACTIVE == 0) {
+    TIMSK &= ~((1 << TOIE1) | compare_interrupt(pump));
+    TCCR1 = 0;
+    power_release(POWER_TIMER1_PWM);
+  }
+}
+
+// Start of each PWM period - advance any ramps, and drive the pump pins high.
+ISR(TIM1_OVF_vect) {
+  for (uint8_t i = 0; i < SETTINGS_PUMP_COUNT; i++) {
+    if ((PWM_ACTIVE & (1 << i)) == 0) {
+      continue;
+    }
+
+    volatile struct pump_pwm *p = &PWM[i];
+    if (p->target - p->duty > p->step) {
+      p->duty += p->step;
+    } else {
+      p->duty = p->target;
+    }
+
+    uint8_t duty = p->duty >> 8;
+
+    // Once ramped up to fully on, hand the pin over to the GPIO output so the
+    // timer can be stopped.
+    if (p->duty == p->target && duty == 255) {
+      channel_on(i);
+      pwm_release(i);
+      continue;
+    }
+
+    pwm_set(i, duty);
+    if (duty != 0) {
+      channel_on(i);
+    }
+  }
+
+#ifdef CHANNEL_EXPANDER
+  OCR1A = next_compare(0);
+#endif
+}
+
+// End of the "on" part of the PWM period for each pump.
+#ifdef CHANNEL_EXPANDER
+
+ISR(TIM1_COMPA_vect) {
+  uint8_t at = OCR1A;
+  for (uint8_t i = 0; i < SETTINGS_PUMP_COUNT; i++) {
+    if ((PWM_ACTIVE & (1 << i)) && (PWM[i].duty >> 8) <= at) {
+      channel_off(i);
+    }
+  }
+  OCR1A = next_compare(at);
+}
+
+#else
+
+ISR(TIM1_COMPA_vect) { channel_off(0); }
+#if CHANNEL_COUNT > 1
+ISR(TIM1_COMPB_vect) { channel_off(1); }
+#endif
+
+#endif /* CHANNEL_EXPANDER */
+
+void pump_start(uint8_t pump) {
+  const struct pump_settings *settings = &settings_get()->pumps[pump];
+
+  // Switch straight on if there is nothing for the timer to do.
+  if (settings->duty == 255 && settings->ramp_ms == 0) {
+    channel_on(pump);
+    return;
+  }
+
+  uint16_t target = (uint16_t)settings->duty << 8;
+  uint16_t periods = settings->ramp_ms / (PWM_PERIOD_US / 1000);
+  if (periods == 0) {
+    periods = 1;
+  }
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    PWM[pump].duty = 0;
+    PWM[pump].target = target;
+    PWM[pump].step = target / periods;
+    if (PWM[pump].step == 0) {
+      PWM[pump].step = 1;
+    }
+
+    pwm_set(pump, 0);
+
+    // Start the timer if not already running for the other pump.
+    if (PWM_ACTIVE == 0) {
+      power_acquire(POWER_TIMER1_PWM);
+      TCNT1 = 0;
+      hal_write(TIFR, (1 << OCF1A) | (1 << OCF1B) | (1 << TOV1));
+      TCCR1 = (1 << CS12) | (1 << CS11) | (1 << CS10); // Pre-scaler: DIV64
+      TIMSK |= (1 << TOIE1);
+    }
+
+    PWM_ACTIVE |= (1 << pump);
+    TIMSK |= compare_interrupt(pump);
+  }
+}
+
+void pump_stop(uint8_t pump) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    if (PWM_ACTIVE & (1 << pump)) {
+      pwm_release(pump);
+    }
+    channel_off(pump);
+  }
+}
+
+#endif /* PROFILE */
@@ -0,0 +1,13 @@
+#ifndef PUMP_H
+#define PUMP_H
+
+#include "settings.h"
+#include <avr/io.h>
+
+/// Turn on pump, ramping up to its configured duty cycle.
+extern void pump_start(uint8_t pump);
+
+/// Turn off pump, stopping any PWM output for it.
+extern void pump_stop(uint8_t pump);
+
+#endif /* PUMP_H */
@@ -0,0 +1,297 @@
+#include "rtc.h"
+
+#ifdef RTC
+
+#include "hal.h"
+#include "pins.h"
+#include "power.h"
+#include <util/delay.h>
+
+/// The bus is clocked in fast mode (up to 400kHz), with the SCL low & high
+/// periods rounded up from the 1.3us & 0.6us minimums - these also cover the
+/// start & stop condition setup and hold times.
+#define I2C_LOW_US 2
+#define I2C_HIGH_US 1
+
+/// The longest a slave may hold SCL low (stretching the clock) before the
+/// transfer is abandoned - the DS3231 never does, so this only bounds the wait
+/// on a shorted or missing bus.
+#define I2C_STRETCH_US 100
+
+/// The USI in two-wire mode, shifting on the positive edge of SCL with the
+/// counter clocked by the USITC software strobe (both edges).
+#define USI_TWO_WIRE ((1 << USIWM1) | (1 << USICS1) | (1 << USICLK))
+
+/// Clear every USI status flag, loading the counter to overflow after the
+/// given number of bits (two edges each).
+#define USI_STATUS_BITS(bits)                                                  \
+  ((1 << USISIF) | (1 << USIOIF) | (1 << USIPF) | (1 << USIDC) |               \
+   ((16 - 2 * (bits)) & 0x0F))
+
+/// The DS3231 registers.
+#define RTC_REG_SECONDS 0x00 // Followed by minutes, hours, day, date, month,
+                             // year
+#define RTC_REG_ALARM1 0x07  // Seconds, minutes, hours, day/date
+#define RTC_REG_ALARM2 0x0B  // Minutes, hours, day/date
+#define RTC_REG_CONTROL 0x0E
+#define RTC_REG_STATUS 0x0F
+
+/// Control register bits.
+#define RTC_INTCN (1 << 2) // The INT/SQW pin outputs the alarms
+#define RTC_A1IE (1 << 0)  // Alarm 1 drives INT/SQW low
+
+/// Status register bits.
+#define RTC_OSF (1 << 7)     // The oscillator has stopped - read only
+#define RTC_EN32KHZ (1 << 3) // The 32kHz output is enabled
+#define RTC_A1F (1 << 0)     // Alarm 1 has matched
+
+/// Alarm register bits - a mask bit (AnMx) leaves its register out of the
+/// match, so A1M4 alone on the day/date register matches alarm 1 on the hours,
+/// minutes & seconds (once a day). DY/DT matches the day/date register against
+/// the day of the week (1 to 7) rather than the date.
+#define RTC_ALARM_MASK (1 << 7)
+#define RTC_ALARM_DY (1 << 6)
+
+/// Written to the status register, clearing the alarm flags & 32kHz output
+/// - writing one to OSF leaves it as it is.
+#define RTC_STATUS_CLEAR RTC_OSF
+
+/// The days before the first of each month, in a non-leap year.
+static const uint16_t DAYS_BEFORE_MONTH[12] = {0,   31,  59,  90,  120, 151,
+                                               181, 212, 243, 273, 304, 334};
+
+/// @brief Wait for SCL to be released high, returning false if held low for
+/// more than I2C_STRETCH_US.
+static bool scl_wait() {
+  for (uint8_t i = 0; i < I2C_STRETCH_US; i++) {
+    if (IS_HIGH(RTC_SCL_PIN)) {
+      return true;
+    }
+    _delay_us(1);
+  }
+  return false;
+}
+
+/// @brief Hand SDA & SCL to the USI, both released (high).
+static void bus_acquire() {
+  power_acquire(POWER_USI_RTC);
+
+  // Open drain before the pins are driven, so a line held low by the RTC is
+  // never driven against.
+  USIDR = 0xFF;
+  USICR = USI_TWO_WIRE;
+  hal_write(USISR, USI_STATUS_BITS(8));
+
+  power_input_enable(RTC_SDA_PIN);
+  power_input_enable(RTC_SCL_PIN);
+  PORTB |= (1 << RTC_SDA_PIN) | (1 << RTC_SCL_PIN);
+  DDRB |= (1 << RTC_SDA_PIN) | (1 << RTC_SCL_PIN);
+}
+
+/// @brief Release SDA & SCL to the board pull-ups, and power down the USI.
+static void bus_release() {
+  DDRB &= ~((1 << RTC_SDA_PIN) | (1 << RTC_SCL_PIN));
+  PORTB &= ~((1 << RTC_SDA_PIN) | (1 << RTC_SCL_PIN));
+  USICR = 0;
+  power_input_disable(RTC_SDA_PIN);
+  power_input_disable(RTC_SCL_PIN);
+
+  power_release(POWER_USI_RTC);
+}
+
+/// @brief Generate a (repeated) start condition, leaving SCL low.
+static bool start() {
+  PORTB |= (1 << RTC_SCL_PIN);
+  if (!scl_wait()) {
+    return false;
+  }
+  _delay_us(I2C_HIGH_US);
+
+  // SDA falling while SCL is high.
+  PORTB &= ~(1 << RTC_SDA_PIN);
+  _delay_us(I2C_HIGH_US);
+  PORTB &= ~(1 << RTC_SCL_PIN);
+
+  // Hand SDA to the USI data register.
+  PORTB |= (1 << RTC_SDA_PIN);
+  return true;
+}
+
+/// @brief Generate a stop condition, leaving the bus idle.
+static void stop() {
+  PORTB &= ~(1 << RTC_SDA_PIN);
+  PORTB |= (1 << RTC_SCL_PIN);
+  scl_wait();
+  _delay_us(I2C_HIGH_US);
+
+  // SDA rising while SCL is high.
+  PORTB |= (1 << RTC_SDA_PIN);
+  _delay_us(I2C_LOW_US);
+}
+
+/// @brief Clock bits (8, or 1 for an acknowledge) through the USI data
+/// register, returning false if a slave holds SCL low.
+///
+/// The bits shifted out of USIDR are replaced by those read from SDA - stored
+/// in data, if not NULL.
+static bool transfer(uint8_t bits, uint8_t *data) {
+  hal_write(USISR, USI_STATUS_BITS(bits));
+
+  do {
+    _delay_us(I2C_LOW_US);
+    USICR = USI_TWO_WIRE | (1 << USITC); // SCL high
+    if (!scl_wait()) {
+      return false;
+    }
+    _delay_us(I2C_HIGH_US);
+    USICR = USI_TWO_WIRE | (1 << USITC); // SCL low
+  } while (bit_is_clear(USISR, USIOIF));
+
+  _delay_us(I2C_LOW_US);
+  if (data != NULL) {
+    *data = USIDR;
+  }
+
+  // Release SDA, and drive it from the data register again.
+  USIDR = 0xFF;
+  DDRB |= (1 << RTC_SDA_PIN);
+  return true;
+}
+
+/// @brief Write byte, returning true if the slave acknowledged it.
+static bool write_byte(uint8_t byte) {
+  USIDR = byte;
+  if (!transfer(8, NULL)) {
+    return false;
+  }
+
+  // Read the acknowledge bit, low if acknowledged.
+  uint8_t ack;
+  DDRB &= ~(1 << RTC_SDA_PIN);
+  return transfer(1, &ack) && (ack & 1) == 0;
+}
+
+/// @brief Read a byte into data, acknowledging it if more are to be read.
+static bool read_byte(uint8_t *data, bool more) {
+  DDRB &= ~(1 << RTC_SDA_PIN);
+  if (!transfer(8, data)) {
+    return false;
+  }
+
+  // Acknowledge by pulling SDA low, or leave it high for the last byte.
+  USIDR = more ? 0x00 : 0xFF;
+  return transfer(1, NULL);
+}
+
+/// @brief Write n bytes of data to the registers from reg.
+static bool write_regs(uint8_t reg, const uint8_t *data, uint8_t n) {
+  bus_acquire();
+
+  bool ok = start() && write_byte(RTC_ADDRESS << 1) && write_byte(reg);
+  for (uint8_t i = 0; ok && i < n; i++) {
+    ok = write_byte(data[i]);
+  }
+
+  stop();
+  bus_release();
+  return ok;
+}
+
+/// @brief Read n bytes into data from the registers from reg.
+static bool read_regs(uint8_t reg, uint8_t *data, uint8_t n) {
+  bus_acquire();
+
+  // Set the register pointer, then read from it after a repeated start.
+  bool ok = start() && write_byte(RTC_ADDRESS << 1) && write_byte(reg) &&
+            start() && write_byte((RTC_ADDRESS << 1) | 1);
+  for (uint8_t i = 0; ok && i < n; i++) {
+    ok = read_byte(&data[i], i + 1 < n);
+  }
+
+  stop();
+  bus_release();
+  return ok;
+}
+
+/// @brief Convert a packed BCD register value (with any flag bits masked out)
+/// to binary.
+static uint8_t from_bcd(uint8_t bcd) { return (bcd >> 4) * 10 + (bcd & 0x0F); }
+
+/// @brief Convert a binary value (less than 100) to packed BCD.
+static uint8_t to_bcd(uint8_t value) {
+  return ((value / 10) << 4) | (value % 10);
+}
+
+bool rtc_init(bool *time_set) {
+  uint8_t status;
+  if (!read_regs(RTC_REG_STATUS, &status, 1)) {
+    return false;
+  }
+  *time_set = (status & RTC_OSF) == 0;
+
+  uint8_t regs[] = {RTC_INTCN, RTC_STATUS_CLEAR};
+  return write_regs(RTC_REG_CONTROL, regs, sizeof(regs));
+}
+
+bool rtc_now(uint32_t *seconds) {
+  // The registers are read in a single transfer, which the DS3231 snapshots
+  // at the start condition - no carry between them can be missed.
+  uint8_t r[7];
+  if (!read_regs(RTC_REG_SECONDS, r, sizeof(r))) {
+    return false;
+  }
+
+  // The 12 hour mode is never set by the firmware, and is not supported.
+  uint8_t month = from_bcd(r[5] & 0x1F);
+  uint8_t date = from_bcd(r[4] & 0x3F);
+  if ((r[2] & (1 << 6)) || month < 1 || month > 12 || date < 1) {
+    return false;
+  }
+
+  // Every year from 2000 to 2099 divisible by 4 is a leap year.
+  uint8_t year = from_bcd(r[6]);
+  uint32_t days = (uint32_t)year * 365 + (year + 3) / 4 +
+                  DAYS_BEFORE_MONTH[month - 1] + (date - 1);
+  if (month > 2 && year % 4 == 0) {
+    days++;
+  }
+
+  *seconds = ((days * 24 + from_bcd(r[2] & 0x3F)) * 60 +
+              from_bcd(r[1] & 0x7F)) *
+                 60 +
+             from_bcd(r[0] & 0x7F);
+  return true;
+}
+
+bool rtc_alarm_at(uint32_t seconds) {
+  uint32_t time_of_day = seconds % RTC_DAY_SECONDS;
+  uint8_t s = time_of_day % 60;
+  uint8_t m = (time_of_day / 60) % 60;
+  uint8_t h = time_of_day / (60 * 60);
+
+  // Alarm 1 matching the time of day, then alarm 2 matching day 0 of the week
+  // (which never comes, so A2F is never set), the alarm 1 interrupt enabled
+  // and any earlier match of either cleared - written in one transfer.
+  uint8_t regs[] = {
+      // Alarm 1: seconds, minutes, hours, day/date.
+      to_bcd(s), to_bcd(m), to_bcd(h), RTC_ALARM_MASK,
+      // Alarm 2: minutes, hours, day/date.
+      0, 0, RTC_ALARM_DY,
+      // Control & status.
+      RTC_INTCN | RTC_A1IE, RTC_STATUS_CLEAR,
+  };
+  return write_regs(RTC_REG_ALARM1, regs, sizeof(regs));
+}
+
+bool rtc_alarm_take(bool *fired) {
+  uint8_t status;
+  if (!read_regs(RTC_REG_STATUS, &status, 1)) {
+    return false;
+  }
+  *fired = (status & RTC_A1F) != 0;
+
+  uint8_t regs[] = {RTC_INTCN, RTC_STATUS_CLEAR};
+  return write_regs(RTC_REG_CONTROL, regs, sizeof(regs));
+}
+
+#endif /* RTC */
@@ -0,0 +1,49 @@
+#ifndef RTC_H
+#define RTC_H
+
+#include <avr/io.h>
+#include <stdbool.h>
+
+/// A DS3231 real-time clock on the USI two-wire (I2C) bus, timing the long
+/// sleeps between watering routines in place of the WDT (see wdt_suspend()).
+///
+/// Only built when RTC is defined (`make RTC=1 CHANNELS=1`) - the bus & the
+/// alarm take the pins of the second channel. The active low, open drain alarm
+/// output (INT/SQW) shares the button pin, and the bus lines need pull-ups on
+/// the board.
+///
+/// Time is counted in seconds since 2000-01-01 00:00:00, in whatever zone the
+/// RTC was set to - the firmware never sets it, so set it to local time before
+/// installing the unit.
+
+/// The 7-bit bus address of the DS3231.
+#define RTC_ADDRESS 0x68
+
+/// The length of a day in seconds.
+#define RTC_DAY_SECONDS ((uint32_t)60 * 60 * 24)
+
+/// @brief Configure the RTC, with the alarm interrupt disabled (releasing the
+/// alarm line) and the 32kHz output off.
+///
+/// Returns false if the RTC does not respond - otherwise time_set is false if
+/// its oscillator has stopped since it was last set (the time is counting, but
+/// not the time of day).
+extern bool rtc_init(bool *time_set);
+
+/// Read the current RTC time into seconds, returning false on a bus error.
+extern bool rtc_now(uint32_t *seconds);
+
+/// @brief Arm the alarm to pull the alarm line low at the RTC time seconds,
+/// which MUST be less than a day away - the alarm matches the time of day
+/// only.
+///
+/// Returns false on a bus error.
+extern bool rtc_alarm_at(uint32_t seconds);
+
+/// @brief Disable the alarm interrupt and clear the alarm flag, releasing the
+/// alarm line - fired is true if the alarm had gone off.
+///
+/// Returns false on a bus error.
+extern bool rtc_alarm_take(bool *fired);
+
+#endif /* RTC_H */
@@ -0,0 +1,251 @@
+#include "settings.h"
+#include "clock.h"
+#include "event_handler/watchdog.h"
+#include <avr/eeprom.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <string.h>
+#include <util/crc16.h>
+
+/// The EEPROM bytes given to the ring of settings records, leaving room for
+/// the history (see history.c) & schedule checkpoints (see checkpoint.c).
+#define SETTINGS_EEPROM_BYTES 336
+
+/// The CRC-8 initial value - non-zero so that neither zero-filled nor erased
+/// cells form an intact record.
+#define SETTINGS_CRC_SEED 0xFF
+
+/// @brief A single record in the EEPROM ring.
+struct settings_slot {
+  /// Incremented (wrapping) for each record written.
+  uint8_t seq;
+  struct settings settings;
+  /// CRC-8 of all the preceding fields, detecting torn writes and worn cells.
+  uint8_t crc;
+};
+
+/// The number of records in the EEPROM ring - as many as fit in
+/// SETTINGS_EEPROM_BYTES (7 with two channels).
+///
+/// Each save is written to the slot after the newest, spreading the wear
+/// across all slots.
+#define SETTINGS_SLOT_COUNT                                                    \
+  ((uint8_t)(SETTINGS_EEPROM_BYTES / sizeof(struct settings_slot)))
+_Static_assert(SETTINGS_EEPROM_BYTES / sizeof(struct settings_slot) >= 2,
+               "The settings ring needs at least two slots");
+
+/// The settings of each pump used if no valid record is stored.
+#define PUMP_SETTINGS_DEFAULT                                                  \
+  {                                                                            \
+      .on_duration_ms = 5000,                                                  \
+      .interval_seconds = PUMP_INTERVAL_SECONDS,                               \
+      .enabled = 1,                                                            \
+      .duty = 255,                                                             \
+      .ramp_ms = 200,                                                          \
+      .adaptive = 0,                                                           \
+  }
+
+/// The settings used if no valid record is stored.
+static const struct settings SETTINGS_DEFAULT = {
+    .version = SETTINGS_VERSION,
+    .pumps =
+        {
+            PUMP_SETTINGS_DEFAULT,
+#if SETTINGS_PUMP_COUNT > 1
+            PUMP_SETTINGS_DEFAULT,
+#endif
+#if SETTINGS_PUMP_COUNT > 2
+            PUMP_SETTINGS_DEFAULT,
+#endif
+#if SETTINGS_PUMP_COUNT > 3
+            PUMP_SETTINGS_DEFAULT,
+#endif
+        },
+    .concurrent = 0,
+    .stagger_ms = 500,
+    .adapt_margin_pct = 10,
+    .supply_ref_mv = 0,
+    .supply_stall_mv = 1000,
+    .supply_bandgap_mv = 1100,
+    .supply_sense_div = 11,
+#ifdef RTC
+    .water_at_min = 7 * 60,
+#else
+    .water_at_min = SETTINGS_WATER_AT_NONE,
+#endif
+};
+
+/// The EEPROM ring of settings records.
+///
+/// Unless provisioned by tools/provision.py, the zero-filled initial image
+/// contains no valid records.
+#ifdef SETTINGS_PROVISION
+#include "settings_provision.h"
+static struct settings_slot EEMEM SETTINGS_SLOTS[SETTINGS_SLOT_COUNT] = {
+    SETTINGS_PROVISION_SLOT,
+};
+#else
+static struct settings_slot EEMEM SETTINGS_SLOTS[SETTINGS_SLOT_COUNT];
+#endif
+
+/// The current settings, loaded once at boot.
+static struct settings SETTINGS;
+
+/// The index of the newest valid slot, or SETTINGS_SLOT_COUNT if none.
+static uint8_t NEWEST = SETTINGS_SLOT_COUNT;
+
+/// The sequence number of the newest valid slot.
+static uint8_t NEWEST_SEQ = 0;
+
+/// @brief Compute the CRC-8 of slot, excluding the crc field itself.
+static uint8_t slot_crc(const struct settings_slot *slot) {
+  const uint8_t *p = (const uint8_t *)slot;
+  uint8_t crc = SETTINGS_CRC_SEED;
+  for (uint8_t i = 0; i < offsetof(struct settings_slot, crc); i++) {
+    crc = _crc8_ccitt_update(crc, p[i]);
+  }
+  return crc;
+}
+
+/// @brief Compute the CRC-16 of settings, excluding the crc field itself.
+static uint16_t settings_crc(const struct settings *settings) {
+  const uint8_t *p = (const uint8_t *)settings;
+  uint16_t crc = 0xFFFF;
+  for (uint8_t i = 0; i < offsetof(struct settings, crc); i++) {
+    crc = _crc16_update(crc, p[i]);
+  }
+  return crc;
+}
+
+/// @brief Return true if settings are of the current layout, intact, and
+/// within the range accepted by the rest of the firmware.
+static bool settings_valid(const struct settings *settings) {
+  if (settings->version != SETTINGS_VERSION ||
+      settings->crc != settings_crc(settings)) {
+    return false;
+  }
+
+  for (uint8_t i = 0; i < SETTINGS_PUMP_COUNT; i++) {
+    const struct pump_settings *pump = &settings->pumps[i];
+    if (pump->on_duration_ms >= SETTINGS_MAX_ON_DURATION_MS ||
+        pump->interval_seconds == 0 ||
+        pump->interval_seconds >= SETTINGS_MAX_INTERVAL_SECONDS) {
+      return false;
+    }
+
+    // A duty cycle of 0 never drives the pump, and a ramp outlasting the run
+    // never reaches the duty cycle.
+    if (pump->duty == 0 || pump->ramp_ms > pump->on_duration_ms) {
+      return false;
+    }
+  }
+
+  if (settings->stagger_ms > SETTINGS_MAX_STAGGER_MS ||
+      settings->adapt_margin_pct >= 100) {
+    return false;
+  }
+
+  if (settings->supply_bandgap_mv < SETTINGS_MIN_BANDGAP_MV ||
+      settings->supply_bandgap_mv > SETTINGS_MAX_BANDGAP_MV ||
+      settings->supply_sense_div == 0) {
+    return false;
+  }
+
+  if (settings->water_at_min >= 24 * 60 &&
+      settings->water_at_min != SETTINGS_WATER_AT_NONE) {
+    return false;
+  }
+
+  return true;
+}
+
+/// @brief Read the slot at index into slot.
+/// @return True if the slot holds a valid record.
+static bool slot_read(uint8_t index, struct settings_slot *slot) {
+  eeprom_read_block(slot, &SETTINGS_SLOTS[index], sizeof(*slot));
+  return slot->crc == slot_crc(slot);
+}
+
+void settings_init() {
+  struct settings_slot slot;
+
+  // The sequence number of the newest record holding valid settings, if any.
+  bool loaded = false;
+  uint8_t loaded_seq = 0;
+
+  NEWEST = SETTINGS_SLOT_COUNT;
+  NEWEST_SEQ = 0;
+  SETTINGS = SETTINGS_DEFAULT;
+
+  for (uint8_t i = 0; i < SETTINGS_SLOT_COUNT; i++) {
+    if (!slot_read(i, &slot)) {
+      continue;
+    }
+
+    // Sequence numbers wrap, but all the valid records in the ring lie within
+    // SETTINGS_SLOT_COUNT of each other, so the signed difference orders them.
+    if (NEWEST == SETTINGS_SLOT_COUNT || (int8_t)(slot.seq - NEWEST_SEQ) > 0) {
+      NEWEST = i;
+      NEWEST_SEQ = slot.seq;
+    }
+
+    // An intact record holding invalid settings (such as those of an older
+    // layout) still occupies its place in the ring, but is passed over for the
+    // newest record that is valid.
+    if (settings_valid(&slot.settings) &&
+        (!loaded || (int8_t)(slot.seq - loaded_seq) > 0)) {
+      SETTINGS = slot.settings;
+      loaded = true;
+      loaded_seq = slot.seq;
+    }
+  }
+
+  SETTINGS.crc = settings_crc(&SETTINGS);
+}
+
+const struct settings *settings_get() { return &SETTINGS; }
+
+void settings_save(struct settings *settings) {
+  // Training & the adaptive mode may shorten a run below its ramp - keep the
+  // record valid.
+  for (uint8_t i = 0; i < SETTINGS_PUMP_COUNT; i++) {
+    struct pump_settings *pump = &settings->pumps[i];
+    if (pump->ramp_ms > pump->on_duration_ms) {
+      pump->ramp_ms = pump->on_duration_ms;
+    }
+  }
+
+  settings->version = SETTINGS_VERSION;
+  settings->crc = settings_crc(settings);
+
+  // Skip the (slow, wearing) write entirely if nothing has changed.
+  if (memcmp(&SETTINGS, settings, sizeof(*settings)) == 0) {
+    return;
+  }
+
+  SETTINGS = *settings;
+
+  struct settings_slot slot;
+  slot.seq = NEWEST_SEQ + 1;
+  slot.settings = *settings;
+  slot.crc = slot_crc(&slot);
+
+  // Write to the slot after the newest, moving on to the next slot if the
+  // record does not read back intact so a worn-out cell is skipped rather than
+  // losing the settings.
+  uint8_t index = NEWEST;
+  for (uint8_t attempt = 0; attempt < SETTINGS_SLOT_COUNT; attempt++) {
+    index = (index + 1) % SETTINGS_SLOT_COUNT;
+
+    clock_slow();
+    eeprom_update_block(&slot, &SETTINGS_SLOTS[index], sizeof(slot));
+    clock_full();
+
+    struct settings_slot check;
+    if (slot_read(index, &check) && memcmp(&check, &slot, sizeof(slot)) == 0) {
+      NEWEST = index;
+      NEWEST_SEQ = slot.seq;
+      return;
+    }
+  }
+}
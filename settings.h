@@ -0,0 +1,97 @@
+#ifndef SETTINGS_H
+#define SETTINGS_H
+
+#include "channel.h"
+#include <avr/io.h>
+
+/// The layout version of struct settings.
+///
+/// MUST be incremented whenever struct settings changes, invalidating stored
+/// records of the old layout (and tools/provision.py updated to match).
+#define SETTINGS_VERSION 7
+
+/// The largest values accepted when validating loaded settings, matching the
+/// limits of the WDT timer API.
+#define SETTINGS_MAX_ON_DURATION_MS ((uint32_t)1 << 23)
+#define SETTINGS_MAX_INTERVAL_SECONDS ((uint32_t)1 << 20)
+
+/// The largest stagger between starting each pump accepted, keeping the
+/// offset of the last pump within 16 bits.
+#define SETTINGS_MAX_STAGGER_MS (UINT16_MAX / SETTINGS_PUMP_COUNT)
+
+/// The range of the internal bandgap reference, varying between parts.
+#define SETTINGS_MIN_BANDGAP_MV 1000
+#define SETTINGS_MAX_BANDGAP_MV 1200
+
+/// The water_at_min of settings that water at the end of each interval,
+/// whatever the time of day.
+#define SETTINGS_WATER_AT_NONE 0xFFFF
+
+/// The number of pumps with independent settings - one per channel, so the
+/// layout (and stored records) differ between channel counts.
+#define SETTINGS_PUMP_COUNT CHANNEL_COUNT
+
+/// Per-pump settings.
+struct pump_settings {
+  /// The duration the pump runs for, in milliseconds.
+  uint32_t on_duration_ms;
+  /// The number of seconds between watering routines for this pump.
+  uint32_t interval_seconds;
+  /// Non-zero if the pump should be run.
+  uint8_t enabled;
+  /// The PWM duty cycle held while running, from 1 to 255 (fully on).
+  uint8_t duty;
+  /// The time taken to ramp up from off to duty when starting, in
+  /// milliseconds - no longer than on_duration_ms.
+  uint16_t ramp_ms;
+  /// Non-zero to monitor the overflow sensor while pumping, learning the run
+  /// duration from the time taken for the saucer to wet.
+  uint8_t adaptive;
+};
+
+/// User-configurable settings, persisted in EEPROM.
+struct settings {
+  /// MUST be SETTINGS_VERSION.
+  uint8_t version;
+  struct pump_settings pumps[SETTINGS_PUMP_COUNT];
+  /// Non-zero to run all due pumps at once, rather than one after another.
+  uint8_t concurrent;
+  /// In concurrent mode, the delay between starting each pump in
+  /// milliseconds, avoiding coinciding inrush currents.
+  uint16_t stagger_ms;
+  /// In adaptive mode, the margin below the time taken for the saucer to wet
+  /// that the run duration converges to, as a percentage.
+  uint8_t adapt_margin_pct;
+  /// The pump supply voltage (in mV) the run durations deliver their volume
+  /// at, each run scaled to the supply measured as it starts - or 0 to run for
+  /// the stored durations regardless (see supply.h). Set by training.
+  uint16_t supply_ref_mv;
+  /// The supply voltage (in mV) at which the pumps stall, delivering no flow.
+  uint16_t supply_stall_mv;
+  /// The measured voltage of the internal bandgap reference, in mV.
+  uint16_t supply_bandgap_mv;
+  /// In a SUPPLY_SENSE build, the ratio of the divider feeding the pump rail
+  /// to the sense pin.
+  uint8_t supply_sense_div;
+  /// In an RTC build, the time of day (in minutes past midnight) each watering
+  /// routine is moved to, or SETTINGS_WATER_AT_NONE - intervals shorter than
+  /// a day water once a day.
+  uint16_t water_at_min;
+  /// CRC-16 of all the preceding fields.
+  uint16_t crc;
+};
+
+/// Load the newest valid settings from EEPROM into SRAM, falling back to the
+/// defaults if none are stored or they fail validation.
+///
+/// MUST be called once at boot, before any other settings function.
+extern void settings_init();
+
+/// The current settings, held in SRAM.
+extern const struct settings *settings_get();
+
+/// Persist settings (computing the version & CRC, and cutting any ramp longer
+/// than its run down to it), skipping the write if they are unchanged.
+extern void settings_save(struct settings *settings);
+
+#endif /* SETTINGS_H */
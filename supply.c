@@ -0,0 +1,96 @@
+#include "supply.h"
+#include "pins.h"
+#include "power.h"
+#include "settings.h"
+#include <util/delay.h>
+
+/// The following ADC configuration assumes a clock frequency of 8MHz
+_Static_assert(F_CPU == 8000000);
+
+/// The ADC clock is F_CPU/64 (125kHz), within the 50-200kHz giving the full
+/// 10-bit resolution.
+#define ADC_PRESCALER ((1 << ADPS2) | (1 << ADPS1))
+
+/// The number of conversions averaged per reading, after discarding the first.
+#define SUPPLY_SAMPLES 4
+
+/// Delay after selecting the input, letting the bandgap reference settle.
+#define SUPPLY_SETTLE_US 1000
+
+#ifdef SUPPLY_SENSE
+/// The pump rail divider on the sense pin, against the internal reference.
+#define SUPPLY_ADMUX ((1 << REFS1) | SUPPLY_SENSE_MUX)
+#else
+/// The bandgap reference, against VCC as the reference.
+#define SUPPLY_ADMUX ((1 << MUX3) | (1 << MUX2))
+#endif
+
+/// @brief Run a single conversion, busy-waiting the ~100us for its result.
+static uint16_t convert() {
+  ADCSRA |= (1 << ADSC);
+  loop_until_bit_is_clear(ADCSRA, ADSC);
+
+  // ADCL MUST be read first, locking the result until ADCH is read.
+  uint8_t lo = ADCL;
+  return lo | ((uint16_t)ADCH << 8);
+}
+
+uint16_t supply_read_mv() {
+  power_acquire(POWER_ADC_SUPPLY);
+  ADMUX = SUPPLY_ADMUX;
+  ADCSRA = (1 << ADEN) | ADC_PRESCALER;
+  _delay_us(SUPPLY_SETTLE_US);
+
+  // The first conversion after changing the reference may be inaccurate.
+  convert();
+
+  uint16_t sum = 0;
+  for (uint8_t i = 0; i < SUPPLY_SAMPLES; i++) {
+    sum += convert();
+  }
+
+  // The ADC MUST be disabled before being powered down.
+  ADCSRA = 0;
+  power_release(POWER_ADC_SUPPLY);
+
+  const struct settings *settings = settings_get();
+#ifdef SUPPLY_SENSE
+  // The pin reads the divided rail as a fraction (of 1024) of the bandgap.
+  uint32_t mv = (uint32_t)sum * settings->supply_bandgap_mv *
+                settings->supply_sense_div / (1024UL * SUPPLY_SAMPLES);
+#else
+  // The bandgap reads as a fraction (of 1024) of VCC.
+  if (sum == 0) {
+    return 0;
+  }
+  uint32_t mv =
+      (uint32_t)settings->supply_bandgap_mv * 1024 * SUPPLY_SAMPLES / sum;
+#endif
+  return mv < UINT16_MAX ? mv : UINT16_MAX;
+}
+
+uint32_t supply_scale_ms(uint32_t duration_ms, uint16_t from_mv,
+                         uint16_t to_mv) {
+  if (from_mv == 0 || to_mv == 0) {
+    return duration_ms;
+  }
+
+  uint16_t stall = settings_get()->supply_stall_mv;
+  uint16_t from = from_mv > stall ? from_mv - stall : 0;
+  uint16_t to = to_mv > stall ? to_mv - stall : 0;
+
+  // The ratio of the flows (from / to) in 8.8 fixed point, bounded - a supply
+  // at or below the stall voltage runs for the longest duration.
+  uint32_t ratio = to == 0 ? UINT32_MAX : ((uint32_t)from << 8) / to;
+  if (ratio < 256 / SUPPLY_SCALE_MIN_DIV) {
+    ratio = 256 / SUPPLY_SCALE_MIN_DIV;
+  } else if (ratio > 256 * SUPPLY_SCALE_MAX_MUL) {
+    ratio = 256 * SUPPLY_SCALE_MAX_MUL;
+  }
+
+  // Split the multiplication, keeping it within 32 bits.
+  uint32_t ms =
+      (duration_ms >> 8) * ratio + (((duration_ms & 0xFF) * ratio) >> 8);
+  return ms < SETTINGS_MAX_ON_DURATION_MS ? ms
+                                          : SETTINGS_MAX_ON_DURATION_MS - 1;
+}
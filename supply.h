@@ -0,0 +1,29 @@
+#ifndef SUPPLY_H
+#define SUPPLY_H
+
+#include <avr/io.h>
+
+/// The bounds of the on-time scaling, as a factor of the trained duration -
+/// limiting the damage of a bad reading or calibration.
+#define SUPPLY_SCALE_MIN_DIV 2 // 1/2 of the trained duration
+#define SUPPLY_SCALE_MAX_MUL 2 // 2x the trained duration
+
+/// @brief Read the voltage of the pump supply in millivolts, powering the ADC
+/// only for the few samples taken.
+///
+/// The pumps share VCC with the MCU, measured against the internal bandgap
+/// reference (calibrated by settings supply_bandgap_mv) - or in a SUPPLY_SENSE
+/// build, the pump rail is read through a divider on SUPPLY_SENSE_PIN.
+extern uint16_t supply_read_mv();
+
+/// @brief Scale duration_ms, delivering a volume at a supply of from_mv, to the
+/// duration delivering the same volume at to_mv.
+///
+/// The flow is modelled as proportional to the supply above the pump stall
+/// voltage (settings supply_stall_mv), the scaling bounded by
+/// SUPPLY_SCALE_MIN_DIV & SUPPLY_SCALE_MAX_MUL. Returned unchanged if either
+/// voltage is unknown (zero).
+extern uint32_t supply_scale_ms(uint32_t duration_ms, uint16_t from_mv,
+                                uint16_t to_mv);
+
+#endif /* SUPPLY_H */
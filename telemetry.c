@@ -0,0 +1,206 @@
+#include "telemetry.h"
+
+#ifdef TELEMETRY
+
+#include "event_handler/button.h"
+#include "hal.h"
+#include "pins.h"
+#include "power.h"
+#include "profile.h"
+#include <avr/interrupt.h>
+#include <util/atomic.h>
+#include <util/crc16.h>
+
+/// The USI data output is fixed in hardware.
+_Static_assert(TELEMETRY_TX_PIN == OVERFLOW_SIGNAL_PIN_1);
+
+/// The timer configuration (shared with the button debounce) assumes a clock
+/// frequency of 8MHz.
+_Static_assert(F_CPU == 8000000);
+
+/// Timer 0 counts at F_CPU/64 (8us) with a period of 125 ticks (1ms) - each
+/// bit lasts 13 ticks (104us, ~9615 baud).
+#define BIT_TICKS 13
+#define TIMER_PERIOD 125
+
+/// The number of bits in each character: start, 8 data, stop.
+#define CHAR_BITS 10
+
+/// The size of the transmit buffer. MUST be a power of 2.
+#define BUFFER_SIZE 32
+_Static_assert((BUFFER_SIZE & (BUFFER_SIZE - 1)) == 0);
+
+/// Bytes queued for transmission, written at HEAD and read at TAIL.
+static volatile uint8_t BUFFER[BUFFER_SIZE];
+static volatile uint8_t HEAD = 0;
+static volatile uint8_t TAIL = 0;
+
+/// The character being shifted out by the USI, split into the (bit-reversed,
+/// MSB first) halves loaded into USIDR.
+static volatile uint8_t CHAR_LO;
+static volatile uint8_t CHAR_HI;
+
+/// The index of the next bit of the character, or CHAR_BITS when between
+/// characters.
+static volatile uint8_t BIT = CHAR_BITS;
+
+/// True while the timer is driving the transmission.
+static volatile bool BUSY = false;
+
+/// The last time to the next WDT timer sent.
+static uint32_t LAST_WDT = 0;
+
+/// @brief Reverse the bit order of b, as the USI shifts out MSB first.
+static uint8_t reverse(uint8_t b) {
+  b = (b & 0xF0) >> 4 | (b & 0x0F) << 4;
+  b = (b & 0xCC) >> 2 | (b & 0x33) << 2;
+  b = (b & 0xAA) >> 1 | (b & 0x55) << 1;
+  return b;
+}
+
+/// @brief Stop transmitting, powering down timer 0 if the button is not using
+/// it.
+static void transmit_stop() {
+  TIMSK &= ~(1 << OCIE0B);
+  BUSY = false;
+  power_release(POWER_TIMER0_TELEMETRY);
+}
+
+// Fires once per bit period while transmitting.
+//
+// The USI uses the software clock strobe, so the output latch is transparent
+// and DO follows the MSB of USIDR - each strobe shifts out the next bit.
+ISR(TIM0_COMPB_vect) {
+  PROFILE_BEGIN(profile);
+
+  // Schedule the next bit, wrapping around the period of the shared timer.
+  uint8_t next = OCR0B + BIT_TICKS;
+  OCR0B = next >= TIMER_PERIOD ? next - TIMER_PERIOD : next;
+
+  if (BIT == CHAR_BITS) {
+    if (HEAD == TAIL) {
+      transmit_stop();
+      PROFILE_END(Profile_IsrTim0CompB, profile);
+      return;
+    }
+
+    // Start bit (0), the data LSB first, then the stop bit & idle (1).
+    uint16_t c = ((uint16_t)BUFFER[TAIL] << 1) | 0xFE00;
+    TAIL = (TAIL + 1) & (BUFFER_SIZE - 1);
+    CHAR_LO = reverse(c);
+    CHAR_HI = reverse(c >> 8);
+    BIT = 0;
+  }
+
+  if (BIT == 0) {
+    USIDR = CHAR_LO;
+  } else if (BIT == 8) {
+    USIDR = CHAR_HI;
+  } else {
+    USICR |= (1 << USICLK);
+  }
+  BIT++;
+
+  PROFILE_END(Profile_IsrTim0CompB, profile);
+}
+
+/// @brief Start the timer driving the transmission, if not already running.
+///
+/// MUST be called while interrupts are disabled.
+static void transmit_start() {
+  if (BUSY) {
+    return;
+  }
+  BUSY = true;
+
+  // Share the 1ms timer of the button debounce, configuring it identically if
+  // not already running.
+  power_acquire(POWER_TIMER0_TELEMETRY);
+  if (!button_is_debouncing()) {
+    OCR0A = TIMER_PERIOD - 1;
+    TCCR0B = (1 << CS01) | (1 << CS00); // Pre-scaler: DIV64
+    TCCR0A = (1 << WGM01); // CTC mode, int. on value match of OCR0A
+  }
+
+  uint8_t next = TCNT0 + 1;
+  OCR0B = next >= TIMER_PERIOD ? 0 : next;
+  hal_write(TIFR, 1 << OCF0B);
+  TIMSK |= (1 << OCIE0B);
+}
+
+/// @brief Queue a frame of the given type and payload, dropping it whole if
+/// the buffer is full.
+static void send(uint8_t type, const uint8_t *payload, uint8_t len) {
+  uint8_t crc = _crc8_ccitt_update(0, type);
+  for (uint8_t i = 0; i < len; i++) {
+    crc = _crc8_ccitt_update(crc, payload[i]);
+  }
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    uint8_t free = (TAIL - HEAD - 1) & (BUFFER_SIZE - 1);
+    if (free < len + 3) {
+      return;
+    }
+
+    uint8_t head = HEAD;
+    BUFFER[head] = TELEMETRY_SYNC;
+    head = (head + 1) & (BUFFER_SIZE - 1);
+    BUFFER[head] = type;
+    head = (head + 1) & (BUFFER_SIZE - 1);
+    for (uint8_t i = 0; i < len; i++) {
+      BUFFER[head] = payload[i];
+      head = (head + 1) & (BUFFER_SIZE - 1);
+    }
+    BUFFER[head] = crc;
+    HEAD = (head + 1) & (BUFFER_SIZE - 1);
+
+    transmit_start();
+  }
+}
+
+void telemetry_init() {
+  power_acquire(POWER_USI_TELEMETRY);
+
+  // Idle the line high before handing the pin to the USI.
+  USIDR = 0xFF;
+  DDRB |= (1 << TELEMETRY_TX_PIN);
+
+  // Three-wire mode drives DO, with the software clock strobe.
+  USICR = (1 << USIWM0);
+}
+
+bool telemetry_busy() { return BUSY; }
+
+void telemetry_events(uint8_t flags) {
+  if (flags == 0) {
+    return;
+  }
+  send(TELEMETRY_FRAME_EVENTS, &flags, sizeof(flags));
+}
+
+void telemetry_wdt(uint32_t next_expiry) {
+  if (next_expiry == LAST_WDT) {
+    return;
+  }
+  LAST_WDT = next_expiry;
+  send(TELEMETRY_FRAME_WDT, (const uint8_t *)&next_expiry, sizeof(next_expiry));
+}
+
+void telemetry_profile(uint8_t hook, uint16_t calls, uint32_t min,
+                       uint32_t max, uint32_t total) {
+  struct {
+    uint8_t hook;
+    uint16_t calls;
+    uint32_t min;
+    uint32_t max;
+    uint32_t total;
+  } payload = {hook, calls, min, max, total};
+  send(TELEMETRY_FRAME_PROFILE, (const uint8_t *)&payload, sizeof(payload));
+}
+
+void telemetry_pump(uint8_t pump, uint8_t state) {
+  uint8_t payload[] = {pump, state};
+  send(TELEMETRY_FRAME_PUMP, payload, sizeof(payload));
+}
+
+#endif /* TELEMETRY */
@@ -0,0 +1,71 @@
+#ifndef TELEMETRY_H
+#define TELEMETRY_H
+
+#include <avr/io.h>
+#include <stdbool.h>
+
+/// A transmit-only serial telemetry channel, driven out of the USI data output
+/// (DO) pin at ~9615 baud (8N1).
+///
+/// Only built when TELEMETRY is defined (`make TELEMETRY=1`) - otherwise every
+/// call below compiles to nothing, and the pin is left to the overflow sensor.
+///
+/// Each event is sent as a frame of TELEMETRY_SYNC, the frame type, a fixed
+/// length payload (little-endian) and a CRC-8 of the type & payload, decoded
+/// by tools/telemetry.py.
+
+/// The pin driven by the USI data output.
+#define TELEMETRY_TX_PIN PINB1
+
+/// The first byte of every frame.
+#define TELEMETRY_SYNC 0x7E
+
+/// Frame types, and their payloads.
+#define TELEMETRY_FRAME_EVENTS 0x01  // uint8_t pending EVENT_STATE flags
+#define TELEMETRY_FRAME_WDT 0x02     // uint32_t seconds to the next WDT timer
+#define TELEMETRY_FRAME_PUMP 0x03    // uint8_t pump, uint8_t FSM state
+#define TELEMETRY_FRAME_PROFILE 0x04 // uint8_t hook, uint16_t calls,
+                                     // uint32_t min, max & total cycles
+
+#ifdef TELEMETRY
+
+/// Configure the USI & TX pin.
+///
+/// MUST be called after channel_init(), taking over an overflow sensor pin.
+extern void telemetry_init();
+
+/// Returns true while frames are being transmitted.
+extern bool telemetry_busy();
+
+/// Queue a frame of the EVENT_STATE flags about to be handled, if any.
+extern void telemetry_events(uint8_t flags);
+
+/// Queue a frame of the time to the next WDT timer, if changed since the last.
+extern void telemetry_wdt(uint32_t next_expiry);
+
+/// Queue a frame of a pump FSM state change.
+extern void telemetry_pump(uint8_t pump, uint8_t state);
+
+/// Queue a frame of the profiling stats of hook (see profile.h).
+extern void telemetry_profile(uint8_t hook, uint16_t calls, uint32_t min,
+                              uint32_t max, uint32_t total);
+
+#else
+
+#define telemetry_init()                                                       \
+  do {                                                                         \
+  } while (0)
+#define telemetry_busy() false
+#define telemetry_events(flags)                                                \
+  do {                                                                         \
+  } while (0)
+#define telemetry_wdt(next_expiry)                                             \
+  do {                                                                         \
+  } while (0)
+#define telemetry_pump(pump, state)                                            \
+  do {                                                                         \
+  } while (0)
+
+#endif /* TELEMETRY */
+
+#endif /* TELEMETRY_H */
@@ -0,0 +1,135 @@
+#!/usr/bin/env python3
+# Copyright 2024 Dominic Dwyer (dom@itsallbroken.com)
+#
+# Licensed under the Apache License, Version 2.0 (the "License"); you may not
+# use this file except in compliance with the License. You may obtain a copy of
+# the License at
+#
+#             http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+# WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+# License for the specific language governing permissions and limitations under
+# the License.
+
+"""Decode the watering history from an EEPROM dump.
+
+Reads an Intel HEX dump of the EEPROM (as produced by `make history`, or
+`avrdude ... -U eeprom:r:history.hex:i`) and prints the intact records of the
+history ring, oldest first.
+
+The record layout (and CRC) MUST match struct history_record in history.h.
+"""
+
+import argparse
+import os
+import re
+import struct
+import sys
+
+RECORD = struct.Struct("<BHBHB")
+
+ROOT = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..")
+
+# MCUSR reset flags, as stored in the high nibble of the record flags.
+RESET_CAUSES = [(0, "power-on"), (1, "external"), (2, "brown-out"),
+                (3, "watchdog")]
+
+
+def crc8_ccitt_update(crc, byte):
+    """avr-libc _crc8_ccitt_update()."""
+    data = crc ^ byte
+    for _ in range(8):
+        data = ((data << 1) ^ 0x07) if data & 0x80 else (data << 1)
+    return data & 0xFF
+
+
+def firmware_record_count():
+    with open(os.path.join(ROOT, "history.h")) as f:
+        m = re.search(r"#define HISTORY_RECORD_COUNT (\d+)", f.read())
+    return int(m.group(1))
+
+
+def read_ihex(path):
+    """Return the data of an Intel HEX file as a bytearray indexed by
+    address."""
+    data = bytearray()
+    base = 0
+    with open(path) as f:
+        for line in f:
+            line = line.strip()
+            if not line.startswith(":"):
+                continue
+            raw = bytes.fromhex(line[1:])
+            length, addr, kind = raw[0], (raw[1] << 8) | raw[2], raw[3]
+            payload = raw[4:4 + length]
+            if kind == 0:
+                addr += base
+                if len(data) < addr + length:
+                    data.extend(b"\xff" * (addr + length - len(data)))
+                data[addr:addr + length] = payload
+            elif kind == 2:
+                base = ((payload[0] << 8) | payload[1]) << 4
+            elif kind == 4:
+                base = ((payload[0] << 8) | payload[1]) << 16
+            elif kind == 1:
+                break
+    return data
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("dump", help="Intel HEX dump of the EEPROM")
+    parser.add_argument("--offset", type=lambda v: int(v, 0), required=True,
+                        help="EEPROM address of HISTORY_RECORDS (avr-nm)")
+    args = parser.parse_args()
+
+    count = firmware_record_count()
+    data = read_ihex(args.dump)
+
+    # avr-nm reports EEPROM symbols in the 0x810000 address space.
+    offset = args.offset & 0xFFFF
+    if len(data) < offset + count * RECORD.size:
+        sys.exit("dump does not cover the history ring")
+
+    records = []
+    for i in range(count):
+        raw = data[offset + i * RECORD.size:offset + (i + 1) * RECORD.size]
+        seq, cycle, flags, on_time_ds, crc = RECORD.unpack(raw)
+
+        check = 0
+        for b in raw[:-1]:
+            check = crc8_ccitt_update(check, b)
+        if crc != check or cycle in (0, 0xFFFF):
+            continue
+        records.append((seq, cycle, flags, on_time_ds))
+
+    if not records:
+        print("no records")
+        return
+
+    # Order by sequence number relative to the newest, as the firmware does.
+    newest = records[0][0]
+    for r in records:
+        if ((r[0] - newest) & 0xFF) < 0x80:
+            newest = r[0]
+    records.sort(key=lambda r: (newest - r[0]) & 0xFF, reverse=True)
+
+    print(f"{'cycle':>6} {'pump':>4} {'on (s)':>8}  events")
+    for _, cycle, flags, on_time_ds in records:
+        events = []
+        if flags & (1 << 1):
+            events.append("skipped (overflow)")
+        if flags & (1 << 2):
+            events.append("stopped (overflow)")
+        reset = flags >> 4
+        causes = [name for bit, name in RESET_CAUSES if reset & (1 << bit)]
+        if causes:
+            events.append("after " + "/".join(causes) + " reset")
+        pump = 1 + (flags & 1) + (2 if flags & (1 << 3) else 0)
+        print(f"{cycle:>6} {pump:>4} {on_time_ds / 10:>8.1f}  {', '.join(events)}")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,198 @@
+#!/usr/bin/env python3
+# Copyright 2024 Dominic Dwyer (dom@itsallbroken.com)
+#
+# Licensed under the Apache License, Version 2.0 (the "License"); you may not
+# use this file except in compliance with the License. You may obtain a copy of
+# the License at
+#
+#             http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+# WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+# License for the specific language governing permissions and limitations under
+# the License.
+
+"""Generate settings_provision.h, pre-loading settings into the EEPROM image.
+
+When settings_provision.h exists in the repository root, the build places the
+generated record in the first slot of the settings ring, and `make build`
+emits a main.eep that provisions a unit without training it by hand.
+
+The record layout (and CRCs) MUST match struct settings_slot in settings.c.
+"""
+
+import argparse
+import os
+import re
+import struct
+import sys
+
+# The struct settings layout this generator produces.
+SETTINGS_VERSION = 7
+
+# The struct settings_slot CRC-8 initial value (SETTINGS_CRC_SEED in settings.c).
+SLOT_CRC_SEED = 0xFF
+
+ROOT = os.path.join(os.path.dirname(os.path.abspath(__file__)), "..")
+
+
+def crc16_update(crc, byte):
+    """avr-libc _crc16_update()."""
+    crc ^= byte
+    for _ in range(8):
+        crc = (crc >> 1) ^ 0xA001 if crc & 1 else crc >> 1
+    return crc
+
+
+def crc8_ccitt_update(crc, byte):
+    """avr-libc _crc8_ccitt_update()."""
+    data = crc ^ byte
+    for _ in range(8):
+        data = ((data << 1) ^ 0x07) if data & 0x80 else (data << 1)
+    return data & 0xFF
+
+
+def firmware_settings_version():
+    with open(os.path.join(ROOT, "settings.h")) as f:
+        m = re.search(r"#define SETTINGS_VERSION (\d+)", f.read())
+    return int(m.group(1))
+
+
+def per_pump(values, name, count):
+    if len(values) == 1:
+        values = values * count
+    if len(values) != count:
+        sys.exit(f"{name}: expected 1 or {count} values")
+    return values
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("--channels", type=int, default=2, choices=range(1, 5),
+                        help="the channel count built with (make CHANNELS=n)")
+    parser.add_argument("--duration-ms", type=int, nargs="+", default=[5000],
+                        help="pump run duration(s) in milliseconds")
+    parser.add_argument("--interval-s", type=int, nargs="+", default=[86400],
+                        help="watering interval(s) in seconds")
+    parser.add_argument("--enabled", type=int, nargs="+", default=[1],
+                        help="1 to enable the pump(s), 0 to disable")
+    parser.add_argument("--duty", type=int, nargs="+", default=[255],
+                        help="PWM duty cycle(s) held while running (1-255)")
+    parser.add_argument("--ramp-ms", type=int, nargs="+", default=[200],
+                        help="soft-start ramp duration(s) in milliseconds, "
+                        "no longer than the run")
+    parser.add_argument("--adaptive", type=int, nargs="+", default=[0],
+                        help="1 to learn the run duration(s) from overflow")
+    parser.add_argument("--margin-pct", type=int, default=10,
+                        help="adaptive margin below the overflow point (%%)")
+    parser.add_argument("--concurrent", action="store_true",
+                        help="run all due pumps at once")
+    parser.add_argument("--stagger-ms", type=int, default=500,
+                        help="delay between starting each pump (concurrent)")
+    parser.add_argument("--supply-ref-mv", type=int, default=0,
+                        help="supply voltage the durations are for, scaling "
+                        "each run to the supply measured (0 to disable)")
+    parser.add_argument("--stall-mv", type=int, default=1000,
+                        help="supply voltage at which the pumps stall")
+    parser.add_argument("--bandgap-mv", type=int, default=1100,
+                        help="measured voltage of the internal bandgap")
+    parser.add_argument("--sense-div", type=int, default=11,
+                        help="pump rail divider ratio (SUPPLY_SENSE builds)")
+    parser.add_argument("--water-at", default=None, metavar="HH:MM",
+                        help="time of day to water at (RTC builds)")
+    parser.add_argument("-o", "--output",
+                        default=os.path.join(ROOT, "settings_provision.h"))
+    args = parser.parse_args()
+
+    if firmware_settings_version() != SETTINGS_VERSION:
+        sys.exit("settings.h SETTINGS_VERSION differs - update this generator")
+
+    durations = per_pump(args.duration_ms, "--duration-ms", args.channels)
+    intervals = per_pump(args.interval_s, "--interval-s", args.channels)
+    enabled = per_pump(args.enabled, "--enabled", args.channels)
+    duties = per_pump(args.duty, "--duty", args.channels)
+    ramps = per_pump(args.ramp_ms, "--ramp-ms", args.channels)
+    adaptive = per_pump(args.adaptive, "--adaptive", args.channels)
+
+    for d, i in zip(durations, intervals):
+        if not 0 <= d < (1 << 23) or not 0 < i < (1 << 20):
+            sys.exit("duration or interval out of range")
+    # settings.h SETTINGS_MAX_STAGGER_MS.
+    if not 0 <= args.stagger_ms <= 0xFFFF // args.channels:
+        sys.exit("stagger out of range")
+    for d, duty, r in zip(durations, duties, ramps):
+        if not 0 < duty <= 255 or not 0 <= r <= d:
+            sys.exit("duty or ramp out of range")
+    if not 0 <= args.margin_pct < 100:
+        sys.exit("margin out of range")
+    if (not 0 <= args.supply_ref_mv < (1 << 16)
+            or not 0 <= args.stall_mv < (1 << 16)):
+        sys.exit("supply voltage out of range")
+    if not 1000 <= args.bandgap_mv <= 1200:
+        sys.exit("bandgap out of range (1000-1200mV)")
+    if not 0 < args.sense_div <= 255:
+        sys.exit("sense divider out of range")
+
+    # SETTINGS_WATER_AT_NONE waters at the end of each interval.
+    water_at_min = 0xFFFF
+    if args.water_at is not None:
+        try:
+            hours, minutes = (int(v) for v in args.water_at.split(":"))
+        except ValueError:
+            sys.exit("time of day must be HH:MM")
+        if not 0 <= hours < 24 or not 0 <= minutes < 60:
+            sys.exit("time of day out of range")
+        water_at_min = hours * 60 + minutes
+
+    # struct settings, little-endian and packed as on the AVR.
+    body = struct.pack("<B", SETTINGS_VERSION)
+    pump_fields = [(d, i, 1 if e else 0, duty, r, 1 if a else 0)
+                   for d, i, e, duty, r, a in zip(durations, intervals, enabled,
+                                                  duties, ramps, adaptive)]
+    for fields in pump_fields:
+        body += struct.pack("<IIBBHB", *fields)
+    body += struct.pack("<BHB", 1 if args.concurrent else 0, args.stagger_ms,
+                        args.margin_pct)
+    body += struct.pack("<HHHB", args.supply_ref_mv, args.stall_mv,
+                        args.bandgap_mv, args.sense_div)
+    body += struct.pack("<H", water_at_min)
+
+    settings_crc = 0xFFFF
+    for b in body:
+        settings_crc = crc16_update(settings_crc, b)
+
+    # struct settings_slot wraps it with a sequence number and CRC-8.
+    seq = 1
+    slot = struct.pack("<B", seq) + body + struct.pack("<H", settings_crc)
+    slot_crc = SLOT_CRC_SEED
+    for b in slot:
+        slot_crc = crc8_ccitt_update(slot_crc, b)
+
+    pumps = ", ".join(
+        f"{{.on_duration_ms = {d}, .interval_seconds = {i}, "
+        f".enabled = {e}, .duty = {duty}, .ramp_ms = {r}, .adaptive = {a}}}"
+        for d, i, e, duty, r, a in pump_fields)
+
+    with open(args.output, "w") as f:
+        f.write("// Generated by tools/provision.py - do not edit.\n")
+        f.write("#define SETTINGS_PROVISION_SLOT \\\n")
+        f.write(f"  {{.seq = {seq}, \\\n")
+        f.write(f"   .settings = {{.version = {SETTINGS_VERSION}, \\\n")
+        f.write(f"                 .pumps = {{{pumps}}}, \\\n")
+        f.write(f"                 .concurrent = {int(args.concurrent)}, \\\n")
+        f.write(f"                 .stagger_ms = {args.stagger_ms}, \\\n")
+        f.write(f"                 .adapt_margin_pct = {args.margin_pct}, \\\n")
+        f.write("                 .supply_ref_mv = "
+                f"{args.supply_ref_mv}, \\\n")
+        f.write(f"                 .supply_stall_mv = {args.stall_mv}, \\\n")
+        f.write("                 .supply_bandgap_mv = "
+                f"{args.bandgap_mv}, \\\n")
+        f.write(f"                 .supply_sense_div = {args.sense_div}, \\\n")
+        f.write(f"                 .water_at_min = {water_at_min}, \\\n")
+        f.write(f"                 .crc = 0x{settings_crc:04x}}}, \\\n")
+        f.write(f"   .crc = 0x{slot_crc:02x}}}\n")
+
+
+if __name__ == "__main__":
+    main()
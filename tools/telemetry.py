@@ -0,0 +1,148 @@
+#!/usr/bin/env python3
+# Copyright 2024 Dominic Dwyer (dom@itsallbroken.com)
+#
+# Licensed under the Apache License, Version 2.0 (the "License"); you may not
+# use this file except in compliance with the License. You may obtain a copy of
+# the License at
+#
+#             http://www.apache.org/licenses/LICENSE-2.0
+#
+# Unless required by applicable law or agreed to in writing, software
+# distributed under the License is distributed on an "AS IS" BASIS, WITHOUT
+# WARRANTIES OR CONDITIONS OF ANY KIND, either express or implied. See the
+# License for the specific language governing permissions and limitations under
+# the License.
+
+"""Decode the telemetry frames sent by a `make TELEMETRY=1` build.
+
+Reads the raw bytes from a serial port (9615 baud 8N1, requires pyserial), or
+from a file captured by `./bench/bench main.elf <scenario> <file>` (or "-" for
+stdin), printing one line per frame.
+
+The frame format MUST match telemetry.h.
+"""
+
+import argparse
+import struct
+import sys
+
+SYNC = 0x7E
+BAUD = 9615
+
+# Frame type -> (name, payload format).
+FRAMES = {
+    0x01: ("events", "<B"),
+    0x02: ("wdt", "<I"),
+    0x03: ("pump", "<BB"),
+    0x04: ("profile", "<BHIII"),
+}
+
+# EVENT_STATE flags, from event.h (telemetry is only built with 2 channels).
+EVENT_FLAGS = [
+    (1 << 0, "BUTTON"),
+    (1 << 1, "BUTTON_SAMPLE"),
+    (1 << 2, "OVERFLOW"),
+    (1 << 3, "WDT_PUMP_1"),
+    (1 << 4, "WDT_PUMP_2"),
+    (1 << 5, "WDT_INTERVAL_1"),
+    (1 << 6, "WDT_INTERVAL_2"),
+    (1 << 7, "WDT_CHECKPOINT"),
+]
+
+# enum ProfileHook, from profile.h.
+PROFILE_HOOKS = [
+    "handle_event_button", "handle_event_button_sample",
+    "handle_event_overflow", "handle_event_pump",
+    "handle_event_watering_interval", "handle_event_checkpoint",
+    "handle_event_rtc_wake", "wdt_tick", "configure_sleep", "PCINT0_vect",
+    "TIM0_COMPA_vect", "TIM0_COMPB_vect",
+]
+
+# enum PumpState, from event_handler/watchdog.c.
+PUMP_STATES = ["idle", "waiting", "running", "flashing", "settling"]
+
+
+def crc8_ccitt_update(crc, byte):
+    """avr-libc _crc8_ccitt_update()."""
+    data = crc ^ byte
+    for _ in range(8):
+        data = ((data << 1) ^ 0x07) if data & 0x80 else (data << 1)
+    return data & 0xFF
+
+
+def describe(kind, values):
+    if kind == 0x01:
+        flags = values[0]
+        return "events " + " ".join(n for bit, n in EVENT_FLAGS if flags & bit)
+    if kind == 0x02:
+        return f"wdt    next timer in {values[0]}s"
+    if kind == 0x04:
+        hook, calls, lo, hi, total = values
+        name = PROFILE_HOOKS[hook] if hook < len(PROFILE_HOOKS) else str(hook)
+        mean = total // calls if calls else 0
+        return (f"prof   {name}: {calls} calls, cycles min {lo} mean {mean} "
+                f"max {hi}")
+    pump, state = values
+    name = PUMP_STATES[state] if state < len(PUMP_STATES) else str(state)
+    return f"pump   {pump + 1} -> {name}"
+
+
+def frames(stream):
+    """Yield (type, values) for each intact frame, resynchronising on
+    corruption."""
+    buf = bytearray()
+    while True:
+        chunk = stream.read(1)
+        if not chunk:
+            return
+        buf += chunk
+
+        while buf:
+            if buf[0] != SYNC:
+                del buf[0]
+                continue
+            if len(buf) < 2:
+                break
+            kind = buf[1]
+            if kind not in FRAMES:
+                del buf[0]
+                continue
+            fmt = FRAMES[kind][1]
+            size = 2 + struct.calcsize(fmt) + 1
+            if len(buf) < size:
+                break
+
+            crc = 0
+            for b in buf[1:size - 1]:
+                crc = crc8_ccitt_update(crc, b)
+            if crc != buf[size - 1]:
+                del buf[0]
+                continue
+
+            yield kind, struct.unpack(fmt, bytes(buf[2:size - 1]))
+            del buf[:size]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__)
+    parser.add_argument("source",
+                        help="serial port (e.g. /dev/ttyUSB0), file, or -")
+    args = parser.parse_args()
+
+    if args.source == "-":
+        stream = sys.stdin.buffer
+    elif args.source.startswith("/dev/"):
+        import serial
+        stream = serial.Serial(args.source, BAUD)
+    else:
+        stream = open(args.source, "rb")
+
+    try:
+        for kind, values in frames(stream):
+            print(describe(kind, values), flush=True)
+    except KeyboardInterrupt:
+        pass
+
+
+if __name__ == "__main__":
+    main()
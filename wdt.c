@@ -1,93 +1,537 @@
 #include "wdt.h"
 #include "event.h"
+#include "hal.h"
 #include "halt.h"
+#include "power.h"
+#include "profile.h"
+#include "rtc.h"
 #include <assert.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
 #include <avr/cpufunc.h>
 #include <avr/interrupt.h>
 #include <avr/wdt.h>
 #include <util/atomic.h>
 
 // Ref table Table 8-2 attiny13A datasheet.
-static const uint8_t WDT_1_SECOND = (1 << WDP2) | (1 << WDP1);
-static const uint8_t WDT_2_SECOND = (1 << WDP2) | (1 << WDP1) | (1 << WDP0);
-static const uint8_t WDT_4_SECOND = (1 << WDP3);
-static const uint8_t WDT_8_SECOND = (1 << WDP3) | (1 << WDP0);
+#define WDT_16_MS 0
+#define WDT_32_MS (1 << WDP0)
+#define WDT_64_MS (1 << WDP1)
+#define WDT_125_MS ((1 << WDP1) | (1 << WDP0))
+#define WDT_250_MS (1 << WDP2)
+#define WDT_500_MS ((1 << WDP2) | (1 << WDP0))
+#define WDT_1_SECOND ((1 << WDP2) | (1 << WDP1))
+#define WDT_2_SECOND ((1 << WDP2) | (1 << WDP1) | (1 << WDP0))
+#define WDT_4_SECOND (1 << WDP3)
+#define WDT_8_SECOND ((1 << WDP3) | (1 << WDP0))
 
-/// @brief The duration of time to count down before emitting EVENT_STATE_WDT.
-static volatile uint32_t WDT_SLEEP_REMAINING_SECONDS = 0;
+/// The WDT interval masks, each double the duration of the previous.
+///
+/// The full prescaler range is used, allowing deadlines to be met to within
+/// half of the shortest (16ms) interval.
+static const uint8_t WDT_INTERVAL_MASKS[] = {
+    WDT_16_MS,  WDT_32_MS,    WDT_64_MS,    WDT_125_MS,   WDT_250_MS,
+    WDT_500_MS, WDT_1_SECOND, WDT_2_SECOND, WDT_4_SECOND, WDT_8_SECOND};
+
+#define WDT_INTERVAL_COUNT                                                     \
+  (sizeof(WDT_INTERVAL_MASKS) / sizeof(WDT_INTERVAL_MASKS[0]))
 
-/// @brief The duration of time the current WDT sleep shall last.
+/// Durations are tracked in fixed-point seconds with this many fractional bits.
+///
+/// The calibrated interval durations are rounded to this resolution, and the
+/// rounding error accumulates on the uptime clock with every interrupt - at 16
+/// bits it amounts to less than 0.1s a day.
+#define WDT_FIXED_SHIFT 16
+#define WDT_FIXED_ONE ((uint32_t)1 << WDT_FIXED_SHIFT)
+
+/// Calibration counts timer 1 ticks at F_CPU/8 (1us) across one 64ms WDT
+/// period (the interval at this index of WDT_INTERVAL_MASKS) - resolving the
+/// oscillator to +/-8ppm, less than a second a day.
+#define WDT_CAL_INTERVAL 2
+#define WDT_CAL_TIMER_HZ (F_CPU / 8)
+
+/// The number of timer ticks in the calibration period with a nominal 128kHz
+/// WDT oscillator.
+#define WDT_CAL_NOMINAL_COUNTS                                                 \
+  (WDT_CAL_TIMER_HZ * (16 << WDT_CAL_INTERVAL) / 1000)
+
+/// Measurements deviating from WDT_CAL_NOMINAL_COUNTS by more than 1/4 are
+/// considered invalid and discarded.
+#define WDT_CAL_MIN_COUNTS (WDT_CAL_NOMINAL_COUNTS - WDT_CAL_NOMINAL_COUNTS / 4)
+#define WDT_CAL_MAX_COUNTS (WDT_CAL_NOMINAL_COUNTS + WDT_CAL_NOMINAL_COUNTS / 4)
+
+/// The calibration period in half ticks, shifted left by the index of an
+/// interval, is the duration of that interval in 1/WDT_CAL_UNITS_HZ seconds.
+#define WDT_CAL_UNITS_HZ ((uint32_t)WDT_CAL_TIMER_HZ * 2 << WDT_CAL_INTERVAL)
+
+// Converting these units into fixed-point seconds multiplies by
+// (1 << WDT_FIXED_SHIFT) / WDT_CAL_UNITS_HZ, which is reduced by a common
+// factor of 512.
+_Static_assert(WDT_CAL_UNITS_HZ % 512 == 0);
+_Static_assert(WDT_CAL_NOMINAL_COUNTS == 64000);
+
+/// The maximum number of concurrently armed timers - the interval & FSM timers
+/// of every channel, and the schedule checkpoint.
+#define WDT_TIMER_CAPACITY (2 * CHANNEL_COUNT + 1)
+
+/// @brief A point on the uptime clock: whole seconds, and the fraction of a
+/// second in fixed-point (less than WDT_FIXED_ONE).
+struct wdt_time {
+  uint32_t seconds;
+  uint16_t fraction;
+};
+_Static_assert(WDT_FIXED_SHIFT == 16);
+
+/// @brief A timer, emitting event once the uptime clock reaches deadline.
+struct wdt_timer {
+  struct wdt_time deadline;
+  /// The event flag to set on expiry, or 0 if this slot is free.
+  event_flags_t event;
+};
+
+/// @brief The fixed-capacity set of armed timers.
+///
+/// The WDT is always programmed for the interval closest to (but not exceeding)
+/// the nearest deadline across all armed timers.
+static volatile struct wdt_timer WDT_TIMERS[WDT_TIMER_CAPACITY];
+
+/// @brief The time elapsed since the WDT was first started, advanced by each
+/// WDT interrupt.
+///
+/// Deadlines are absolute points on this clock, so the time taken to handle an
+/// event never delays the deadlines that follow it.
+static volatile struct wdt_time UPTIME;
+
+/// @brief The duration of time the current WDT sleep shall last, in fixed-point
+/// seconds.
 ///
 /// After the WTD interrupt fires, this duration of time has elapsed.
-static volatile uint8_t WDT_THIS_SLEEP_SECONDS = 0;
+static volatile uint32_t WDT_THIS_SLEEP = 0;
+
+/// The index into WDT_INTERVAL_MASKS the WDT is programmed for, or
+/// WDT_INTERVAL_COUNT if stopped.
+static volatile uint8_t WDT_INTERVAL = WDT_INTERVAL_COUNT;
+
+/// The number of WDT interrupts (each WDT_THIS_SLEEP apart) before the nearest
+/// deadline must be re-evaluated.
+static volatile uint8_t WDT_SLEEPS_LEFT = 0;
+
+/// True if the MCU has slept since the WDT interval in progress started (see
+/// interval_elapsed()).
+static volatile bool WDT_SLEPT = false;
+
+/// @brief The measured duration of each interval in WDT_INTERVAL_MASKS, in
+/// fixed-point seconds.
+///
+/// Defaults to the nominal durations until wdt_calibrate() is called.
+static volatile uint32_t WDT_INTERVAL_DURATIONS[WDT_INTERVAL_COUNT];
 
-static void configure_sleep();
-static uint8_t maximal_interval_mask(uint8_t duration_seconds);
-static uint8_t interval_mask_to_seconds(uint8_t interval_mask);
+static void configure_sleep(bool restart);
+static void program_interval(uint8_t interval);
+static void timer_arm(event_flags_t event, struct wdt_time deadline);
+static uint8_t maximal_interval(uint32_t duration);
+static void set_interval_durations(uint32_t half_ticks);
+static void uptime_advance(uint32_t elapsed);
 
 /// @brief Process a WDT interrupt.
 ///
 /// This MUST be called from an interrupt context in response to all WDT
 /// interrupts.
+///
+/// Only the uptime clock is advanced on most interrupts - the WDT keeps
+/// running at the same interval until the nearest deadline is close enough to
+/// need a shorter one (or to expire).
 inline void wdt_tick() {
-  // Otherwise adjust the countdown timer, taking care to avoid an overflow by
-  // perform a saturating subtraction.
-  if ((uint8_t)WDT_SLEEP_REMAINING_SECONDS >= WDT_THIS_SLEEP_SECONDS) {
-    WDT_SLEEP_REMAINING_SECONDS -= WDT_THIS_SLEEP_SECONDS;
-  } else {
-    WDT_SLEEP_REMAINING_SECONDS = 0;
+  PROFILE_BEGIN(profile);
+
+  uptime_advance(WDT_THIS_SLEEP);
+  WDT_SLEPT = false;
+
+  if (--WDT_SLEEPS_LEFT == 0) {
+    configure_sleep(false);
   }
 
-  configure_sleep();
+  PROFILE_END(Profile_WdtTick, profile);
 }
 
-/// @brief Configure the WDT to cause an EVENT_STATE_WDT to be emitted after the
-/// configured duration, replacing any existing WDT sleep countdown.
-/// @param duration_seconds Approximate number of seconds in the future to set
-/// the EVENT_STATE_WDT flag.
+/// @brief Advance the uptime clock by elapsed fixed-point seconds.
 ///
-/// Always enables interrupts before returning.
-void wdt_sleep_seconds(uint32_t duration_seconds) {
+/// MUST be called while interrupts are disabled.
+static void uptime_advance(uint32_t elapsed) {
+  uint32_t fraction = UPTIME.fraction + elapsed;
+  UPTIME.seconds += (uint16_t)(fraction >> WDT_FIXED_SHIFT);
+  UPTIME.fraction = fraction;
+}
+
+/// @brief Return the fixed-point part of the WDT interval in progress already
+/// elapsed, which the uptime clock is yet to be advanced by.
+///
+/// Negligible if the interval started since the MCU last slept - otherwise an
+/// interrupt other than the WDT's woke the MCU at an unknown point of it, taken
+/// as half way.
+///
+/// MUST be called while interrupts are disabled.
+static uint32_t interval_elapsed() {
+  if (WDT_INTERVAL == WDT_INTERVAL_COUNT || !WDT_SLEPT) {
+    return 0;
+  }
+  return WDT_THIS_SLEEP / 2;
+}
+
+/// @brief Return the fixed-point duration from the current uptime until
+/// deadline, 0 if it has passed, or UINT32_MAX if it does not fit.
+///
+/// MUST be called while interrupts are disabled.
+static uint32_t until(volatile const struct wdt_time *deadline) {
+  uint32_t seconds = deadline->seconds - UPTIME.seconds;
+  if (deadline->seconds < UPTIME.seconds ||
+      (seconds == 0 && deadline->fraction <= UPTIME.fraction)) {
+    return 0;
+  }
+  if (seconds >= (UINT32_MAX >> WDT_FIXED_SHIFT)) {
+    return UINT32_MAX;
+  }
+  return (seconds << WDT_FIXED_SHIFT) + deadline->fraction - UPTIME.fraction;
+}
+
+/// @brief Return the uptime after the fixed-point duration.
+///
+/// MUST be called while interrupts are disabled.
+static struct wdt_time uptime_after(uint32_t duration) {
+  uint32_t fraction = UPTIME.fraction + (duration & (WDT_FIXED_ONE - 1));
+  return (struct wdt_time){
+      .seconds = UPTIME.seconds + (duration >> WDT_FIXED_SHIFT) +
+                 (fraction >> WDT_FIXED_SHIFT),
+      .fraction = fraction,
+  };
+}
+
+/// @brief Measure the real duration of the WDT intervals against the system
+/// clock, correcting all subsequent countdowns for oscillator drift.
+///
+/// Busy-waits for up to two 64ms WDT periods with interrupts disabled, after
+/// which the WDT is re-programmed for any armed timers. The uptime clock is
+/// credited with the part of the WDT interval in progress when it started (see
+/// interval_elapsed()) and the expected duration of the calibration.
+void wdt_calibrate() {
+  uint32_t counts = 0;
+
+  power_acquire(POWER_TIMER1_CALIBRATE);
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    uptime_advance(interval_elapsed());
+
+    // Run the WDT in interrupt mode at the calibration interval, without
+    // servicing the interrupt - restarting the count first, as switching to a
+    // shorter interval past its timeout expires it at once (a partial period
+    // the synchronisation below would mistake for a whole one).
+    wdt_reset();
+    hal_write(WDTCR, WDTCR | (1 << WDCE) | (1 << WDE));
+    hal_write(WDTCR, (1 << WDIF) | (1 << WDIE) |
+                         WDT_INTERVAL_MASKS[WDT_CAL_INTERVAL]);
+
+    // Synchronise with the first timeout to skip any oscillator start-up
+    // delay and the unknown phase of the WDT counter.
+    loop_until_bit_is_set(WDTCR, WDIF);
+
+    // Start counting from a whole tick, resetting the prescaler.
+    TCNT1 = 0;
+    hal_write(TIFR, 1 << TOV1);
+    GTCCR |= (1 << PSR1);
+    TCCR1 = (1 << CS12); // Pre-scaler: DIV8
+    hal_write(WDTCR, WDTCR | (1 << WDIF));
+
+    // Count timer ticks (and overflows of the 8-bit timer) until the next
+    // timeout.
+    uint16_t overflows = 0;
+    while (bit_is_clear(WDTCR, WDIF)) {
+      if (bit_is_set(TIFR, TOV1)) {
+        hal_write(TIFR, 1 << TOV1);
+        overflows++;
+      }
+    }
+
+    TCCR1 = 0;
+    uint8_t count = TCNT1;
+
+    // Account for an overflow that raced with the WDT timeout.
+    if (bit_is_set(TIFR, TOV1) && count < 128) {
+      overflows++;
+    }
+    counts = ((uint32_t)overflows << 8) | count;
+
+    // Disable the watchdog and clear the pending interrupt.
+    hal_write(WDTCR, WDTCR | (1 << WDCE) | (1 << WDE));
+    hal_write(WDTCR, 1 << WDIF);
+    WDT_INTERVAL = WDT_INTERVAL_COUNT;
+  }
+
+  power_release(POWER_TIMER1_CALIBRATE);
+
+  // Hand timer 1 back to the profiling clock, if built with it.
+  profile_init();
+
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    // The counter truncates the period to the last whole tick - the period
+    // lies half a tick beyond it, on average.
+    if (counts >= WDT_CAL_MIN_COUNTS && counts <= WDT_CAL_MAX_COUNTS) {
+      set_interval_durations(2 * counts + 1);
+    } else if (WDT_INTERVAL_DURATIONS[0] == 0) {
+      set_interval_durations(2 * WDT_CAL_NOMINAL_COUNTS);
+    }
+
+    // The calibration lasted the measured period, plus half a period (on
+    // average) synchronising with the first timeout.
+    uint32_t period = WDT_INTERVAL_DURATIONS[WDT_CAL_INTERVAL];
+    uptime_advance(period + period / 2);
+
+    // Resume the countdown of any armed timers.
+    configure_sleep(true);
+  }
+}
+
+/// @brief Arm a timer to emit event once the uptime clock reaches deadline,
+/// replacing any timer already armed for the same event.
+/// @param event The event flag to set on expiry, identifying the timer.
+/// @param deadline The time to set the event flag - if already passed, the
+/// flag is set immediately.
+///
+/// Re-programming the WDT restarts the current interval - the uptime clock is
+/// first credited with the part of it already elapsed (see
+/// interval_elapsed()). This is avoided altogether for a deadline no nearer
+/// than the end of the current sleep, which picks it up as it ends.
+///
+/// Halts if more than WDT_TIMER_CAPACITY timers are armed.
+///
+/// MUST be called while interrupts are disabled.
+static void timer_arm(event_flags_t event, struct wdt_time deadline) {
+  // Lazily initialise the interval durations if never calibrated.
+  if (WDT_INTERVAL_DURATIONS[0] == 0) {
+    set_interval_durations(2 * WDT_CAL_NOMINAL_COUNTS);
+  }
+
+  // Prefer the slot already holding this event, falling back to a free one.
+  volatile struct wdt_timer *slot = NULL;
+  for (uint8_t i = 0; i < WDT_TIMER_CAPACITY; i++) {
+    volatile struct wdt_timer *t = &WDT_TIMERS[i];
+    if (t->event == event) {
+      slot = t;
+      break;
+    }
+    if (t->event == 0 && slot == NULL) {
+      slot = t;
+    }
+  }
+  ASSERT(slot != NULL);
+
+  slot->event = event;
+  slot->deadline.seconds = deadline.seconds;
+  slot->deadline.fraction = deadline.fraction;
+
+  if (WDT_INTERVAL < WDT_INTERVAL_COUNT &&
+      until(&slot->deadline) >= WDT_THIS_SLEEP * WDT_SLEEPS_LEFT) {
+    return;
+  }
+
+  // Configure the watchdog to sleep until the nearest deadline.
+  uptime_advance(interval_elapsed());
+  configure_sleep(true);
+}
+
+/// @brief Arm a timer to emit event at uptime second at_seconds.
+/// @see timer_arm()
+void wdt_timer_at(event_flags_t event, uint32_t at_seconds) {
+  ATOMIC_BLOCK(ATOMIC_FORCEON) {
+    timer_arm(event, (struct wdt_time){.seconds = at_seconds, .fraction = 0});
+  }
+}
+
+/// @brief Arm a timer to emit event after duration_ms milliseconds, from the
+/// uptime clock plus the part of the WDT interval in progress already elapsed.
+/// @see timer_arm()
+void wdt_timer_arm_ms(event_flags_t event, uint32_t duration_ms) {
+  // Converting milliseconds to fixed-point seconds multiplies by
+  // (1 << WDT_FIXED_SHIFT) / 1000, reduced by a common factor of 8 - the whole
+  // seconds are split off to keep the intermediate value within 32 bits.
+  uint32_t ms = duration_ms % 1000;
+  uint32_t duration = ((duration_ms / 1000) << WDT_FIXED_SHIFT) +
+                      (ms * (WDT_FIXED_ONE / 8) + 62) / 125;
+
   ATOMIC_BLOCK(ATOMIC_FORCEON) {
-    // This sleep will last this long, woken at the maximal interval
-    WDT_SLEEP_REMAINING_SECONDS = duration_seconds;
-    // Configure the watchdog to sleep.
-    configure_sleep();
+    timer_arm(event, uptime_after(interval_elapsed() + duration));
+  }
+}
+
+/// @brief Disarm the timer for event, if armed.
+///
+/// The WDT is not re-programmed, so a wake-up for the cancelled deadline may
+/// still occur, after which the WDT is programmed for the remaining timers.
+void wdt_timer_cancel(event_flags_t event) {
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    for (uint8_t i = 0; i < WDT_TIMER_CAPACITY; i++) {
+      if (WDT_TIMERS[i].event == event) {
+        WDT_TIMERS[i].event = 0;
+      }
+    }
+  }
+}
+
+/// @brief Return the fixed-point fraction of a second in milliseconds.
+static uint16_t fraction_ms(uint16_t fraction) {
+  // The inverse of the conversion in wdt_timer_arm_ms(), multiplying by
+  // 1000 / (1 << WDT_FIXED_SHIFT) with rounding.
+  return ((uint32_t)fraction * 125 + WDT_FIXED_ONE / 16) / (WDT_FIXED_ONE / 8);
+}
+
+/// @brief Return the milliseconds until the timer for event expires, or 0 if
+/// not armed.
+///
+/// The uptime clock is only advanced as each WDT interval completes - the part
+/// of the interval in progress already elapsed is estimated (see
+/// interval_elapsed()), resolving the result to half the current interval.
+uint32_t wdt_timer_remaining_ms(event_flags_t event) {
+  uint32_t remaining = 0;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    for (uint8_t i = 0; i < WDT_TIMER_CAPACITY; i++) {
+      if (WDT_TIMERS[i].event != event) {
+        continue;
+      }
+      remaining = until(&WDT_TIMERS[i].deadline);
+      uint32_t elapsed = interval_elapsed();
+      remaining = remaining > elapsed ? remaining - elapsed : 0;
+    }
+  }
+
+  return (remaining >> WDT_FIXED_SHIFT) * 1000 + fraction_ms(remaining);
+}
+
+/// @brief Return the approximate number of seconds until the nearest armed
+/// deadline, or 0 if no timers are armed.
+uint32_t wdt_timer_next_expiry() {
+  uint32_t next = 0;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    for (uint8_t i = 0; i < WDT_TIMER_CAPACITY; i++) {
+      volatile struct wdt_timer *t = &WDT_TIMERS[i];
+      if (t->event == 0) {
+        continue;
+      }
+      uint32_t remaining = until(&t->deadline);
+      if (next == 0 || remaining < next) {
+        next = remaining;
+      }
+    }
+  }
+
+  // Round up to whole seconds, so an armed timer never reports 0.
+  if (next > UINT32_MAX - (WDT_FIXED_ONE - 1)) {
+    return UINT32_MAX >> WDT_FIXED_SHIFT;
+  }
+  return (next + WDT_FIXED_ONE - 1) >> WDT_FIXED_SHIFT;
+}
+
+void wdt_sleep() { WDT_SLEPT = true; }
+
+/// @brief Return the whole seconds elapsed on the uptime clock, including the
+/// part of the WDT interval in progress already elapsed.
+uint32_t wdt_uptime() {
+  uint32_t seconds;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
+    seconds = uptime_after(interval_elapsed()).seconds;
   }
+  return seconds;
+}
+
+/// @brief Return the milliseconds elapsed on the uptime clock, wrapping.
+/// @see wdt_uptime()
+uint32_t wdt_uptime_ms() {
+  struct wdt_time now;
+  ATOMIC_BLOCK(ATOMIC_RESTORESTATE) { now = uptime_after(interval_elapsed()); }
+  return now.seconds * 1000 + fraction_ms(now.fraction);
 }
 
-/// @brief Disable the watchdog timer, and clear any pending interrupts for it.
+/// @brief Disarm all timers, and clear any pending event for them.
+///
+/// The WDT keeps running to advance the uptime clock.
 void wdt_cancel() {
   ATOMIC_BLOCK(ATOMIC_RESTORESTATE) {
-    WDTCR |= (1 << WDCE) | (1 << WDE);
-    WDTCR = 0;
+    for (uint8_t i = 0; i < WDT_TIMER_CAPACITY; i++) {
+      WDT_TIMERS[i].event = 0;
+    }
   }
 }
 
-/// @brief Configure the WDT interrupt for the maximal interval until
-/// WDT_SLEEP_REMAINING_SECONDS.
+/// @brief Configure the WDT interrupt for the maximal interval until the
+/// nearest armed deadline.
+/// @param restart True to restart the WDT counter even if the interval is
+/// unchanged, timing the interval from now rather than from the last
+/// interrupt.
 ///
-/// Disables the WDT if WDT_SLEEP_REMAINING_SECONDS == 0 to prevent spurious
-/// wakeups and immediately sets the EVENT_STATE_WDT flag.
+/// Timers with less than half of the shortest interval remaining are expired,
+/// setting their event flag. If no timers remain armed the WDT runs at the
+/// longest interval, only advancing the uptime clock.
 ///
 /// MUST be called while interrupts are disabled.
-static void configure_sleep() {
-  // If there's nothing to sleep for, immediately emit the event and return.
-  //
-  // This prevents an invalid mask being used after this conditional.
-  if (WDT_SLEEP_REMAINING_SECONDS == 0) {
-    // Disable the watchdog interrupt when no sleep is required.
-    WDTCR |= (1 << WDCE) | (1 << WDE);
-    WDTCR = 0;
+static void configure_sleep(bool restart) {
+  PROFILE_BEGIN(profile);
+  uint32_t nearest = UINT32_MAX;
 
-    event_flag_set(EVENT_STATE_WDT);
-    return;
+  for (uint8_t i = 0; i < WDT_TIMER_CAPACITY; i++) {
+    volatile struct wdt_timer *t = &WDT_TIMERS[i];
+    if (t->event == 0) {
+      continue;
+    }
+
+    // If there's nothing left to sleep for, emit the event and free the slot.
+    //
+    // The countdown is rounded to the nearest interval, so this fires at most
+    // half the shortest interval early.
+    uint32_t remaining = until(&t->deadline);
+    if (remaining < WDT_INTERVAL_DURATIONS[0] / 2) {
+      event_flag_set(t->event);
+      t->event = 0;
+      continue;
+    }
+
+    if (remaining < nearest) {
+      nearest = remaining;
+    }
   }
 
-  // Select the maximal sleep interval mask for the remaining duration.
-  uint8_t interval_mask = maximal_interval_mask(WDT_SLEEP_REMAINING_SECONDS);
+  // Select the maximal sleep interval for the nearest deadline.
+  uint8_t interval = maximal_interval(nearest);
 
-  WDT_THIS_SLEEP_SECONDS = interval_mask_to_seconds(interval_mask);
+  // Below the longest interval the nearest deadline is less than two intervals
+  // away, and is re-evaluated after each - at the longest, it is re-evaluated
+  // once it is less than two intervals away.
+  uint32_t sleeps = 1;
+  if (interval == WDT_INTERVAL_COUNT - 1) {
+    sleeps = nearest / WDT_INTERVAL_DURATIONS[interval];
+    if (sleeps > UINT8_MAX) {
+      sleeps = UINT8_MAX;
+    }
+  }
+  WDT_SLEEPS_LEFT = sleeps;
+
+  if (restart || interval != WDT_INTERVAL) {
+    program_interval(interval);
+  }
+
+  PROFILE_END(Profile_ConfigureSleep, profile);
+}
+
+/// @brief Program the WDT for the interval at index interval of
+/// WDT_INTERVAL_MASKS, timed from now.
+///
+/// MUST be called while interrupts are disabled.
+static void program_interval(uint8_t interval) {
+  WDT_INTERVAL = interval;
+  WDT_THIS_SLEEP = WDT_INTERVAL_DURATIONS[interval];
+  WDT_SLEPT = false;
+
+  // Restart the WDT counter so the selected interval is timed from now,
+  // regardless of how far through the previous interval it had counted.
+  wdt_reset();
 
   // The sequence for clearing WDE and changing time-out configuration is as
   // follows:
@@ -95,7 +539,7 @@ static void configure_sleep() {
   //     1. In the same operation, write a logic one to the Watchdog change
   //     enable bit (WDCE) and WDE. A logic one must be written to WDE
   //     regardless of the previous value of the WDE bit.
-  WDTCR |= (1 << WDCE) | (1 << WDE);
+  hal_write(WDTCR, WDTCR | (1 << WDCE) | (1 << WDE));
 
   //     2. Within the next four clock cycles, write the WDE and Watchdog
   //     prescaler bits (WDP) as desired, but with the WDCE bit cleared.
@@ -103,48 +547,172 @@ static void configure_sleep() {
 
   // Disable the watchdog reset by clearing the WDE bit set above, and enable
   // the watchdog interrupt by setting WDTIE.
-  WDTCR = (1 << WDIE) | interval_mask;
+  hal_write(WDTCR, (1 << WDIE) | WDT_INTERVAL_MASKS[interval]);
 }
 
-/// @brief Return the largest WDT sleep interval that is less than or equal to
-/// duration_seconds.
-/// @param duration_seconds The number of seconds the caller would like to
-/// sleep for.
-/// @return The WDTCR duration bitmask.
-static inline uint8_t maximal_interval_mask(uint8_t duration_seconds) {
-  // Note the input truncates the u32 to a u8, which covers the full range of
-  // the interval masks while saving a few bytes.
+/// @brief Return the index of the largest WDT sleep interval in
+/// WDT_INTERVAL_MASKS that is less than or equal to duration, or the shortest
+/// interval if none are.
+/// @param duration The fixed-point duration the caller would like to sleep
+/// for.
+/// @return An index into WDT_INTERVAL_MASKS and WDT_INTERVAL_DURATIONS.
+static inline uint8_t maximal_interval(uint32_t duration) {
+  uint8_t i = WDT_INTERVAL_COUNT - 1;
+  while (i > 0 && WDT_INTERVAL_DURATIONS[i] > duration) {
+    i--;
+  }
+  return i;
+}
 
-  if (duration_seconds >= 8) {
-    return WDT_8_SECOND;
+/// @brief Derive the fixed-point duration of each WDT interval from the
+/// calibration period, measured in half timer ticks.
+///
+/// MUST be called while interrupts are disabled.
+static void set_interval_durations(uint32_t half_ticks) {
+  for (uint8_t i = 0; i < WDT_INTERVAL_COUNT; i++) {
+    uint32_t units = half_ticks << i;
+    // Split off the whole seconds to keep the intermediate value within 32
+    // bits.
+    uint32_t whole = units / WDT_CAL_UNITS_HZ;
+    uint32_t part = units % WDT_CAL_UNITS_HZ;
+    WDT_INTERVAL_DURATIONS[i] =
+        (whole << WDT_FIXED_SHIFT) +
+        (part * (WDT_FIXED_ONE / 512) + WDT_CAL_UNITS_HZ / 1024) /
+            (WDT_CAL_UNITS_HZ / 512);
   }
-  if (duration_seconds >= 4) {
-    return WDT_4_SECOND;
+}
+
+#ifdef RTC
+
+/// True while the RTC answers on the bus - cleared on any bus error, leaving
+/// the WDT to time every sleep.
+static bool RTC_PRESENT = false;
+
+/// True if the RTC held the time of day at boot (its oscillator never stopped
+/// since it was set).
+static bool RTC_TIME_SET = false;
+
+/// The RTC time at uptime zero - the RTC seconds less the uptime seconds.
+static uint32_t RTC_OFFSET;
+
+/// True while the WDT is stopped, waiting for the RTC alarm.
+static volatile bool SUSPENDED = false;
+
+void wdt_rtc_init() {
+  uint32_t now;
+  RTC_PRESENT = rtc_init(&RTC_TIME_SET) && rtc_now(&now);
+  if (RTC_PRESENT) {
+    RTC_OFFSET = now - wdt_uptime();
+  } else {
+    RTC_TIME_SET = false;
   }
-  if (duration_seconds >= 2) {
-    return WDT_2_SECOND;
+}
+
+void wdt_suspend() {
+  // Another interrupt (a profiling clock overflow) woke the MCU while
+  // suspended - the alarm is still armed, and re-arming it would raise the
+  // next.
+  if (SUSPENDED) {
+    return;
+  }
+
+  // The debounce & PWM timers wake the MCU far more often than the minimum
+  // suspension - and idling keeps the WDT running regardless.
+  if (!RTC_PRESENT || (power_users() & POWER_IDLE_USERS) != 0) {
+    return;
   }
-  if (duration_seconds >= 1) {
-    return WDT_1_SECOND;
+
+  volatile struct wdt_timer *next = NULL;
+  uint32_t nearest = UINT32_MAX;
+  for (uint8_t i = 0; i < WDT_TIMER_CAPACITY; i++) {
+    volatile struct wdt_timer *t = &WDT_TIMERS[i];
+    if (t->event == 0) {
+      continue;
+    }
+    uint32_t remaining = until(&t->deadline);
+    if (next == NULL || remaining < nearest) {
+      next = t;
+      nearest = remaining;
+    }
+  }
+  if (next != NULL &&
+      nearest < ((uint32_t)WDT_SUSPEND_MIN_SECONDS << WDT_FIXED_SHIFT)) {
+    return;
   }
 
-  halt();
+  uint32_t now;
+  if (!rtc_now(&now)) {
+    RTC_PRESENT = false;
+    return;
+  }
+
+  // Wake at the nearest deadline in whole RTC seconds, rounded up so it has
+  // passed by the time the uptime clock is advanced to the RTC time.
+  uint32_t alarm = now + WDT_SUSPEND_MAX_SECONDS;
+  if (next != NULL) {
+    uint32_t at = next->deadline.seconds + (next->deadline.fraction != 0) +
+                  RTC_OFFSET;
+    if ((int32_t)(at - now) < WDT_SUSPEND_MIN_SECONDS) {
+      return;
+    }
+    if ((int32_t)(at - alarm) < 0) {
+      alarm = at;
+    }
+  }
+
+  if (!rtc_alarm_at(alarm)) {
+    RTC_PRESENT = false;
+    return;
+  }
+
+  // Stop the watchdog, and clear any interrupt it raised in the meantime -
+  // the part of the interval in progress is made up by wdt_resume().
+  wdt_reset();
+  hal_write(WDTCR, WDTCR | (1 << WDCE) | (1 << WDE));
+  hal_write(WDTCR, 1 << WDIF);
+  WDT_INTERVAL = WDT_INTERVAL_COUNT;
+
+  SUSPENDED = true;
+}
+
+bool wdt_suspended() { return SUSPENDED; }
+
+bool wdt_resume() {
+  bool fired = false;
+
+  ATOMIC_BLOCK(ATOMIC_FORCEON) {
+    SUSPENDED = false;
+
+    uint32_t now;
+    if (rtc_alarm_take(&fired) && rtc_now(&now)) {
+      // Never step the uptime clock backwards, should the WDT have run fast
+      // while awake.
+      uint32_t seconds = now - RTC_OFFSET;
+      if ((int32_t)(seconds - UPTIME.seconds) > 0) {
+        UPTIME.seconds = seconds;
+        UPTIME.fraction = 0;
+      }
+    } else {
+      // The time asleep is lost, but the timers still expire - late.
+      RTC_PRESENT = false;
+    }
+
+    // Drop the pin change of the alarm line being released.
+    hal_write(GIFR, 1 << PCIF);
+
+    // Expire the timers now due, and time the rest with the WDT.
+    configure_sleep(true);
+  }
+
+  return fired;
 }
 
-/// @brief Convert the WDTCR duration bitmask to the number of seconds it sleeps
-/// @param interval_mask The WDTCR duration bitmask.
-/// @return The number of seconds the bitmask configures the watchdog to sleep.
-static inline uint8_t interval_mask_to_seconds(uint8_t interval_mask) {
-  switch (interval_mask) {
-  case WDT_1_SECOND:
-    return 1;
-  case WDT_2_SECOND:
-    return 2;
-  case WDT_4_SECOND:
-    return 4;
-  case WDT_8_SECOND:
-    return 8;
-  default:
-    halt();
+bool wdt_time_of_day(uint32_t at, uint32_t *seconds) {
+  if (!RTC_TIME_SET) {
+    return false;
   }
-}
\ No newline at end of file
+  *seconds = (at + RTC_OFFSET) % RTC_DAY_SECONDS;
+  return true;
+}
+
+#endif /* RTC */
@@ -1,15 +1,112 @@
 #ifndef WDT_H
 #define WDT_H
 
+#include "event.h"
 #include <avr/io.h>
+#include <stdbool.h>
 
 /// The callback to be invoked by the WDT interrupt service routine.
 extern void wdt_tick();
 
-/// Enable the WDT interrupt timer.
-extern void wdt_sleep_seconds(uint32_t duration_seconds);
+/// Arm a WDT-driven timer that sets the event flag once the uptime clock (see
+/// wdt_uptime()) reaches at_seconds, replacing any timer for the same event.
+extern void wdt_timer_at(event_flags_t event, uint32_t at_seconds);
 
-/// Cancel a running WDT sleep countdown, or NOP if not running.
+/// Timers expire up to this many milliseconds early - half the shortest (16ms)
+/// WDT interval. A shorter timer sets its event flag as it is armed.
+#define WDT_TIMER_RESOLUTION_MS 8
+
+/// As wdt_timer_at(), but for a duration from now in milliseconds (which MUST
+/// be less than 2^23).
+extern void wdt_timer_arm_ms(event_flags_t event, uint32_t duration_ms);
+
+/// Disarm the timer for event, or NOP if not armed.
+extern void wdt_timer_cancel(event_flags_t event);
+
+/// Milliseconds until the timer for event expires, to within half the WDT
+/// interval in progress - or 0 if not armed.
+extern uint32_t wdt_timer_remaining_ms(event_flags_t event);
+
+/// Seconds until the nearest armed timer expires, or 0 if none are armed.
+extern uint32_t wdt_timer_next_expiry();
+
+/// Measure the WDT oscillator against the system clock, correcting the
+/// duration of all subsequent WDT sleeps.
+extern void wdt_calibrate();
+
+/// Disarm all timers, leaving the WDT advancing the uptime clock.
 extern void wdt_cancel();
 
+/// @brief Note the MCU is about to sleep - should another interrupt wake it
+/// part way through the WDT interval in progress, the time elapsed in it is
+/// unknown until the next WDT interrupt.
+///
+/// MUST be called with interrupts disabled, just before sleeping.
+extern void wdt_sleep();
+
+/// Seconds elapsed since the WDT was first started at boot.
+///
+/// Monotonic, and advanced by each WDT interrupt - deadlines scheduled against
+/// it do not drift with the time taken to handle each event. The part of the
+/// interval in progress is estimated if another interrupt woke the MCU.
+extern uint32_t wdt_uptime();
+
+/// As wdt_uptime(), but in milliseconds - wrapping, so only the difference
+/// between two readings is meaningful.
+extern uint32_t wdt_uptime_ms();
+
+#ifdef RTC
+
+/// The shortest sleep handed to the RTC alarm - nearer deadlines are timed by
+/// the WDT, resolving them to 16ms rather than to whole RTC seconds.
+#define WDT_SUSPEND_MIN_SECONDS 16
+
+/// The longest sleep handed to the RTC alarm, which matches the time of day -
+/// kept clear of a whole day so it can never match early.
+#define WDT_SUSPEND_MAX_SECONDS ((uint32_t)23 * 60 * 60)
+
+/// Read the RTC (see rtc.h), mapping the uptime clock onto its time - without
+/// a response every sleep is timed by the WDT alone.
+///
+/// MUST be called at boot, before the button pin change interrupt (shared
+/// with the alarm) is enabled.
+extern void wdt_rtc_init();
+
+/// @brief Stop the WDT and arm the RTC alarm for the nearest deadline, if at
+/// least WDT_SUSPEND_MIN_SECONDS away and no running peripheral needs the
+/// WDT - doing nothing if already suspended.
+///
+/// MUST be called with interrupts disabled, just before sleeping - a pin
+/// change interrupt while suspended MUST be handed to wdt_resume().
+extern void wdt_suspend();
+
+/// True between wdt_suspend() stopping the WDT and wdt_resume().
+extern bool wdt_suspended();
+
+/// @brief Disarm the RTC alarm, advance the uptime clock to the RTC time and
+/// restart the WDT - expiring any timers now due.
+///
+/// Returns true if woken by the alarm, false if by another pin change (the
+/// button).
+extern bool wdt_resume();
+
+/// @brief Set seconds to the time of day (seconds past midnight, by the RTC)
+/// at uptime second at.
+///
+/// Returns false if the time of day is unknown - the RTC is missing, or has
+/// lost its time.
+extern bool wdt_time_of_day(uint32_t at, uint32_t *seconds);
+
+#else
+
+#define wdt_rtc_init()                                                         \
+  do {                                                                         \
+  } while (0)
+#define wdt_suspend()                                                          \
+  do {                                                                         \
+  } while (0)
+#define wdt_time_of_day(at, seconds) false
+
+#endif /* RTC */
+
 #endif /* WDT_H */
\ No newline at end of file